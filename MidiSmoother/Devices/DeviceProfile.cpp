@@ -0,0 +1,69 @@
+//
+//  DeviceProfile.cpp
+//  MidiSmoother
+//
+
+#include "DeviceProfile.h"
+
+#include <deque>
+
+static std::deque<DeviceProfile> BuiltInProfiles()
+{
+	std::deque<DeviceProfile> profiles;
+	profiles.push_back( MakeDeviceProfile<Generic2048Device>() );
+	profiles.push_back( MakeDeviceProfile<Generic1024Device>() );
+	profiles.push_back( MakeDeviceProfile<HiRes8192Device>() );
+	profiles.push_back( MakeDeviceProfile<Hid16384Device>() );
+	return profiles;
+}
+
+static std::deque<DeviceProfile>& Registry()
+/*
+ * The registered devices, seeded with the built in profiles as the static is initialised, which
+ * happens once however many threads get here first. A deque so that registering a device never
+ * moves the ones already handed out.
+ */
+{
+	static std::deque<DeviceProfile> registry( BuiltInProfiles() );
+	return registry;
+}
+
+const DeviceProfile& DefaultDeviceProfile()
+{
+	return Registry()[0];
+}
+
+const DeviceProfile* FindDeviceProfile( const std::string& name )
+{
+	std::deque<DeviceProfile>& registry = Registry();
+	for( size_t i = 0; i < registry.size(); i++ )
+	{
+		if( name == registry[i].name )
+			return &registry[i];
+	}
+	return NULL;
+}
+
+int NumDeviceProfiles()
+{
+	return (int)Registry().size();
+}
+
+const DeviceProfile& DeviceProfileAt( int index )
+{
+	return Registry()[index];
+}
+
+void RegisterDeviceProfile( const DeviceProfile& profile )
+{
+	std::deque<DeviceProfile>& registry = Registry();
+	for( size_t i = 0; i < registry.size(); i++ )
+	{
+		if( std::string( profile.name ) == registry[i].name )
+		{
+			registry[i] = profile;
+			return;
+		}
+	}
+	registry.push_back( profile );
+}
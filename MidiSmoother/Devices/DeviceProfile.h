@@ -0,0 +1,130 @@
+//
+//  DeviceProfile.h
+//  MidiSmoother
+//
+//  Physical description of a platter controller and the smoother settings tuned for it.
+//
+//  Each device is described once as a traits struct, and the runtime registry used to select
+//  a device by name is built from the traits. The device is only known at run time, so the
+//  smoother folds the tick conversion into one constant per instance (MidiSmoother::mMsPerTick)
+//  rather than at compile time.
+//
+
+#ifndef __MidiSmoother__DeviceProfile__
+#define __MidiSmoother__DeviceProfile__
+
+#include <string>
+
+struct DeviceProfile
+{
+	const char* name;
+	int ticks_per_revolution;		// ticks reported for one whole turn of the platter
+	double seconds_per_revolution;	// song seconds one turn represents
+	double message_rate_hz;			// messages per second the device sends while moving
+	int tick_quantization;			// smallest change in ticks a message reports
+	int saturation_limit;			// the largest |ticks| a single message can carry
+	double max_velocity;			// the fastest a hand can spin the platter, in multiples of normal speed
+	const char* default_mode;		// MidiSmoother::SmoothingModeName of the tuned mode
+	int reversal_ticks;				// opposite direction ticks that make a change of direction
+	double stop_timeout_ms;			// ms without messages before the platter is considered stopped
+
+	double MsPerTick() const { return seconds_per_revolution * 1000.0 / ticks_per_revolution; }
+};
+
+// The 7 bit, 2048 tick controller the bundled captures were recorded from
+struct Generic2048Device
+{
+	static const char* Name() { return "generic-2048"; }
+	static constexpr int kTicksPerRevolution = 2048;
+	static constexpr double kSecondsPerRevolution = 1.8;
+	static constexpr double kMessageRateHz = 250;
+	static constexpr int kTickQuantization = 1;
+	static constexpr int kSaturationLimit = 63;
+	static constexpr double kMaxVelocity = 30;
+	static const char* DefaultMode() { return "regression"; }
+	static constexpr int kReversalTicks = 2;
+	static constexpr double kStopTimeoutMs = 15;
+};
+
+// A coarser 7 bit controller. The smoother settings are placeholders scaled from the 2048 tick
+// device, as there is no capture from one to tune them on
+struct Generic1024Device
+{
+	static const char* Name() { return "generic-1024"; }
+	static constexpr int kTicksPerRevolution = 1024;
+	static constexpr double kSecondsPerRevolution = 1.8;
+	static constexpr double kMessageRateHz = 250;
+	static constexpr int kTickQuantization = 1;
+	static constexpr int kSaturationLimit = 63;
+	static constexpr double kMaxVelocity = 30;
+	static const char* DefaultMode() { return "oneeuro"; }
+	static constexpr int kReversalTicks = 1;
+	static constexpr double kStopTimeoutMs = 20;
+};
+
+// 14 bit midi (paired CC) jog wheel polled at 1kHz. The smoother settings are placeholders, as
+// there is no capture from one to tune them on
+struct HiRes8192Device
+{
+	static const char* Name() { return "hires-8192"; }
+	static constexpr int kTicksPerRevolution = 8192;
+	static constexpr double kSecondsPerRevolution = 1.8;
+	static constexpr double kMessageRateHz = 1000;
+	static constexpr int kTickQuantization = 1;
+	static constexpr int kSaturationLimit = 8191;
+	static constexpr double kMaxVelocity = 30;
+	static const char* DefaultMode() { return "oneeuro"; }
+	static constexpr int kReversalTicks = 8;
+	static constexpr double kStopTimeoutMs = 8;
+};
+
+// HID jog wheel reporting 16 bit deltas at 1kHz. The smoother settings are placeholders, as
+// there is no capture from one to tune them on
+struct Hid16384Device
+{
+	static const char* Name() { return "hid-16384"; }
+	static constexpr int kTicksPerRevolution = 16384;
+	static constexpr double kSecondsPerRevolution = 1.8;
+	static constexpr double kMessageRateHz = 1000;
+	static constexpr int kTickQuantization = 1;
+	static constexpr int kSaturationLimit = 32767;
+	static constexpr double kMaxVelocity = 30;
+	static const char* DefaultMode() { return "oneeuro"; }
+	static constexpr int kReversalTicks = 16;
+	static constexpr double kStopTimeoutMs = 8;
+};
+
+template<typename Device>
+DeviceProfile MakeDeviceProfile()
+/*
+ * The runtime description of a device traits struct.
+ */
+{
+	DeviceProfile profile;
+	profile.name = Device::Name();
+	profile.ticks_per_revolution = Device::kTicksPerRevolution;
+	profile.seconds_per_revolution = Device::kSecondsPerRevolution;
+	profile.message_rate_hz = Device::kMessageRateHz;
+	profile.tick_quantization = Device::kTickQuantization;
+	profile.saturation_limit = Device::kSaturationLimit;
+	profile.max_velocity = Device::kMaxVelocity;
+	profile.default_mode = Device::DefaultMode();
+	profile.reversal_ticks = Device::kReversalTicks;
+	profile.stop_timeout_ms = Device::kStopTimeoutMs;
+	return profile;
+}
+
+// The device used when none is selected
+const DeviceProfile& DefaultDeviceProfile();
+
+// Looks up a registered device by name. Returns NULL if there is none
+const DeviceProfile* FindDeviceProfile( const std::string& name );
+
+int NumDeviceProfiles();
+
+const DeviceProfile& DeviceProfileAt( int index );
+
+// Adds a device to the registry, replacing any existing device with the same name
+void RegisterDeviceProfile( const DeviceProfile& profile );
+
+#endif /* defined(__MidiSmoother__DeviceProfile__) */
@@ -7,11 +7,22 @@
 //
 
 #include "MidiFirer.h"
+#include "Threading/ThreadConfig.h"
 
 #include <sstream>
 #include <chrono>
 
-MidiFirer::MidiEvent::MidiEvent( char midi_value, double interval ) :
+// events parsed ahead of the fire thread when streaming
+static const size_t kStreamQueueSize = 4096;
+// how long the reader waits for a followed file to grow
+static const int kFollowPollMs = 2;
+
+MidiFirer::MidiEvent::MidiEvent() :
+midi_value(0),
+interval(0)
+{}
+
+MidiFirer::MidiEvent::MidiEvent( int32_t midi_value, double interval ) :
 midi_value(midi_value),
 interval(interval)
 /*
@@ -33,12 +44,33 @@ interval(in_event.interval)
  */
 {}
 
+MidiFirer::MidiEvent& MidiFirer::MidiEvent::operator=( const MidiEvent& in_event )
+/*
+ * Assignment for a Midi Event, so events can be handed between threads through a queue.
+ */
+{
+	midi_value = in_event.midi_value;
+	interval = in_event.interval;
+	return *this;
+}
+
 MidiFirer::MidiFirer( MidiSmoother& smoother ) :
 mMidiSmoother( smoother ),
 mThreadStartMutex(),
 mThreadStart(),
 mFireThread(),
-mbThreadRunning(false)
+mbThreadRunning(false),
+mMidiEvents(),
+mNextEvent(0),
+mpStream(NULL),
+mbFollow(false),
+mReadThread(),
+mbReaderDone(false),
+mStreamQueue(kStreamQueueSize),
+mNextFireTime(),
+mPendingEvent(),
+mbHasPendingEvent(false),
+mpShadow(NULL)
 /*
  * Constructor for a Midi Firer class that will produce Midi and provide it to the smoother
  */
@@ -68,6 +100,7 @@ void MidiFirer::LoadMidiDataFromStream( std::istream& stream )
 	std::unique_lock<std::mutex> lock (mThreadStartMutex);
 	if( mbThreadRunning )
 		return;
+	mpStream = NULL;
 	
 	double interval;
 	int midi_value;
@@ -82,15 +115,44 @@ void MidiFirer::LoadMidiDataFromStream( std::istream& stream )
 		string_stream >> comma;
 		string_stream >> midi_value;
 		// push the event into the back of the list of midi events
-		mMidiEvents.push_back( MidiEvent( static_cast<char>(midi_value), interval ) );
+		mMidiEvents.push_back( MidiEvent( midi_value, interval ) );
 	}
 }
 
+void MidiFirer::StreamMidiDataFromStream( std::istream& stream, bool follow )
+/*
+ * Fires Midi events from a stream as they are read, rather than loading them all first. The stream
+ * is parsed on its own thread into a fixed size queue, so memory stays constant however long the
+ * stream is and firing starts as soon as the first line arrives. Lines that don't parse are skipped.
+ * The stream must outlive the firing, and a reader blocked on a live pipe only notices Stop once
+ * the next line (or the end of the stream) arrives.
+ *
+ * @param stream
+ *		The stream to read, in the same format as LoadMidiDataFromStream. May be stdin or a named pipe
+ * @param follow
+ *		If true the end of the stream is treated as the end of what has been written so far, as for a
+ *		file that is still being appended to, and firing continues until Stop is called
+ */
+{
+	std::unique_lock<std::mutex> lock (mThreadStartMutex);
+	if( mbThreadRunning )
+		return;
+	mpStream = &stream;
+	mbFollow = follow;
+}
+
 void MidiFirer::Start()
 /* 
  * Start the firing of midi events. This will continue asyncronously
  */
 {
+	mNextEvent = 0;
+	mbReaderDone = false;
+	// processing starts here rather than on the fire thread, so a consumer started after this
+	// never finds the smoother not yet processing and gives up
+	BeginFiring();
+	if( mpStream )
+		mReadThread = std::thread( &MidiFirer::ReadThreadFunction, this );
 	mFireThread = std::thread( &MidiFirer::FireThreadFunction, this );
 	std::unique_lock<std::mutex> lock (mThreadStartMutex);
     mbThreadRunning = true;
@@ -98,6 +160,58 @@ void MidiFirer::Start()
     
 }
 
+void MidiFirer::Schedule( Reactor& reactor )
+/*
+ * Fires the midi events from a task on the given reactor rather than from the firer's own thread.
+ * Events are fired on an absolute schedule from now, so the timing doesn't drift however late the
+ * task runs. A streaming source is still read on its own thread, as reading may block.
+ */
+{
+	mNextEvent = 0;
+	mbReaderDone = false;
+	mbHasPendingEvent = false;
+	{
+		std::unique_lock<std::mutex> lock (mThreadStartMutex);
+		mbThreadRunning = true;
+	}
+	if( mpStream )
+		mReadThread = std::thread( &MidiFirer::ReadThreadFunction, this );
+
+	mMidiSmoother.StartMidiProcessing( reactor );
+	if( mpShadow )
+		mpShadow->Begin();
+	mNextFireTime = Reactor::Clock::now();
+	reactor.Schedule( "firer", mNextFireTime, [this]( Reactor::Clock::time_point now, Reactor::Clock::time_point& next )
+	{
+		while( mbThreadRunning )
+		{
+			if( !mbHasPendingEvent )
+			{
+				bool finished;
+				if( !TryNextEvent( mPendingEvent, finished ) )
+				{
+					if( finished )
+						break;
+					// the stream hasn't caught up yet
+					next = now + std::chrono::milliseconds( 1 );
+					return true;
+				}
+				mbHasPendingEvent = true;
+				mNextFireTime += std::chrono::duration_cast<Reactor::Clock::duration>( std::chrono::duration<double>( mPendingEvent.interval ) );
+			}
+			if( mNextFireTime > now )
+			{
+				next = mNextFireTime;
+				return true;
+			}
+			Fire( mPendingEvent.midi_value );
+			mbHasPendingEvent = false;
+		}
+		EndFiring();
+		return false;
+	} );
+}
+
 void MidiFirer::Stop()
 /*
  * Stop the firing of midi events. This will wait for the thread to end
@@ -111,6 +225,8 @@ void MidiFirer::Stop()
 	}
 	if( mFireThread.joinable())
 		mFireThread.join();
+	if( mReadThread.joinable())
+		mReadThread.join();
     
 }
 
@@ -121,6 +237,117 @@ void MidiFirer::WaitForCompletion()
 {
 	if( mFireThread.joinable())
 		mFireThread.join();
+	if( mReadThread.joinable())
+		mReadThread.join();
+}
+
+bool MidiFirer::ParseMidiEvent( const std::string& line, MidiEvent& event )
+/*
+ * Parses a single line of the two column csv.
+ */
+{
+	std::istringstream string_stream( line );
+	char comma;
+	return static_cast<bool>( string_stream >> event.interval >> comma >> event.midi_value );
+}
+
+void MidiFirer::ReadThreadFunction()
+/*
+ * Run by the reader thread when streaming. Parses lines into mStreamQueue, waiting while the queue
+ * is full, until the stream ends (or, when following, until stopped).
+ */
+{
+    // wait for the explicit start message
+	{
+		std::unique_lock<std::mutex> lock (mThreadStartMutex);
+		if( !mbThreadRunning ){
+			mThreadStart.wait( lock );
+		}
+	}
+
+	std::string line, partial;
+	MidiEvent event;
+	while( mbThreadRunning )
+	{
+		if( !std::getline( *mpStream, line ) )
+		{
+			if( !mbFollow )
+				break;
+			mpStream->clear();
+			std::this_thread::sleep_for( std::chrono::milliseconds( kFollowPollMs ) );
+			continue;
+		}
+		// a followed file may end part way through a line that is still being written
+		if( mpStream->eof() && mbFollow )
+		{
+			partial += line;
+			mpStream->clear();
+			std::this_thread::sleep_for( std::chrono::milliseconds( kFollowPollMs ) );
+			continue;
+		}
+		if( !partial.empty() )
+		{
+			line = partial + line;
+			partial.clear();
+		}
+		if( !ParseMidiEvent( line, event ) )
+			continue;
+		while( !mStreamQueue.Push( event ) && mbThreadRunning )
+			std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+	}
+	mbReaderDone = true;
+}
+
+bool MidiFirer::TryNextEvent( MidiEvent& event, bool& finished )
+/*
+ * The next event to fire if one is available now, either from those loaded or from the stream.
+ * finished is set once every event has been fired.
+ */
+{
+	finished = false;
+	if( !mpStream )
+	{
+		finished = mNextEvent >= mMidiEvents.size();
+		if( finished )
+			return false;
+		event = mMidiEvents[mNextEvent++];
+		return true;
+	}
+	if( mStreamQueue.Pop( event ) )
+	{
+		mMidiSmoother.Metrics().input_queue_depth.Set( (double)mStreamQueue.Size() );
+		return true;
+	}
+	// the reader may have pushed its last events just before finishing
+	if( mbReaderDone )
+	{
+		if( mStreamQueue.Pop( event ) )
+			return true;
+		finished = true;
+	}
+	return false;
+}
+
+bool MidiFirer::NextEvent( MidiEvent& event )
+/*
+ * The next event to fire. When streaming this waits for the reader, and returns false once the
+ * reader has finished and everything has been fired.
+ */
+{
+	int spins = 0;
+	bool finished;
+	while( mbThreadRunning )
+	{
+		if( TryNextEvent( event, finished ) )
+			return true;
+		if( finished )
+			return false;
+		if( ++spins < 64 )
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+	}
+	return false;
 }
 
 
@@ -132,6 +359,8 @@ void MidiFirer::FireThreadFunction()
  *		The provided threading context. In this case it is an instance of a MidiFirer
  */
 {   
+	ApplyThreadSettings( kThreadRoleMidi );
+
     // wait for the explicit start message
 	{
 		std::unique_lock<std::mutex> lock (mThreadStartMutex);
@@ -141,25 +370,54 @@ void MidiFirer::FireThreadFunction()
 	}
     
 	// iterate over all events
-    std::vector<MidiEvent>::const_iterator event_it = mMidiEvents.begin();
-    std::vector<MidiEvent>::const_iterator event_it_end = mMidiEvents.end();
+    MidiEvent event;
 	
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-	mMidiSmoother.StartMidiProcessing();
-    while( mbThreadRunning && event_it != event_it_end )
+    while( mbThreadRunning && NextEvent( event ) )
     {
 		// determine how long we took to send the last event
 		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 		std::chrono::duration<int,std::micro> duration_micro = std::chrono::duration_cast< std::chrono::duration<int,std::micro> >(end-start);
 		
         // first sleep for the required interval
-        std::chrono::microseconds interval = std::chrono::microseconds(static_cast<long long>((*event_it).interval * 1000000) - duration_micro.count() ) ;
+        std::chrono::microseconds interval = std::chrono::microseconds(static_cast<long long>(event.interval * 1000000) - duration_micro.count() ) ;
         std::this_thread::sleep_for( interval );
 		start = std::chrono::steady_clock::now();
+		mWakeupLatency.Record( std::chrono::duration<double,std::micro>( start - ( end + interval ) ).count() );
 		
 		// then send the event
-        mMidiSmoother.NotifyMidiValue( (*event_it).midi_value );
-        event_it++;
+        Fire( event.midi_value );
     }
+	EndFiring();
+}
+
+void MidiFirer::BeginFiring()
+{
+	mMidiSmoother.StartMidiProcessing();
+	if( mpShadow )
+		mpShadow->Begin();
+}
+
+void MidiFirer::EndFiring()
+{
+	if( mpShadow )
+		mpShadow->End();
 	mMidiSmoother.StopMidiProcessing();
+}
+
+void MidiFirer::Fire( int32_t midi_value )
+/*
+ * Gives an event to the smoother, and then to the shadow with the time the smoother saw it.
+ */
+{
+	if( !mpShadow )
+	{
+		mMidiSmoother.NotifyMidiValue( midi_value );
+		return;
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double time_ms = mMidiSmoother.CurrentTimeMs();
+	mMidiSmoother.NotifyMidiValue( midi_value, time_ms );
+	double cost_ns = std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count();
+	mpShadow->NotifyMidi( midi_value, time_ms, cost_ns );
 }
\ No newline at end of file
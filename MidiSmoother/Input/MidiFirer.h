@@ -14,8 +14,11 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 
 #include "MidiSmoother.h"
+#include "Output/ShadowComparison.h"
+#include "Threading/SpscQueue.h"
 
 class MidiFirer
 {
@@ -23,27 +26,61 @@ public:
     MidiFirer( MidiSmoother& smoother );
     ~MidiFirer();
 	void LoadMidiDataFromStream( std::istream& stream );
+	void StreamMidiDataFromStream( std::istream& stream, bool follow );
     void Start();
+    void Schedule( Reactor& reactor );
     void Stop();
     void WaitForCompletion();
+
+    // Hands every event to a shadow smoother as well, after the primary. Set before starting
+    void SetShadow( ShadowComparison* shadow ) { mpShadow = shadow; }
+
+    // How late the firing thread woke for each event, in us. Read once firing has finished
+    const LatencyHistogram& WakeupLatency() const { return mWakeupLatency; }
 private:
     struct MidiEvent
     {
-        MidiEvent( char midi_value, double interval );
+        MidiEvent();
+        MidiEvent( int32_t midi_value, double interval );
         MidiEvent( const MidiEvent& in_event );
-        char midi_value;
+        MidiEvent& operator=( const MidiEvent& in_event );
+        int32_t midi_value;
         double interval;
     };
 private:
     void FireThreadFunction();
+    void ReadThreadFunction();
+    bool NextEvent( MidiEvent& event );
+    bool TryNextEvent( MidiEvent& event, bool& finished );
+    static bool ParseMidiEvent( const std::string& line, MidiEvent& event );
+    void Fire( int32_t midi_value );
+    void BeginFiring();
+    void EndFiring();
     MidiSmoother& mMidiSmoother;
     
     std::mutex mThreadStartMutex;
     std::condition_variable mThreadStart;
     std::thread	mFireThread;
-    bool mbThreadRunning;
+    std::atomic<bool> mbThreadRunning;
     
     std::vector<MidiEvent> mMidiEvents;
+    size_t mNextEvent;
+    
+    // streaming input, parsed on mReadThread as it arrives
+    std::istream* mpStream;
+    bool mbFollow;
+    std::thread mReadThread;
+    std::atomic<bool> mbReaderDone;
+    SpscQueue<MidiEvent> mStreamQueue;
+    
+    // firing from a reactor task
+    Reactor::Clock::time_point mNextFireTime;
+    MidiEvent mPendingEvent;
+    bool mbHasPendingEvent;
+
+    LatencyHistogram mWakeupLatency;
+
+    ShadowComparison* mpShadow;
 };
 
 #endif /* defined(__MidiFirer__MidiFirer__) */
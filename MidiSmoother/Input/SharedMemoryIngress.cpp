@@ -0,0 +1,429 @@
+//
+//  SharedMemoryIngress.cpp
+//  MidiSmoother
+//
+
+#include "SharedMemoryIngress.h"
+#include "Threading/SpscQueue.h"
+#include "Threading/ThreadConfig.h"
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+static const uint32_t kRingMagic = 0x4944494d;	// "MIDI"
+static const uint32_t kRingVersion = 2;
+// events handed to the smoother under a single lock
+static const size_t kIngressBatchSize = 64;
+// how long the ingress sleeps at most before checking whether it has been stopped (ms)
+static const int kIngressWaitMs = 10;
+
+struct SharedMidiRingHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;							// slots, a power of two
+	std::atomic<uint32_t> producer_done;
+	std::atomic<uint32_t> consumer_waiting;
+	std::atomic<uint32_t> wake;					// futex word, bumped to wake a waiting consumer
+	std::atomic<int32_t> consumer_pid;			// the process that created the ring
+	std::atomic<int32_t> producer_pid;			// the process that last attached to it, 0 until one does
+
+	alignas( kCacheLineSize ) std::atomic<uint64_t> head;	// next event to read, written by the consumer
+	alignas( kCacheLineSize ) std::atomic<uint64_t> tail;	// next slot to write, written by the producer
+};
+
+// the slots start on the cache line after the header
+static const size_t kSlotsOffset = ( sizeof( SharedMidiRingHeader ) + kCacheLineSize - 1 ) / kCacheLineSize * kCacheLineSize;
+
+const char* const SharedMidiRing::kDefaultName = "/midismoother";
+
+SharedMidiRing::SharedMidiRing() :
+mName(),
+mbOwner( false ),
+mCachedHead( 0 ),
+mMappedSize( 0 ),
+mHeader( NULL ),
+mSlots( NULL )
+{
+}
+
+SharedMidiRing::~SharedMidiRing()
+{
+	Close();
+}
+
+int64_t SharedMidiRing::NowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+#ifndef _WIN32
+
+static bool ProcessAlive( int32_t pid )
+{
+	return kill( (pid_t)pid, 0 ) == 0 || errno == EPERM;
+}
+
+static bool RingInUse( const std::string& name )
+/*
+ * Whether the ring of that name belongs to a consumer that is still running. A ring too small or
+ * not yet marked as built was left by a consumer that died making it; one of another version
+ * can't be told about, so is taken to be in use.
+ */
+{
+	int fd = shm_open( name.c_str(), O_RDONLY, 0 );
+	if( fd < 0 )
+		return false;
+	struct stat status;
+	if( fstat( fd, &status ) != 0 || (size_t)status.st_size < kSlotsOffset )
+	{
+		close( fd );
+		return false;
+	}
+	void* memory = mmap( NULL, kSlotsOffset, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( memory == MAP_FAILED )
+		return true;
+	const SharedMidiRingHeader* header = static_cast<const SharedMidiRingHeader*>( memory );
+	bool in_use;
+	if( header->magic != kRingMagic )
+		in_use = false;
+	else if( header->version != kRingVersion )
+		in_use = true;
+	else
+		in_use = ProcessAlive( header->consumer_pid.load( std::memory_order_relaxed ) );
+	munmap( memory, kSlotsOffset );
+	return in_use;
+}
+
+bool SharedMidiRing::Map( int fd, size_t size )
+{
+	void* memory = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( memory == MAP_FAILED )
+		return false;
+	mMappedSize = size;
+	mHeader = static_cast<SharedMidiRingHeader*>( memory );
+	mSlots = reinterpret_cast<SharedMidiEvent*>( static_cast<char*>( memory ) + kSlotsOffset );
+	return true;
+}
+
+bool SharedMidiRing::Create( const std::string& name, size_t capacity )
+/*
+ * @param name
+ *		The shared memory object's name, starting with a /
+ * @param capacity
+ *		The least number of events the ring must hold. Rounded up to a power of two
+ */
+{
+	Close();
+	size_t slots = 2;
+	while( slots < capacity )
+		slots <<= 1;
+	size_t size = kSlotsOffset + slots * sizeof( SharedMidiEvent );
+
+	// a ring left behind by a consumer that crashed is replaced, but one still in use is not
+	int fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600 );
+	if( fd < 0 && errno == EEXIST && !RingInUse( name ) )
+	{
+		shm_unlink( name.c_str() );
+		fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600 );
+	}
+	if( fd < 0 )
+		return false;
+	if( ftruncate( fd, (off_t)size ) != 0 || !Map( fd, size ) )
+	{
+		shm_unlink( name.c_str() );
+		return false;
+	}
+	mName = name;
+	mbOwner = true;
+
+	new( mHeader ) SharedMidiRingHeader();
+	mHeader->capacity = slots;
+	mHeader->version = kRingVersion;
+	mHeader->producer_done = 0;
+	mHeader->consumer_waiting = 0;
+	mHeader->wake = 0;
+	mHeader->consumer_pid = (int32_t)getpid();
+	mHeader->producer_pid = 0;
+	mHeader->head = 0;
+	mHeader->tail = 0;
+	// written last, so a producer never attaches to a half built ring
+	std::atomic_thread_fence( std::memory_order_release );
+	mHeader->magic = kRingMagic;
+	return true;
+}
+
+bool SharedMidiRing::Open( const std::string& name )
+{
+	Close();
+	int fd = shm_open( name.c_str(), O_RDWR, 0 );
+	if( fd < 0 )
+		return false;
+	struct stat status;
+	if( fstat( fd, &status ) != 0 || (size_t)status.st_size < kSlotsOffset )
+	{
+		close( fd );
+		return false;
+	}
+	if( !Map( fd, (size_t)status.st_size ) )
+		return false;
+	std::atomic_thread_fence( std::memory_order_acquire );
+	if( mHeader->magic != kRingMagic || mHeader->version != kRingVersion ||
+		kSlotsOffset + mHeader->capacity * sizeof( SharedMidiEvent ) > mMappedSize )
+	{
+		Close();
+		return false;
+	}
+	mName = name;
+	mbOwner = false;
+	mCachedHead = mHeader->head.load( std::memory_order_acquire );
+	mHeader->producer_pid.store( (int32_t)getpid(), std::memory_order_release );
+	return true;
+}
+
+bool SharedMidiRing::ProducerAlive() const
+{
+	int32_t pid = mHeader->producer_pid.load( std::memory_order_acquire );
+	return pid == 0 || ProcessAlive( pid );
+}
+
+void SharedMidiRing::Close()
+{
+	if( mHeader )
+		munmap( mHeader, mMappedSize );
+	if( mbOwner )
+		shm_unlink( mName.c_str() );
+	mHeader = NULL;
+	mSlots = NULL;
+	mMappedSize = 0;
+	mbOwner = false;
+}
+
+#else
+
+bool SharedMidiRing::Map( int, size_t )
+{
+	return false;
+}
+
+bool SharedMidiRing::Create( const std::string&, size_t )
+{
+	return false;
+}
+
+bool SharedMidiRing::Open( const std::string& )
+{
+	return false;
+}
+
+bool SharedMidiRing::ProducerAlive() const
+{
+	return true;
+}
+
+void SharedMidiRing::Close()
+{
+}
+
+#endif
+
+static void WakeConsumer( std::atomic<uint32_t>& word )
+{
+#ifdef __linux__
+	syscall( SYS_futex, reinterpret_cast<uint32_t*>( &word ), FUTEX_WAKE, 1, NULL, NULL, 0 );
+#else
+	(void)word;
+#endif
+}
+
+bool SharedMidiRing::Push( int32_t ticks, int64_t time_ns )
+{
+	uint64_t tail = mHeader->tail.load( std::memory_order_relaxed );
+	if( tail - mCachedHead >= mHeader->capacity )
+	{
+		mCachedHead = mHeader->head.load( std::memory_order_acquire );
+		if( tail - mCachedHead >= mHeader->capacity )
+			return false;
+	}
+	SharedMidiEvent& slot = mSlots[tail & ( mHeader->capacity - 1 )];
+	slot.ticks = ticks;
+	slot.reserved = 0;
+	slot.time_ns = time_ns;
+	mHeader->tail.store( tail + 1, std::memory_order_release );
+
+	// pairs with the consumer announcing itself before checking for events
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	if( mHeader->consumer_waiting.load( std::memory_order_relaxed ) )
+	{
+		mHeader->wake.fetch_add( 1, std::memory_order_release );
+		WakeConsumer( mHeader->wake );
+	}
+	return true;
+}
+
+void SharedMidiRing::MarkDone()
+{
+	mHeader->producer_done.store( 1, std::memory_order_release );
+	mHeader->wake.fetch_add( 1, std::memory_order_release );
+	WakeConsumer( mHeader->wake );
+}
+
+bool SharedMidiRing::ProducerDone() const
+{
+	return mHeader->producer_done.load( std::memory_order_acquire ) != 0;
+}
+
+size_t SharedMidiRing::Peek( const SharedMidiEvent*& events ) const
+{
+	uint64_t head = mHeader->head.load( std::memory_order_relaxed );
+	uint64_t tail = mHeader->tail.load( std::memory_order_acquire );
+	uint64_t index = head & ( mHeader->capacity - 1 );
+	events = mSlots + index;
+	return (size_t)std::min( tail - head, mHeader->capacity - index );
+}
+
+void SharedMidiRing::Release( size_t count )
+{
+	mHeader->head.fetch_add( count, std::memory_order_release );
+}
+
+void SharedMidiRing::Wait( int timeout_ms )
+/*
+ * Announces that the consumer is about to sleep, then sleeps only if there is still nothing to
+ * read, so a producer pushing at the same moment either is seen here or sees the announcement.
+ */
+{
+	uint32_t seen = mHeader->wake.load( std::memory_order_acquire );
+	mHeader->consumer_waiting.store( 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	bool empty = mHeader->tail.load( std::memory_order_relaxed ) == mHeader->head.load( std::memory_order_relaxed );
+	if( empty && !ProducerDone() )
+	{
+#ifdef __linux__
+		struct timespec timeout;
+		timeout.tv_sec = timeout_ms / 1000;
+		timeout.tv_nsec = ( timeout_ms % 1000 ) * 1000000L;
+		syscall( SYS_futex, reinterpret_cast<uint32_t*>( &mHeader->wake ), FUTEX_WAIT, seen, &timeout, NULL, 0 );
+#else
+		(void)seen;
+		std::this_thread::sleep_for( std::chrono::microseconds( 200 ) );
+#endif
+	}
+	mHeader->consumer_waiting.store( 0, std::memory_order_relaxed );
+}
+
+SharedMemoryIngress::SharedMemoryIngress( MidiSmoother& smoother ) :
+mMidiSmoother( smoother ),
+mRing(),
+mIngressThread(),
+mbThreadRunning( false ),
+mbProducerLost( false ),
+mLatency()
+/*
+ * Constructor for an ingress that will feed the given smoother from shared memory.
+ */
+{
+}
+
+SharedMemoryIngress::~SharedMemoryIngress()
+{
+	Stop();
+}
+
+bool SharedMemoryIngress::Open( const std::string& name, size_t capacity )
+/*
+ * Creates the ring for a producer to attach to. Must be called before Start.
+ */
+{
+	return mRing.Create( name, capacity );
+}
+
+void SharedMemoryIngress::Start()
+/*
+ * Starts processing straight away, rather than on the ingress thread, so that a consumer started
+ * next never sees the smoother idle.
+ */
+{
+	mLatency.Reset();
+	mbProducerLost = false;
+	mMidiSmoother.StartMidiProcessing();
+	mbThreadRunning = true;
+	mIngressThread = std::thread( &SharedMemoryIngress::IngressThreadFunction, this );
+}
+
+void SharedMemoryIngress::Stop()
+{
+	mbThreadRunning = false;
+	if( mIngressThread.joinable() )
+		mIngressThread.join();
+}
+
+void SharedMemoryIngress::WaitForCompletion()
+{
+	if( mIngressThread.joinable() )
+		mIngressThread.join();
+}
+
+void SharedMemoryIngress::IngressThreadFunction()
+/*
+ * Hands events to the smoother in batches straight from the ring, placing each one on the
+ * smoother's clock at the time the driver saw it.
+ */
+{
+	ApplyThreadSettings( kThreadRoleMidi );
+
+	MidiSmoother::MidiDelta batch[kIngressBatchSize];
+	while( mbThreadRunning )
+	{
+		const SharedMidiEvent* events;
+		size_t count = mRing.Peek( events );
+		if( count == 0 )
+		{
+			if( mRing.ProducerDone() && mRing.Peek( events ) == 0 )
+				break;
+			// a producer that exits without marking the ring done would otherwise be waited for forever
+			if( !mRing.ProducerAlive() && mRing.Peek( events ) == 0 )
+			{
+				mbProducerLost = true;
+				break;
+			}
+			mRing.Wait( kIngressWaitMs );
+			continue;
+		}
+		mMidiSmoother.Metrics().input_queue_depth.Set( (double)count );
+		count = std::min( count, kIngressBatchSize );
+
+		int64_t now_ns = SharedMidiRing::NowNs();
+		double now_ms = mMidiSmoother.CurrentTimeMs();
+		for( size_t i = 0; i < count; i++ )
+		{
+			batch[i].ticks = events[i].ticks;
+			batch[i].time_ms = now_ms - ( now_ns - events[i].time_ns ) / 1e6;
+		}
+		mMidiSmoother.NotifyMidiValues( batch, count );
+
+		// the latency runs until the smoother has the event
+		int64_t delivered_ns = SharedMidiRing::NowNs();
+		for( size_t i = 0; i < count; i++ )
+			mLatency.Record( ( delivered_ns - events[i].time_ns ) / 1000.0 );
+		mRing.Release( count );
+	}
+	mMidiSmoother.StopMidiProcessing();
+}
@@ -0,0 +1,132 @@
+//
+//  SharedMemoryIngress.h
+//  MidiSmoother
+//
+//  Feeds a MidiSmoother from a controller driver running in another process. The two sides
+//  share a single producer / single consumer ring of timestamped tick events in POSIX shared
+//  memory: the driver writes events straight into the ring's slots and the smoother reads
+//  them from the same memory, so nothing is copied through the kernel. A consumer with
+//  nothing to do sleeps on a futex in the ring (a short poll where futexes are unavailable),
+//  and the driver only makes the wake system call when the consumer is actually asleep.
+//
+//  Timestamps are on the steady clock, which is system wide, so the consumer can both place
+//  each event on the smoother's clock and measure how long it took to cross between the
+//  processes.
+//
+//  Only available on POSIX systems; elsewhere Create and Open fail.
+//
+
+#ifndef __MidiSmoother__SharedMemoryIngress__
+#define __MidiSmoother__SharedMemoryIngress__
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <stdint.h>
+
+#include "MidiSmoother.h"
+#include "Threading/LatencyHistogram.h"
+
+struct SharedMidiEvent
+{
+	int32_t ticks;
+	int32_t reserved;
+	int64_t time_ns;		// steady clock time the driver saw the movement
+};
+
+struct SharedMidiRingHeader;
+
+class SharedMidiRing
+{
+public:
+	static const char* const kDefaultName;
+
+	SharedMidiRing();
+
+	~SharedMidiRing();
+
+	// Consumer side. Creates the ring, which is removed again by Close. A ring of the same name
+	// left by a consumer that has exited is replaced; one whose consumer is still running is not,
+	// and Create fails
+	bool Create( const std::string& name, size_t capacity );
+
+	// Producer side. Attaches to a ring the consumer has created
+	bool Open( const std::string& name );
+
+	void Close();
+
+	bool IsOpen() const { return mHeader != NULL; }
+
+	// Producer only. Returns false, dropping the event, if the ring is full
+	bool Push( int32_t ticks, int64_t time_ns );
+
+	// Producer only. Tells the consumer no more events will come
+	void MarkDone();
+
+	// Consumer only. Points events at the oldest unread events, returning how many can be read
+	// in place (which may be fewer than are waiting if the ring wraps)
+	size_t Peek( const SharedMidiEvent*& events ) const;
+
+	// Consumer only. Frees the slots of the oldest count events for reuse
+	void Release( size_t count );
+
+	// Consumer only. Sleeps until an event may have arrived or the timeout passes
+	void Wait( int timeout_ms );
+
+	bool ProducerDone() const;
+
+	// Consumer only. False once the producer that attached has exited, whether or not it marked
+	// the ring done. True while none has attached
+	bool ProducerAlive() const;
+
+	static int64_t NowNs();
+private:
+	SharedMidiRing( const SharedMidiRing& );
+	SharedMidiRing& operator=( const SharedMidiRing& );
+
+	bool Map( int fd, size_t size );
+
+	std::string mName;
+	bool mbOwner;
+	uint64_t mCachedHead;		// the producer's copy of the consumer's position
+	size_t mMappedSize;
+	SharedMidiRingHeader* mHeader;
+	SharedMidiEvent* mSlots;
+};
+
+class SharedMemoryIngress
+{
+public:
+	SharedMemoryIngress( MidiSmoother& smoother );
+
+	~SharedMemoryIngress();
+
+	bool Open( const std::string& name, size_t capacity );
+
+	void Start();
+
+	void Stop();
+
+	// Waits for the producer to finish, or exit without saying so, and every event to be delivered
+	void WaitForCompletion();
+
+	// Whether the producer exited without marking the ring done
+	bool ProducerLost() const { return mbProducerLost; }
+
+	// The time each event took from the driver's timestamp to reaching the smoother. Only
+	// valid once the ingress has stopped
+	const LatencyHistogram& Latency() const { return mLatency; }
+
+	uint64_t Events() const { return mLatency.Count(); }
+private:
+	void IngressThreadFunction();
+
+	MidiSmoother& mMidiSmoother;
+	SharedMidiRing mRing;
+	std::thread mIngressThread;
+	std::atomic<bool> mbThreadRunning;
+	std::atomic<bool> mbProducerLost;
+	LatencyHistogram mLatency;
+};
+
+#endif /* defined(__MidiSmoother__SharedMemoryIngress__) */
@@ -7,6 +7,8 @@
 //
 
 #include "MidiSmoother.h"
+#include "Threading/ThreadConfig.h"
+#include "Threading/Tracer.h"
 
 #include <iostream>
 #include <complex>
@@ -14,24 +16,86 @@
 #include <thread>
 #include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <limits>
 #include <vector>
 
 #define PI acos(-1)
 
+const double MidiSmoother::kNoTimestamp = -1e300;
 
+// how often the smoother's periodic work runs
+static const double kServiceIntervalMs = 7 * 30 / 44.1;
 
 
+
+
+bool MidiSmoother::SmoothingModeFromName(const std::string& name, SmoothingMode& mode)
+/*
+ * Looks up a smoothing mode by the name used on the command line.
+ *
+ * @return
+ *		false if no mode has that name
+ */
+{
+    if (name == "regression")
+        mode = kSmoothingRegression;
+    else if (name == "spline")
+        mode = kSmoothingSpline;
+    else if (name == "oneeuro")
+        mode = kSmoothingOneEuro;
+    else if (name == "robust")
+        mode = kSmoothingRobust;
+    else if (name == "lastdelta")
+        mode = kSmoothingLastDelta;
+    else
+        return false;
+    return true;
+}
+
+const char* MidiSmoother::SmoothingModeName(SmoothingMode mode)
+{
+    switch (mode)
+    {
+    case kSmoothingSpline: return "spline";
+    case kSmoothingOneEuro: return "oneeuro";
+    case kSmoothingRobust: return "robust";
+    case kSmoothingLastDelta: return "lastdelta";
+    case kSmoothingRegression:
+    default: return "regression";
+    }
+}
+
+SmoothingModel* MidiSmoother::CreateModel(SmoothingMode mode)
+/*
+ * Creates a stand alone model for offline use, configured as MidiSmoother configures its own.
+ */
+{
+    switch (mode)
+    {
+    case kSmoothingSpline: return new HermiteSplineModel(SplineTangentSpan, SplineHorizonIntervals);
+    case kSmoothingOneEuro: return new OneEuroModel(OneEuroMinCutoff, OneEuroBeta, OneEuroDerivativeCutoff);
+    case kSmoothingRobust: return new RobustRegressionModel(RobustWindow);
+    case kSmoothingLastDelta: return new LastDeltaModel();
+    case kSmoothingRegression:
+    default: return new LinearRegressionModel(MaxNum);
+    }
+}
+
+static DeviceProfile CustomDevice(int midi_values_per_revolution, double seconds_per_revolution)
+/*
+ * A device like the default one but with the given platter resolution.
+ */
+{
+    DeviceProfile device = DefaultDeviceProfile();
+    device.name = "custom";
+    device.ticks_per_revolution = midi_values_per_revolution;
+    device.seconds_per_revolution = seconds_per_revolution;
+    return device;
+}
+
 MidiSmoother::MidiSmoother(int midi_values_per_revolution, double seconds_per_revolution) :
-    mMidiValuesPerRevolution(midi_values_per_revolution),
-    mSecondsPerRevolution(seconds_per_revolution),
-    mbMidiIsProcessing(false),
-    mThreadStartMutex(),
-    mThreadStart(),
-    mMidiSmoothThread(),
-    mbThreadRunning(false),
-    mNum(0), //indicate the last input
-    mPos(0), //indicate the last output
-    mLastVelocity(0.0)
+    MidiSmoother(CustomDevice(midi_values_per_revolution, seconds_per_revolution))
     /*
      * Constructor for a Midi Smoother.
      *
@@ -41,19 +105,395 @@ MidiSmoother::MidiSmoother(int midi_values_per_revolution, double seconds_per_re
      *		The number of seconds an entire platter revolution represents
      */
 {
+}
+
+MidiSmoother::MidiSmoother(const DeviceProfile& device) :
+    mMidiValuesPerRevolution(device.ticks_per_revolution),
+    mSecondsPerRevolution(device.seconds_per_revolution),
+    mMsPerTick(device.MsPerTick()),
+    mDevice(device),
+    mbMidiIsProcessing(false),
+    mThreadStartMutex(),
+    mThreadStart(),
+    mMidiSmoothThread(),
+    mbThreadRunning(false),
+    mPublished(),
+    mReadersMutex(),
+    mReaders(),
+    mSmoothingMode(kSmoothingRegression),
+    mLatencyBudget(-1),
+    mModel(&mRegressionModel),
+    mRegressionModel(MaxNum),
+    mSplineModel(SplineTangentSpan, SplineHorizonIntervals),
+    mOneEuroModel(OneEuroMinCutoff, OneEuroBeta, OneEuroDerivativeCutoff),
+    mRobustModel(RobustWindow),
+    mLastDeltaModel(),
+    mPredictiveModel(0),
+    mWarmupModel(WarmupMessages, 1000.0 / device.message_rate_hz, WarmupSlopeSpanMs, device.reversal_ticks * device.MsPerTick()),
+    mbWarmup(true),
+    mUpdateBudget(-1),
+    mLadderSize(1),
+    mLevel(0),
+    mUpdateCost(0),
+    mLevelUpdates(0),
+    mHeadroomUpdates(0),
+    mRecoveryUpdates(QosRecoveryUpdates),
+    mUpdatesSinceUpgrade(std::numeric_limits<uint64_t>::max()),
+    mHistoryCount(0),
+    mHistoryPos(0),
+    mFadeFrom(),
+    mFadeStartMs(0),
+    mFadeMs(0),
+    mReversalTicks(device.reversal_ticks),
+    mStopTimeout(device.stop_timeout_ms),
+    mDirection(0),
+    mOppositeTicks(0),
+    mbHasEvent(false),
+    mbStopped(false),
+    mbParked(false),
+    mLastEventMs(0),
+    mLastIntervalMs(0),
+    mSaturation(device, SaturationPushMs, SaturationCoastMs),
+    mSaturationDirection(0),
+    mLastVelocity(0)
+    /*
+     * Constructor for a Midi Smoother tuned for a particular controller.
+     *
+     * @param device
+     *		The controller's platter resolution and the smoother settings tuned for it
+     */
+{
+    mLadder[0] = kSmoothingRegression;
+    SmoothingMode mode;
+    if (SmoothingModeFromName(device.default_mode, mode))
+        SetSmoothingMode(mode);
+}
 
+const DeviceProfile& MidiSmoother::GetDeviceProfile() const
+{
+    return mDevice;
 }
 
-void MidiSmoother::StartMidiProcessing()
+void MidiSmoother::SetSmoothingMode(SmoothingMode mode)
 /*
- * Indicates that the midi processing is about to begin!
+ * Selects the model used to smooth the midi. Takes effect immediately, with the new model
+ * starting from no history.
+ */
+{
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    mSmoothingMode = mode;
+    SelectModel();
+}
+
+void MidiSmoother::SetLatencyBudget(double latency_budget_ms)
+/*
+ * Asks the smoother to extrapolate its model forwards so that its output lags the platter by no
+ * more than the given latency, as far as the model's own group delay estimate allows.
+ *
+ * @param latency_budget_ms
+ *		The allowed latency in ms. Negative turns prediction off
+ */
+{
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    mLatencyBudget = latency_budget_ms;
+    SelectModel();
+}
+
+double MidiSmoother::EffectiveLatency() const
+/*
+ * @return
+ *		The latency (ms) the output has had on average when predicting, otherwise the current
+ *		group delay estimate of the model
+ */
+{
+    if (mLatencyBudget >= 0)
+        return mPredictiveModel.AverageLatency();
+    return mModel->GroupDelay();
+}
+
+void MidiSmoother::SetReversalThreshold(int ticks)
+/*
+ * @param ticks
+ *		The number of ticks against the current direction that make a change of direction. Smaller
+ *		values react sooner but also to encoder jitter
+ */
+{
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    mReversalTicks = std::max(1, ticks);
+    mWarmupModel.SetStartDistance(mReversalTicks * mMsPerTick);
+}
+
+void MidiSmoother::SetStopTimeout(double timeout_ms)
+/*
+ * @param timeout_ms
+ *		The minimum time without midi after which the output ramps to a stop. The timeout is
+ *		stretched to two message intervals when the platter is moving slowly
+ */
+{
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    mStopTimeout = timeout_ms;
+    Publish();
+}
+
+void MidiSmoother::SetUpdateBudget(double budget_us)
+/*
+ * Sets how long one update of the model may take. While updates take longer on average the
+ * smoother steps down to cheaper models, from the selected one through regression to the latest
+ * delta alone, stepping back up once they take well under it again. Each change of model is
+ * crossfaded over QosCrossfadeMs.
+ *
+ * @param budget_us
+ *		The allowed cost of an update in us. Negative turns the ladder off
+ */
+{
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    mUpdateBudget = budget_us;
+    SelectModel();
+}
+
+void MidiSmoother::SetWarmup(bool warmup)
+/*
+ * Turns the warm-up after each start from rest on or off (see WarmupModel). It is on by default.
+ */
+{
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    mbWarmup = warmup;
+    SelectModel();
+}
+
+MidiSmoother::QosStats MidiSmoother::GetQosStats() const
+{
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    QosStats stats;
+    stats.level = mLevel;
+    stats.mode = mLadder[mLevel];
+    stats.downgrades = mMetrics.qos_downgrades.Value();
+    stats.upgrades = mMetrics.qos_upgrades.Value();
+    stats.update_cost_us = mUpdateCost;
+    return stats;
+}
+
+double MidiSmoother::StopTimeout() const
+/*
+ * The device's stop timeout is about four message intervals rather than one. A controller only
+ * sends when the tick count changes, so a platter slowing into a reversal leaves gaps of two or
+ * three intervals between messages while still moving; on the bundled scratch capture a timeout
+ * of 1.5 measured intervals stops the output 54 times where this stops it 7. --stop-timeout
+ * can bring it down to the floor of two measured intervals for a controller known to report
+ * every poll.
+ */
+{
+    return std::max(mStopTimeout, 2 * mLastIntervalMs);
+}
+
+void MidiSmoother::DetectReversal(int32_t ticks)
+/*
+ * Tracks the direction of travel. Once enough ticks have arrived against it the model's history is
+ * truncated so that none of the old direction remains in the fit. mThreadStartMutex must be held.
+ */
+{
+    int sign = ticks > 0 ? 1 : (ticks < 0 ? -1 : 0);
+    if (sign == 0)
+        return;
+    if (mDirection == 0 || sign == mDirection)
+    {
+        mDirection = sign;
+        mOppositeTicks = 0;
+        return;
+    }
+    mOppositeTicks += std::abs(ticks);
+    if (mOppositeTicks >= mReversalTicks)
+    {
+        mDirection = sign;
+        mOppositeTicks = 0;
+        mModel->TruncateHistory();
+        mHistoryCount = 0;
+        mHistoryPos = 0;
+    }
+}
+
+void MidiSmoother::SelectModel()
+/*
+ * Builds the ladder of models for the current settings and starts at its top, from no history.
+ * mThreadStartMutex must be held.
+ */
+{
+    mLadderSize = 0;
+    mLadder[mLadderSize++] = mSmoothingMode;
+    if (mUpdateBudget >= 0)
+    {
+        if (mSmoothingMode != kSmoothingRegression && mSmoothingMode != kSmoothingLastDelta)
+            mLadder[mLadderSize++] = kSmoothingRegression;
+        if (mSmoothingMode != kSmoothingLastDelta)
+            mLadder[mLadderSize++] = kSmoothingLastDelta;
+    }
+    mHeadroomUpdates = 0;
+    mRecoveryUpdates = QosRecoveryUpdates;
+    mUpdatesSinceUpgrade = std::numeric_limits<uint64_t>::max();
+    SelectRung(0, 0);
+    ResetModel();
+    Publish();
+}
+
+void MidiSmoother::SelectRung(int level, double time_ms)
+/*
+ * Points mModel at the model for a level of the ladder, wrapped for prediction if need be and
+ * then for the warm-up, and replays the latest deltas into it. The output crossfades over from the previous model from
+ * time_ms. mThreadStartMutex must be held.
+ */
+{
+    Trace(kTraceModelChange, mLadder[level], time_ms, mUpdateCost);
+    mFadeFrom = mModel->Curve();
+    mFadeStartMs = time_ms;
+    mFadeMs = QosCrossfadeMs;
+    mLevel = level;
+    mUpdateCost = 0;
+    mMetrics.qos_level.Set(level);
+    mMetrics.update_cost_us.Set(0);
+    mLevelUpdates = 0;
+    mHeadroomUpdates = 0;
+
+    SmoothingModel* model;
+    switch (mLadder[level])
+    {
+    case kSmoothingSpline: model = &mSplineModel; break;
+    case kSmoothingOneEuro: model = &mOneEuroModel; break;
+    case kSmoothingRobust: model = &mRobustModel; break;
+    case kSmoothingLastDelta: model = &mLastDeltaModel; break;
+    case kSmoothingRegression:
+    default: model = &mRegressionModel; break;
+    }
+    if (mLatencyBudget >= 0)
+    {
+        mPredictiveModel.SetModel(model);
+        mPredictiveModel.SetLatencyBudget(mLatencyBudget);
+        model = &mPredictiveModel;
+    }
+    if (mbWarmup)
+    {
+        mWarmupModel.SetModel(model);
+        model = &mWarmupModel;
+    }
+    mModel = model;
+    mModel->Reset();
+    int oldest = mHistoryCount < MaxNum ? 0 : mHistoryPos;
+    for (int i = 0; i < mHistoryCount; i++)
+    {
+        const Delta& delta = mHistory[(oldest + i) % MaxNum];
+        mModel->AddDelta(delta.time_ms, delta.distance_ms);
+    }
+    mMetrics.model_updates.Add(mHistoryCount);
+}
+
+void MidiSmoother::MeasureUpdateCost(double cost_us, double time_ms)
+/*
+ * Steps down the ladder while updates cost more than the budget, and back up after a long run
+ * of them costing well under it. mThreadStartMutex must be held.
+ */
+{
+    mUpdateCost = mLevelUpdates > 0 ? mUpdateCost + QosCostSmoothing * (cost_us - mUpdateCost) : cost_us;
+    mMetrics.update_cost_us.Set(mUpdateCost);
+    mLevelUpdates++;
+    if (mUpdatesSinceUpgrade < std::numeric_limits<uint64_t>::max())
+        mUpdatesSinceUpgrade++;
+
+    // the first updates on a model are cold and say little about what it costs
+    if (mLevelUpdates < 1 / QosCostSmoothing)
+        return;
+    if (mUpdateCost > mUpdateBudget && mLevel + 1 < mLadderSize)
+    {
+        // stepping straight back down after stepping up means the costlier model still doesn't
+        // fit, so wait longer before trying it again
+        if (mUpdatesSinceUpgrade < (uint64_t)mRecoveryUpdates)
+            mRecoveryUpdates = std::min(mRecoveryUpdates * 2, QosRecoveryUpdates * 64);
+        else
+            mRecoveryUpdates = QosRecoveryUpdates;
+        mMetrics.qos_downgrades.Add();
+        SelectRung(mLevel + 1, time_ms);
+    }
+    else if (mLevel > 0 && mUpdateCost < mUpdateBudget * QosRecoveryHeadroom)
+    {
+        if (++mHeadroomUpdates >= mRecoveryUpdates)
+        {
+            mMetrics.qos_upgrades.Add();
+            mUpdatesSinceUpgrade = 0;
+            SelectRung(mLevel - 1, time_ms);
+        }
+    }
+    else
+    {
+        mHeadroomUpdates = 0;
+    }
+}
+
+void MidiSmoother::ResetModel()
+/*
+ * Starts the model again from no history. mThreadStartMutex must be held.
+ */
+{
+    mModel->Reset();
+    mHistoryCount = 0;
+    mHistoryPos = 0;
+    mFadeMs = 0;
+    if (mSaturation.IsSaturated())
+        EndSaturation(mLastEventMs);
+    mLastVelocity = 0;
+}
+
+MidiSmoother::SmoothingMode MidiSmoother::GetSmoothingMode() const
+{
+    return mSmoothingMode;
+}
+
+void MidiSmoother::BeginMidiProcessing()
+/*
+ * Starts the clock and the model afresh.
  */
 {
     mbMidiIsProcessing = true;
 
-    std::memset(mX, 0, sizeof(mX));
-    std::memset(mFx, 0, sizeof(mFx));
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    ResetModel();
+    mDirection = 0;
+    mOppositeTicks = 0;
+    mbHasEvent = false;
+    mbStopped = false;
+    mLastIntervalMs = 0;
     startTime = std::chrono::steady_clock::now();
+    Publish();
+}
+
+void MidiSmoother::StartMidiProcessing( Reactor& reactor )
+/*
+ * Indicates that the midi processing is about to begin, with the smoother's periodic work run as a
+ * task on the given reactor rather than on its own thread. The task finishes once processing stops.
+ */
+{
+    BeginMidiProcessing();
+    reactor.Schedule("smoother", Reactor::Clock::now(), [this](Reactor::Clock::time_point now, Reactor::Clock::time_point& next)
+    {
+        if (!mbMidiIsProcessing)
+            return false;
+        mMetrics.service_wakeups.Add();
+        double interval_ms = kServiceIntervalMs;
+        // no new motion can need a stop sooner than the stop timeout, so an idle deck checks back
+        // that much later rather than every interval
+        if (ServiceMidiProcessing(ElapsedMs(now)))
+        {
+            interval_ms = std::max(kServiceIntervalMs, StopTimeout());
+            mMetrics.wakeups_avoided.Add((uint64_t)(interval_ms / kServiceIntervalMs) - 1);
+        }
+        next = now + std::chrono::duration_cast<Reactor::Clock::duration>(std::chrono::duration<double, std::milli>(interval_ms));
+        return true;
+    });
+}
+
+void MidiSmoother::StartMidiProcessing()
+/*
+ * Indicates that the midi processing is about to begin!
+ */
+{
+    BeginMidiProcessing();
     mMidiSmoothThread = std::thread(&MidiSmoother::MidiSmootherThreadFunction, this);
 
     std::unique_lock<std::mutex> scoped_lock(mThreadStartMutex);
@@ -86,92 +526,194 @@ bool MidiSmoother::MidiIsProcessing() const
 	return mbMidiIsProcessing;
 }
 
-void MidiSmoother::AddData(double X, double Y)
+double MidiSmoother::ElapsedMs(std::chrono::steady_clock::time_point time) const
 /*
- * Problem: for given vectors x and y, (x is the input, y is the label). 
- * Find a optimal line that best predicts future y with future x.
- * We need to find the line: y = bx + a which best fits the pattern of the data dots.
- *
- * @param X, Y
- *		X is the input, Y is the label
+ * The number of milliseconds between the start of processing and the given time
  */
 {
-   
-    //For Linear Regression
-    //printf("X=: %f \n", X);
-    mX[mPos] = X;
-    mFx[mPos++] = Y;
-    if (mPos >= MaxNum-1) mPos = 0;
-    mNum = mNum < MaxNum ? mNum + 1 : mNum;
-    /*
-    * In order to calculate the ground truth for the slope and intercept, 
-    * we need to run the following calculation for all training data.
-    * b --> slope = (N * Sum(x_i * y_i) - Sum(x_i) * Sum(y_i)) / (N * Sum(x_i^2) - Sum(x_i)^2)
-    * a --> intercept = (Sum(y_i) - b * Sum(x_i)) / N
-    */
-    if (mNum > 1)
-    {
-        double _x = 0, _y = 0;
-
-        for (int i = 0; i < mNum; i++)
-            _x += mX[i], _y += mFx[i];
-        _x /= (double)mNum; _y /= (double)mNum;
-        double up = 0, down = 0;
-        for (int i = 0; i < mNum; i++)
-        {
-            up += (mX[i] - _x) * (mFx[i] - _y);
-            down += (mX[i] - _x) * (mX[i] - _x);
-        }
-        b = up / down;
-        a = _y - b * _x;
-    }
-    
+    return std::chrono::duration<double, std::milli>(time - startTime).count();
 }
 
-
-
-double MidiSmoother::LinearRegression(double X)
+void MidiSmoother::NotifyMidiValue( int32_t ticks )
 /*
- * If the goal is prediction, forecasting, or error reduction, linear regression can be used to fit 
- * a predictive model to an observed data set of values of the response and explanatory variables. 
- * After developing such a model, if additional values of the explanatory variables are collected 
- * without an accompanying response value, the fitted model can be used to make a prediction of the
- * response
+ * Notify the smoother that a new value has been received from the platter.
  *
- * @param midi_value
- *		X is the input.
- * @return
- *		The F (x) corresponding to the X coordinate (midi value corresponding Seconds).
+ * @param ticks
+ *		The number of midi values that has passed. This can be negative indicating reverse direction.
  */
 {
-    return b * X + a;
+    mbMidiIsProcessing = true;
+    // Use lock_guard to lock the signal, insert the data 
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    TraceBatch batch;
+    AddMidiValue(ticks, ElapsedMs(std::chrono::steady_clock::now()));
+    Publish();
+    if (mbParked)
+        mThreadStart.notify_one();
 }
 
-void MidiSmoother::NotifyMidiValue( char midi_value )
+void MidiSmoother::NotifyMidiValue( int32_t ticks, double time_ms )
 /*
- * Notify the smoother that a new value has been received from the platter.
+ * Notify the smoother of a platter movement the device has timestamped itself.
  *
- * @param midi_value
+ * @param ticks
  *		The number of midi values that has passed. This can be negative indicating reverse direction.
+ * @param time_ms
+ *		When the movement happened, on the smoother's clock (see CurrentTimeMs)
  */
 {
-    // printf("NotifyMidiValue: %d \n", midi_value);
-	// NB: This is incorrect! This assumes that we recieve a midi value every millisecond which isn't true
-    //mLastVelocity = midi_value/(double)mMidiValuesPerRevolution * mSecondsPerRevolution * 1000;
-    
     mbMidiIsProcessing = true;
     std::lock_guard<std::mutex> lk(mThreadStartMutex);
-    // Use lock_guard to lock the signal, insert the data 
-    std::chrono::steady_clock::time_point currentT = std::chrono::steady_clock::now();
-    std::chrono::duration<int, std::micro> duration_m = std::chrono::duration_cast<std::chrono::duration<int, std::micro>>(currentT - startTime);
-    double X = double(duration_m.count()) * std::chrono::microseconds::period::num / std::chrono::microseconds::period::den;
-    X = X / 1000;
-    
-    double Y = midi_value / (double)mMidiValuesPerRevolution * mSecondsPerRevolution * 1000;
-    AddData(X, Y);
+    TraceBatch batch;
+    AddMidiValue(ticks, time_ms);
+    Publish();
+    if (mbParked)
+        mThreadStart.notify_one();
+}
 
-    mThreadStart.notify_one();
-	
+void MidiSmoother::NotifyMidiValues( const MidiDelta* deltas, size_t count )
+/*
+ * Notify the smoother of a whole packet of platter movements at once, taking the lock and reading
+ * the clock only once. Deltas without a device timestamp are spread evenly between the previous
+ * delta and now, as they were generated over that time but delivered together.
+ *
+ * @param deltas
+ *		The movements, in the order they happened
+ * @param count
+ *		The number of movements
+ */
+{
+    if (count == 0)
+        return;
+    mbMidiIsProcessing = true;
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    TraceBatch batch;
+    double now = ElapsedMs(std::chrono::steady_clock::now());
+    double previous = mbHasEvent ? std::min(mLastEventMs, now) : now;
+    double spacing = (now - previous) / count;
+    for (size_t i = 0; i < count; i++)
+    {
+        double time_ms = deltas[i].time_ms == kNoTimestamp ? previous + spacing * (i + 1) : deltas[i].time_ms;
+        AddMidiValue(deltas[i].ticks, time_ms);
+    }
+    Publish();
+    if (mbParked)
+        mThreadStart.notify_one();
+}
+
+double MidiSmoother::CurrentTimeMs() const
+/*
+ * The smoother's clock: ms since processing started. Device timestamps must be given on this clock.
+ */
+{
+    return ElapsedMs(std::chrono::steady_clock::now());
+}
+
+void MidiSmoother::FollowClock( const MidiSmoother& other )
+{
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    startTime = other.startTime;
+}
+
+void MidiSmoother::AddMidiValue( int32_t ticks, double time_ms )
+/*
+ * Feeds a single movement to the model. mThreadStartMutex must be held.
+ */
+{
+    // time never runs backwards for the model, whatever the device claims
+    double X = mbHasEvent ? std::max(time_ms, mLastEventMs) : time_ms;
+    double Y = ticks * mMsPerTick;
+
+    // after a stop the output has ramped to zero, so start again from no history
+    if (mbHasEvent && X - mLastEventMs > StopTimeout())
+    {
+        ResetModel();
+        mDirection = 0;
+        mLastIntervalMs = 0;
+    }
+    else if (mbHasEvent)
+    {
+        mLastIntervalMs = X - mLastEventMs;
+    }
+    mbHasEvent = true;
+    mbStopped = false;
+    mLastEventMs = X;
+
+    Trace(kTraceMidi, ticks, X);
+    mMetrics.midi_events.Add();
+    // a message at the device's limit only says the platter moved at least that far
+    if (std::abs(ticks) >= mDevice.saturation_limit)
+    {
+        Y = SaturatedDistance(ticks, X);
+    }
+    else
+    {
+        if (mSaturation.IsSaturated())
+            EndSaturation(X);
+        mLastVelocity = mLastIntervalMs > 0 ? Y / mLastIntervalMs : 0;
+    }
+    DetectReversal(ticks);
+    if (mUpdateBudget < 0)
+    {
+        mModel->AddDelta(X, Y);
+        RecordModelUpdate();
+        return;
+    }
+
+    // keep the deltas a model stepped to would need, and time the update against the budget
+    mHistory[mHistoryPos].time_ms = X;
+    mHistory[mHistoryPos].distance_ms = Y;
+    mHistoryPos = (mHistoryPos + 1) % MaxNum;
+    mHistoryCount = std::min(mHistoryCount + 1, MaxNum);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    mModel->AddDelta(X, Y);
+    MeasureUpdateCost(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count(), X);
+    RecordModelUpdate();
+}
+
+double MidiSmoother::SaturatedDistance(int32_t ticks, double time_ms)
+/*
+ * The distance to give the model for a message at the device's saturation limit, inferred by
+ * mSaturation. A run of them starts from the velocity of the message before, and ends at the
+ * first message under the limit or a change of direction. mThreadStartMutex must be held.
+ */
+{
+    int direction = ticks > 0 ? 1 : -1;
+    double interval = mLastIntervalMs > 0 ? mLastIntervalMs : 1000.0 / mDevice.message_rate_hz;
+    if (mSaturation.IsSaturated() && direction != mSaturationDirection)
+        EndSaturation(time_ms);
+    if (!mSaturation.IsSaturated())
+    {
+        mSaturation.Begin(time_ms, direction * mLastVelocity, interval);
+        mSaturationDirection = direction;
+        mMetrics.saturated_runs.Add();
+        mMetrics.saturated.Set(1);
+        Trace(kTraceSaturation, 1, time_ms, direction * mLastVelocity, interval);
+    }
+    mMetrics.saturated_messages.Add();
+    return direction * mSaturation.Distance(time_ms, interval);
+}
+
+void MidiSmoother::EndSaturation(double time_ms)
+/*
+ * Ends a run of saturated messages. mThreadStartMutex must be held.
+ */
+{
+    SaturationEstimator::Run run = mSaturation.End(time_ms);
+    mMetrics.saturated.Set(0);
+    Trace(kTraceSaturation, 0, time_ms, run.duration_ms, run.peak_velocity);
+}
+
+void MidiSmoother::RecordModelUpdate()
+/*
+ * Traces the coefficients of the model's new curve and counts the update. mThreadStartMutex
+ * must be held.
+ */
+{
+    const VelocityCurve& curve = mModel->Curve();
+    Trace(kTraceModelUpdate, mLadder[mLevel], curve.c0, curve.c1, curve.c2);
+    mMetrics.model_updates.Add();
+    mMetrics.latency_ms.Set(EffectiveLatency());
 }
 
 double MidiSmoother::RequestMSToMoveValue( double ms_to_process ) const
@@ -184,7 +726,96 @@ double MidiSmoother::RequestMSToMoveValue( double ms_to_process ) const
  *		The number of ms that should be moved during this process step
  */
 {
-	return mLastVelocity * ms_to_process;
+	return VelocityAt( CurrentTimeMs() ) * ms_to_process;
+}
+
+MidiSmoother::PublishedVelocity::PublishedVelocity() :
+    curve(),
+    stop_ms(std::numeric_limits<double>::max()),
+    ramp_ms(1),
+    fade_from(),
+    fade_start_ms(0),
+    fade_ms(0)
+{
+}
+
+double MidiSmoother::PublishedVelocity::Velocity( double time_ms ) const
+/*
+ * The curve's velocity, crossfaded in from the previous model's over fade_ms after a change of
+ * model, and ramped to a stop over ramp_ms once stop_ms has passed.
+ */
+{
+    double velocity = curve.Velocity(time_ms);
+    if (fade_ms > 0 && time_ms < fade_start_ms + fade_ms)
+    {
+        double from = fade_from.Velocity(time_ms);
+        velocity = from + (velocity - from) * std::max(0.0, (time_ms - fade_start_ms) / fade_ms);
+    }
+    if (time_ms > stop_ms)
+        velocity *= std::max(0.0, 1.0 - (time_ms - stop_ms) / ramp_ms);
+    return velocity;
+}
+
+double MidiSmoother::VelocityAt( double time_ms ) const
+/*
+ * The smoothed velocity at any time on the smoother's clock. Safe to call from any number of
+ * threads at once, and never waits on the midi or smoothing threads.
+ *
+ * @param time_ms
+ *		The time on the smoother's clock (see CurrentTimeMs)
+ */
+{
+    PublishedVelocity published;
+    mPublished.Load(published);
+    return published.Velocity(time_ms);
+}
+
+int MidiSmoother::ReadPublished( PublishedVelocity& published ) const
+{
+    return mPublished.Load(published);
+}
+
+void MidiSmoother::Publish()
+/*
+ * Publishes the model's current output to readers. mThreadStartMutex must be held, which also
+ * makes this the only writer.
+ */
+{
+    PublishedVelocity published;
+    published.curve = mModel->Curve();
+    if (mbHasEvent && !mbStopped)
+    {
+        published.stop_ms = mLastEventMs + StopTimeout();
+        published.ramp_ms = std::max(mLastIntervalMs, 1.0);
+    }
+    // once the crossfade is over for the latest midi it is over for every reader
+    if (mFadeMs > 0 && mLastEventMs >= mFadeStartMs + mFadeMs)
+        mFadeMs = 0;
+    if (mFadeMs > 0)
+    {
+        published.fade_from = mFadeFrom;
+        published.fade_start_ms = mFadeStartMs;
+        published.fade_ms = mFadeMs;
+    }
+    mPublished.Store(published);
+}
+
+void MidiSmoother::RegisterReader( VelocityReader* reader )
+{
+    std::lock_guard<std::mutex> lk(mReadersMutex);
+    mReaders.push_back(reader);
+}
+
+void MidiSmoother::UnregisterReader( VelocityReader* reader )
+{
+    std::lock_guard<std::mutex> lk(mReadersMutex);
+    mReaders.erase(std::remove(mReaders.begin(), mReaders.end(), reader), mReaders.end());
+}
+
+std::vector<VelocityReader*> MidiSmoother::Readers() const
+{
+    std::lock_guard<std::mutex> lk(mReadersMutex);
+    return mReaders;
 }
 
 
@@ -197,6 +828,8 @@ void MidiSmoother::MidiSmootherThreadFunction()
  */
 {
 
+    ApplyThreadSettings(kThreadRoleSmoother);
+
     // wait for the explicit start message
     {
         std::unique_lock<std::mutex> scoped_lock(mThreadStartMutex);
@@ -207,31 +840,25 @@ void MidiSmoother::MidiSmootherThreadFunction()
     }
 
     // determine our request frequency
-    const int iterations_per_block = 7;
-    const double ms_request_per_iteration = 30 / 44.1;
-    const int total_interval_microseconds = (int)(ms_request_per_iteration * iterations_per_block * 1000);
+    const int total_interval_microseconds = (int)(kServiceIntervalMs * 1000);
     // continue caculating the F(Xi)
     while (mbThreadRunning )
     {
         // request a block of updates
         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-        std::chrono::duration<int, std::micro> duration_m = std::chrono::duration_cast<std::chrono::duration<int, std::micro>>(start - startTime);
-        double curSeconds = double(duration_m.count()) * std::chrono::microseconds::period::num / std::chrono::microseconds::period::den;
-        curSeconds = curSeconds / 1000;
+        double curMs = ElapsedMs(start);
         //process data;
-        if (mNum <= 0)
-        {
-            mLastVelocity = 0;
-        }
-        else if (mNum < 3)
+        mMetrics.service_wakeups.Add();
+        if (ServiceMidiProcessing(curMs))
         {
-            mLastVelocity = mFx[mNum - 1];
-        }
-        else
-        {
-            //mLastVelocity = LagrangeInter(curSeconds);
-            mLastVelocity = LinearRegression(curSeconds);
-            //AddData(curSeconds, mLastVelocity);
+            // the platter is untouched: park until the next midi rather than waking to find nothing to do
+            std::unique_lock<std::mutex> scoped_lock(mThreadStartMutex);
+            mbParked = true;
+            while (mbThreadRunning && (mbStopped || !mbHasEvent))
+                mThreadStart.wait(scoped_lock);
+            mbParked = false;
+            mMetrics.wakeups_avoided.Add((uint64_t)((ElapsedMs(std::chrono::steady_clock::now()) - curMs) / kServiceIntervalMs));
+            continue;
         }
         
         
@@ -243,6 +870,30 @@ void MidiSmoother::MidiSmootherThreadFunction()
         std::chrono::microseconds interval = std::chrono::microseconds(microseconds);
         // and sleep
         std::this_thread::sleep_for(interval);
+        mWakeupLatency.Record(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - (end + interval)).count());
+
+    }
+}
 
+bool MidiSmoother::ServiceMidiProcessing( double cur_ms )
+/*
+ * The smoother's periodic work. Readers ramp the output to a stop themselves once the midi goes
+ * quiet. When the ramp is over, publish a clean stop and start the next motion from no history.
+ *
+ * @return
+ *		True if the deck is idle, so there is no more work until the next midi arrives
+ */
+{
+    std::lock_guard<std::mutex> lk(mThreadStartMutex);
+    if (mbHasEvent && !mbStopped && cur_ms - mLastEventMs > StopTimeout() + std::max(mLastIntervalMs, 1.0))
+    {
+        Trace(kTraceStop, 0, cur_ms);
+        mMetrics.stops.Add();
+        ResetModel();
+        mDirection = 0;
+        mLastIntervalMs = 0;
+        mbStopped = true;
+        Publish();
     }
+    return mbStopped || !mbHasEvent;
 }
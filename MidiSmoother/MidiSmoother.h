@@ -12,53 +12,279 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "Models/LinearRegressionModel.h"
+#include "Models/HermiteSplineModel.h"
+#include "Models/OneEuroModel.h"
+#include "Models/LastDeltaModel.h"
+#include "Models/PredictiveModel.h"
+#include "Models/RobustRegressionModel.h"
+#include "Models/WarmupModel.h"
+#include "Models/SaturationEstimator.h"
+#include "Devices/DeviceProfile.h"
+#include "Threading/SeqLock.h"
+#include "Threading/Reactor.h"
+#include "Threading/LatencyHistogram.h"
+#include "Threading/Metrics.h"
+
+class VelocityReader;
 
 
 #ifndef MidiSmoother_MidiSmoother_h
 #define MidiSmoother_MidiSmoother_h
 
-#define MaxNum 20
+#define MaxNum 20					// messages in the regression window
+#define RobustWindow 8				// knots in the robust regression window
+#define SplineTangentSpan 4			// knots the spline tangent is measured over
+#define SplineHorizonIntervals 4.0	// message intervals the spline takes to head onto the track
+#define OneEuroMinCutoff 1.0		// Hz, the One-Euro cutoff while the velocity is steady
+#define OneEuroBeta 1.0				// Hz of extra cutoff per unit of velocity change per second
+#define OneEuroDerivativeCutoff 3.0	// Hz, cutoff of the velocity change estimate
+#define WarmupMessages 8			// messages after a start from rest until the output is the model's alone
+#define WarmupSlopeSpanMs 2.0		// ms the first messages must span before the warm-up trusts their slope by half
+#define SaturationPushMs 2.0		// ms the push that carries the platter past a device's saturation limit takes to give out
+#define SaturationCoastMs 100.0		// ms the platter takes to slow back towards the limit once the push is over
+#define QosCostSmoothing 0.05		// weight of each update in the moving average of the update cost
+#define QosRecoveryUpdates 512		// updates with headroom before stepping back up to a costlier model
+#define QosRecoveryHeadroom 0.5		// fraction of the budget the cost must stay under to step back up
+#define QosCrossfadeMs 20.0			// ms the output takes to move over to a newly stepped to model
 class MidiSmoother
 {
 public:
+	// A single platter movement for NotifyMidiValues
+	struct MidiDelta
+	{
+		int32_t ticks;		// ticks moved since the previous delta. Negative is reverse
+		double time_ms;		// when the movement happened on the smoother's clock (see CurrentTimeMs), or kNoTimestamp
+	};
+
+	// Marks a delta without a device timestamp. Such deltas are stamped when they arrive
+	static const double kNoTimestamp;
+
+	enum SmoothingMode
+	{
+		kSmoothingRegression,	// least squares line through the per message deltas
+		kSmoothingSpline,		// cubic Hermite spline through the integrated position track
+		kSmoothingOneEuro,		// One-Euro low pass whose cutoff rises with the rate of change
+		kSmoothingRobust,		// Theil-Sen fit of the integrated position track
+		kSmoothingLastDelta,	// the latest message's velocity alone, the cheapest there is
+		kNumSmoothingModes
+	};
+
+	static bool SmoothingModeFromName( const std::string& name, SmoothingMode& mode );
+
+	static const char* SmoothingModeName( SmoothingMode mode );
+
+	// A model for the given mode with the default settings. The caller owns the result
+	static SmoothingModel* CreateModel( SmoothingMode mode );
+
+	// The output as published to readers: the model's curve, and the ramp to a stop once the midi goes quiet
+	struct PublishedVelocity
+	{
+		PublishedVelocity();
+
+		double Velocity( double time_ms ) const;
+
+		VelocityCurve curve;
+		double stop_ms;		// when the output starts ramping to zero
+		double ramp_ms;		// how long the ramp to zero takes
+		VelocityCurve fade_from;	// the previous model's curve, faded out after a change of model
+		double fade_start_ms;
+		double fade_ms;		// 0 when there is nothing to fade from
+	};
+
+	// Where the smoother is on its ladder of models, from the selected mode (level 0) down to the cheapest
+	struct QosStats
+	{
+		int level;
+		SmoothingMode mode;		// the model in use at that level
+		uint64_t downgrades;
+		uint64_t upgrades;
+		double update_cost_us;	// moving average of the cost of one update
+	};
+
 	MidiSmoother( int midi_values_per_revolution, double seconds_per_revolution );
+
+	explicit MidiSmoother( const DeviceProfile& device );
+
+	const DeviceProfile& GetDeviceProfile() const;
+
+	void SetSmoothingMode( SmoothingMode mode );
+
+	SmoothingMode GetSmoothingMode() const;
+
+	void SetLatencyBudget( double latency_budget_ms );
+
+	double EffectiveLatency() const;
+
+	void SetReversalThreshold( int ticks );
+
+	void SetStopTimeout( double timeout_ms );
+
+	void SetUpdateBudget( double budget_us );
+
+	void SetWarmup( bool warmup );
+
+	QosStats GetQosStats() const;
 	
-	void NotifyMidiValue( char midi_value );
+	void NotifyMidiValue( int32_t ticks );
+
+	void NotifyMidiValue( int32_t ticks, double time_ms );
+
+	void NotifyMidiValues( const MidiDelta* deltas, size_t count );
+
+	double CurrentTimeMs() const;
+
+	// Puts this smoother on another's clock, so that times on one mean the same to the other.
+	// Call once both have started processing
+	void FollowClock( const MidiSmoother& other );
 	
 	double RequestMSToMoveValue( double ms_to_process ) const;
+
+	double VelocityAt( double time_ms ) const;
+
+	// Copies the published output. Returns the number of times the copy was retried
+	int ReadPublished( PublishedVelocity& published ) const;
+
+	void RegisterReader( VelocityReader* reader );
+
+	void UnregisterReader( VelocityReader* reader );
+
+	std::vector<VelocityReader*> Readers() const;
 	
 	void StartMidiProcessing();
+
+	void StartMidiProcessing( Reactor& reactor );
 	
 	void StopMidiProcessing();
 	
 	bool MidiIsProcessing() const;
+
+	// How late the smoother's thread woke against its schedule, in us. Read once the thread has stopped
+	const LatencyHistogram& WakeupLatency() const { return mWakeupLatency; }
+
+	// The number of times the smoother's periodic work ran, and the number of times it would
+	// have run but for parking while the platter was untouched. Read once processing has stopped
+	uint64_t ServiceWakeups() const { return mMetrics.service_wakeups.Value(); }
+
+	uint64_t WakeupsAvoided() const { return mMetrics.wakeups_avoided.Value(); }
+
+	// The deck's live counters, which the parts of the deck feeding and reading this smoother
+	// also write to. Safe to read from any thread at any time
+	DeckMetrics& Metrics() { return mMetrics; }
+
+	const DeckMetrics& Metrics() const { return mMetrics; }
 private:
 	void MidiSmootherThreadFunction();
 
-	void AddData(double X, double Y);
-	double LinearRegression(double X);
+	void BeginMidiProcessing();
+
+	bool ServiceMidiProcessing( double cur_ms );
+
+	double ElapsedMs( std::chrono::steady_clock::time_point time ) const;
+
+	void SelectModel();
+
+	void SelectRung( int level, double time_ms );
+
+	void MeasureUpdateCost( double cost_us, double time_ms );
+
+	void ResetModel();
+
+	void AddMidiValue( int32_t ticks, double time_ms );
+
+	void RecordModelUpdate();
+
+	void DetectReversal( int32_t ticks );
+
+	double SaturatedDistance( int32_t ticks, double time_ms );
+
+	void EndSaturation( double time_ms );
+
+	double StopTimeout() const;
+
+	void Publish();
 
 	// These variables should not be modified to ensure things continue as necessary
 	const int mMidiValuesPerRevolution; // the number of midi values that would need to be recieved for an entire platter revolution to be expected
 	const double mSecondsPerRevolution; // the number of seconds an entire platter revolution represents
+	const double mMsPerTick; // song ms moved per midi value, so each value costs a single multiply
+	const DeviceProfile mDevice; // the controller being smoothed
 	bool mbMidiIsProcessing;
 
 	//Add thread for midi processing. Don't block other thread
-	std::mutex mThreadStartMutex;
+	mutable std::mutex mThreadStartMutex;
 	std::condition_variable mThreadStart;
 	std::thread	mMidiSmoothThread;
 	bool mbThreadRunning;
 	std::chrono::steady_clock::time_point startTime;
+	LatencyHistogram mWakeupLatency;
 	
 	
 private:
-	// This is an example of the absolute simplest way of providing velocity.
-	double mLastVelocity;
-	double mX[MaxNum];
-	double mFx[MaxNum];
-	double a, b;
-	int mNum;
-	int mPos;
+	// The velocity readers see. Published whenever the model changes, so that readers never
+	// need mThreadStartMutex
+	SeqLock<PublishedVelocity> mPublished;
+	mutable std::mutex mReadersMutex;
+	std::vector<VelocityReader*> mReaders;
+
+	SmoothingMode mSmoothingMode;
+	double mLatencyBudget;		// ms, negative when no prediction is wanted
+	SmoothingModel* mModel;		// the model selected by mSmoothingMode. Only touched with mThreadStartMutex held
+	LinearRegressionModel mRegressionModel;
+	HermiteSplineModel mSplineModel;
+	OneEuroModel mOneEuroModel;
+	RobustRegressionModel mRobustModel;
+	LastDeltaModel mLastDeltaModel;
+	PredictiveModel mPredictiveModel;
+	WarmupModel mWarmupModel;
+	bool mbWarmup;				// whether the model is wrapped in mWarmupModel
+
+	// the ladder of models stepped down while updates cost more than mUpdateBudget. Only touched
+	// with mThreadStartMutex held
+	struct Delta
+	{
+		double time_ms;
+		double distance_ms;
+	};
+	double mUpdateBudget;		// us, negative when the ladder is off
+	SmoothingMode mLadder[3];
+	int mLadderSize;
+	int mLevel;
+	double mUpdateCost;			// us, moving average for the current level
+	int mLevelUpdates;			// updates measured on the current level
+	int mHeadroomUpdates;		// consecutive updates under the headroom
+	int mRecoveryUpdates;		// updates with headroom needed to step up, longer when stepping up hasn't lasted
+	uint64_t mUpdatesSinceUpgrade;
+	Delta mHistory[MaxNum];		// the latest deltas, replayed into a model when stepping to it
+	int mHistoryCount;
+	int mHistoryPos;
+	VelocityCurve mFadeFrom;
+	double mFadeStartMs;
+	double mFadeMs;
+
+	// direction change and stop detection. Only touched with mThreadStartMutex held
+	int mReversalTicks;			// opposite direction ticks needed to count as a reversal
+	double mStopTimeout;		// minimum ms without midi before ramping to a stop
+	int mDirection;				// +1, -1 or 0 before any motion
+	int mOppositeTicks;			// ticks received against mDirection since the last tick with it
+	bool mbHasEvent;
+	bool mbStopped;				// the output has ramped to zero and the model has no history
+	bool mbParked;				// the smoother's thread is waiting for midi rather than running periodically
+	double mLastEventMs;
+	double mLastIntervalMs;
+
+	// the motion filled in through runs of messages at the device's limit. Only touched with
+	// mThreadStartMutex held
+	SaturationEstimator mSaturation;
+	int mSaturationDirection;	// +1 or -1, the direction of the current run
+	double mLastVelocity;		// over the latest message under the limit, which a run starts from
+
+	DeckMetrics mMetrics;
 };
 
 #endif
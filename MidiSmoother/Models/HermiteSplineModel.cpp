@@ -0,0 +1,126 @@
+//
+//  HermiteSplineModel.cpp
+//  MidiSmoother
+//
+
+#include "HermiteSplineModel.h"
+
+#include <algorithm>
+
+// weighting of the newest interval in the running interval estimate
+static const double kIntervalSmoothing = 0.2;
+// the curve never converges faster than this (ms), however fast messages arrive
+static const double kMinimumHorizon = 1.0;
+// the shortest time (ms) a tangent is measured over, so knots bunched by the transport don't make it spike
+static const double kMinimumInterval = 0.5;
+// the fraction of the gap between the curve and the position track closed over each horizon. All
+// of it makes every message's quantization show up in the velocity
+static const double kPositionCatchUp = 0.3;
+
+HermiteSplineModel::HermiteSplineModel( int tangent_span, double horizon_intervals ) :
+mTangentSpan( std::max( 1, std::min( tangent_span, (int)kMaxKnots - 1 ) ) ),
+mHorizonIntervals( std::max( 0.5, horizon_intervals ) )
+/*
+ * Constructor for the spline model.
+ *
+ * @param tangent_span
+ *		The number of knots the tangent at the newest knot is measured over. Larger is smoother but later
+ * @param horizon_intervals
+ *		The number of message intervals each segment is given to head back towards the position track
+ */
+{
+	Reset();
+}
+
+void HermiteSplineModel::Reset()
+{
+	mNumKnots = 0;
+	mNewestKnot = -1;
+	mPosition = 0;
+	mInterval = 0;
+	mHorizon = 0;
+	mCurve = VelocityCurve();
+}
+
+const HermiteSplineModel::Knot& HermiteSplineModel::KnotFromNewest( int age ) const
+{
+	return mKnots[( mNewestKnot - age + kMaxKnots ) % kMaxKnots];
+}
+
+void HermiteSplineModel::AddDelta( double time_ms, double distance_ms )
+/*
+ * Appends a knot to the position track and builds the next curve segment. The segment is a cubic
+ * Hermite from the current state of the running curve to the newest tangent one horizon from now,
+ * having closed kPositionCatchUp of its gap to the track, after which the curve continues in a
+ * straight line at the tangent.
+ *
+ * @param time_ms
+ *		The arrival time of the delta
+ * @param distance_ms
+ *		The distance moved since the last delta in song ms
+ */
+{
+	mPosition += distance_ms;
+	mNewestKnot = ( mNewestKnot + 1 ) % kMaxKnots;
+	mKnots[mNewestKnot].time = time_ms;
+	mKnots[mNewestKnot].position = mPosition;
+	mNumKnots = std::min( mNumKnots + 1, (int)kMaxKnots );
+
+	if( mNumKnots < 2 )
+	{
+		// nothing to differentiate yet, sit still on the track
+		mCurve = VelocityCurve();
+		mCurve.t0 = time_ms;
+		mCurve.p0 = mPosition;
+		return;
+	}
+
+	double interval = time_ms - KnotFromNewest( 1 ).time;
+	if( interval > 0 )
+		mInterval = mInterval > 0 ? mInterval + kIntervalSmoothing * ( interval - mInterval ) : interval;
+
+	// non uniform backward difference over the tangent span, over no less than kMinimumInterval so
+	// that knots bunched together by the transport can't make it spike
+	int span = std::min( mTangentSpan, mNumKnots - 1 );
+	const Knot& oldest = KnotFromNewest( span );
+	double tangent_time = std::max( time_ms - oldest.time, kMinimumInterval );
+	double target_velocity = ( mPosition - oldest.position ) / tangent_time;
+
+	// start exactly where the running curve is, so position and velocity are continuous
+	double p_start = mCurve.Position( time_ms );
+	double v_start = mCurve.Velocity( time_ms );
+
+	double horizon = std::max( mInterval * mHorizonIntervals, kMinimumHorizon );
+	mHorizon = horizon;
+	double p_end = p_start + kPositionCatchUp * ( mPosition - p_start ) + target_velocity * horizon;
+
+	// Hermite basis rewritten as a polynomial in dt: p = p0 + v0 dt + A dt^2 + B dt^3
+	double A = ( 3.0 * ( p_end - p_start ) - ( 2.0 * v_start + target_velocity ) * horizon ) / ( horizon * horizon );
+	double B = ( 2.0 * ( p_start - p_end ) + ( v_start + target_velocity ) * horizon ) / ( horizon * horizon * horizon );
+
+	mCurve.t0 = time_ms;
+	mCurve.p0 = p_start;
+	mCurve.c0 = v_start;
+	mCurve.c1 = 2.0 * A;
+	mCurve.c2 = 3.0 * B;
+	mCurve.duration = horizon;
+}
+
+void HermiteSplineModel::TruncateHistory()
+/*
+ * Keeps only the newest knot, so the next tangent is measured purely in the new direction.
+ * The running curve is untouched so continuity is preserved.
+ */
+{
+	mNumKnots = std::min( mNumKnots, 1 );
+}
+
+double HermiteSplineModel::GroupDelay() const
+/*
+ * The tangent is a backward difference centred half the tangent span back, and the curve
+ * takes a horizon to converge onto it, lagging by about half of that on average.
+ */
+{
+	int span = std::min( mTangentSpan, std::max( mNumKnots - 1, 0 ) );
+	return ( span * mInterval + mHorizon ) * 0.5;
+}
@@ -0,0 +1,51 @@
+//
+//  HermiteSplineModel.h
+//  MidiSmoother
+//
+//  Integrates the midi deltas into a cumulative position track and follows it with a
+//  piecewise cubic Hermite curve. Knot tangents are non uniform Catmull-Rom style
+//  differences over the most recent knots. Each update starts from the position and
+//  velocity the previous curve has at the arrival time, so the curve is C1 across
+//  updates and the velocity (its analytic derivative) never jumps.
+//
+
+#ifndef __MidiSmoother__HermiteSplineModel__
+#define __MidiSmoother__HermiteSplineModel__
+
+#include "SmoothingModel.h"
+
+class HermiteSplineModel : public SmoothingModel
+{
+public:
+	static const int kMaxKnots = 16;
+
+	HermiteSplineModel( int tangent_span, double horizon_intervals );
+
+	virtual void Reset();
+
+	virtual void AddDelta( double time_ms, double distance_ms );
+
+	virtual void TruncateHistory();
+
+	virtual double GroupDelay() const;
+private:
+	struct Knot
+	{
+		double time;		// ms
+		double position;	// song ms
+	};
+
+	const Knot& KnotFromNewest( int age ) const;
+
+	const int mTangentSpan;				// how many knots back the tangent of the newest knot is measured over
+	const double mHorizonIntervals;		// how many message intervals the curve takes to head onto the track
+
+	Knot mKnots[kMaxKnots];
+	int mNumKnots;
+	int mNewestKnot;
+	double mPosition;					// integrated track position
+	double mInterval;					// smoothed interval between messages (ms)
+	double mHorizon;					// ms the current segment takes to reach the track
+};
+
+#endif /* defined(__MidiSmoother__HermiteSplineModel__) */
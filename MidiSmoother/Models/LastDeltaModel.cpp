@@ -0,0 +1,64 @@
+//
+//  LastDeltaModel.cpp
+//  MidiSmoother
+//
+
+#include "LastDeltaModel.h"
+
+#include <algorithm>
+#include <limits>
+
+// the shortest interval (ms) a velocity is calculated over
+static const double kMinimumInterval = 0.5;
+
+LastDeltaModel::LastDeltaModel()
+{
+	Reset();
+}
+
+void LastDeltaModel::Reset()
+{
+	mbHasTime = false;
+	mLastTime = 0;
+	mInterval = 0;
+	mCurve = VelocityCurve();
+}
+
+void LastDeltaModel::AddDelta( double time_ms, double distance_ms )
+/*
+ * @param time_ms
+ *		The arrival time of the delta
+ * @param distance_ms
+ *		The distance moved since the last delta in song ms
+ */
+{
+	// the first delta covers an unknown amount of time, so it only starts the clock
+	if( !mbHasTime )
+	{
+		mbHasTime = true;
+		mLastTime = time_ms;
+		return;
+	}
+	mInterval = std::max( time_ms - mLastTime, kMinimumInterval );
+	mLastTime = time_ms;
+
+	mCurve = VelocityCurve();
+	mCurve.t0 = time_ms;
+	mCurve.c0 = distance_ms / mInterval;
+	mCurve.duration = std::numeric_limits<double>::infinity();
+}
+
+void LastDeltaModel::TruncateHistory()
+/*
+ * There is no history beyond the latest delta, which is kept as the current output.
+ */
+{
+}
+
+double LastDeltaModel::GroupDelay() const
+/*
+ * The delta describes the motion over the interval before it arrived, so it lags by half of it.
+ */
+{
+	return mInterval * 0.5;
+}
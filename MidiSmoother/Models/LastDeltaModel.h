@@ -0,0 +1,32 @@
+//
+//  LastDeltaModel.h
+//  MidiSmoother
+//
+//  The velocity of the latest message alone, held until the next. No smoothing at all, but a
+//  constant cost per message, which makes it the bottom rung when MidiSmoother has to shed load.
+//
+
+#ifndef __MidiSmoother__LastDeltaModel__
+#define __MidiSmoother__LastDeltaModel__
+
+#include "SmoothingModel.h"
+
+class LastDeltaModel : public SmoothingModel
+{
+public:
+	LastDeltaModel();
+
+	virtual void Reset();
+
+	virtual void AddDelta( double time_ms, double distance_ms );
+
+	virtual void TruncateHistory();
+
+	virtual double GroupDelay() const;
+private:
+	bool mbHasTime;			// true once a delta has been seen and so intervals can be measured
+	double mLastTime;
+	double mInterval;		// ms covered by the latest delta
+};
+
+#endif /* defined(__MidiSmoother__LastDeltaModel__) */
@@ -0,0 +1,128 @@
+//
+//  LinearRegressionModel.cpp
+//  MidiSmoother
+//
+
+#include "LinearRegressionModel.h"
+
+#include <algorithm>
+#include <limits>
+
+// the shortest interval (ms) a velocity is calculated over
+static const double kMinimumInterval = 0.5;
+
+LinearRegressionModel::LinearRegressionModel( int window_size ) :
+mWindowSize( std::max( 2, std::min( window_size, (int)kMaxWindowSize ) ) )
+/*
+ * Constructor for the regression model.
+ *
+ * @param window_size
+ *		The number of most recent messages the line is fitted over
+ */
+{
+	Reset();
+}
+
+void LinearRegressionModel::Reset()
+{
+	std::fill( mX, mX + kMaxWindowSize, 0.0 );
+	std::fill( mFx, mFx + kMaxWindowSize, 0.0 );
+	a = b = 0;
+	mOldestX = mNewestX = 0;
+	mbHasTime = false;
+	mLastTime = 0;
+	mNum = 0;	//indicate the last input
+	mPos = 0;	//indicate the last output
+	mCurve = VelocityCurve();
+}
+
+void LinearRegressionModel::AddDelta( double time_ms, double distance_ms )
+/*
+ * Problem: for given vectors x and y, (x is the input, y is the label).
+ * Find a optimal line that best predicts future y with future x.
+ * We need to find the line: y = bx + a which best fits the pattern of the data dots.
+ * Here x is the arrival time and y the velocity over the interval before it.
+ *
+ * @param time_ms
+ *		The arrival time of the delta
+ * @param distance_ms
+ *		The distance moved since the last delta in song ms
+ */
+{
+	// the first delta covers an unknown amount of time, so it only starts the clock
+	if( !mbHasTime )
+	{
+		mbHasTime = true;
+		mLastTime = time_ms;
+		return;
+	}
+	double X = time_ms;
+	double Y = distance_ms / std::max( time_ms - mLastTime, kMinimumInterval );
+	mLastTime = time_ms;
+
+	mX[mPos] = X;
+	mFx[mPos++] = Y;
+	if( mPos >= mWindowSize ) mPos = 0;
+	mNum = mNum < mWindowSize ? mNum + 1 : mNum;
+	mNewestX = X;
+	mOldestX = mX[mNum < mWindowSize ? 0 : mPos];
+
+	// Until there are enough points for a line the latest delta is used as is
+	if( mNum < 3 )
+	{
+		mCurve = VelocityCurve();
+		mCurve.t0 = X;
+		mCurve.c0 = Y;
+		return;
+	}
+
+	/*
+	 * In order to calculate the ground truth for the slope and intercept,
+	 * we need to run the following calculation for all training data.
+	 * b --> slope = (N * Sum(x_i * y_i) - Sum(x_i) * Sum(y_i)) / (N * Sum(x_i^2) - Sum(x_i)^2)
+	 * a --> intercept = (Sum(y_i) - b * Sum(x_i)) / N
+	 */
+	double _x = 0, _y = 0;
+	for( int i = 0; i < mNum; i++ )
+		_x += mX[i], _y += mFx[i];
+	_x /= (double)mNum; _y /= (double)mNum;
+	double up = 0, down = 0;
+	for( int i = 0; i < mNum; i++ )
+	{
+		up += (mX[i] - _x) * (mFx[i] - _y);
+		down += (mX[i] - _x) * (mX[i] - _x);
+	}
+	// messages bunched at a single instant give no slope information
+	if( down > 0 )
+	{
+		b = up / down;
+		a = _y - b * _x;
+	}
+
+	// the fitted line, anchored at the newest sample and extrapolated from there
+	mCurve.t0 = X;
+	mCurve.c0 = b * X + a;
+	mCurve.c1 = b;
+	mCurve.c2 = 0;
+	mCurve.duration = std::numeric_limits<double>::infinity();
+}
+
+void LinearRegressionModel::TruncateHistory()
+/*
+ * Empties the window. The current line is kept until the next delta replaces it.
+ */
+{
+	mNum = 0;
+	mPos = 0;
+}
+
+double LinearRegressionModel::GroupDelay() const
+/*
+ * Each delta describes the motion over the interval before it arrived, so the fit lags by half
+ * a message interval. The line itself is extrapolated to the present and adds no further delay.
+ */
+{
+	if( mNum < 2 )
+		return 0;
+	return ( mNewestX - mOldestX ) / ( mNum - 1 ) * 0.5;
+}
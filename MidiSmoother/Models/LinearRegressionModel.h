@@ -0,0 +1,39 @@
+//
+//  LinearRegressionModel.h
+//  MidiSmoother
+//
+//  Sliding window least squares fit of the per message velocity against time.
+//
+
+#ifndef __MidiSmoother__LinearRegressionModel__
+#define __MidiSmoother__LinearRegressionModel__
+
+#include "SmoothingModel.h"
+
+class LinearRegressionModel : public SmoothingModel
+{
+public:
+	static const int kMaxWindowSize = 64;
+
+	LinearRegressionModel( int window_size );
+
+	virtual void Reset();
+
+	virtual void AddDelta( double time_ms, double distance_ms );
+
+	virtual void TruncateHistory();
+
+	virtual double GroupDelay() const;
+private:
+	const int mWindowSize;
+	double mX[kMaxWindowSize];
+	double mFx[kMaxWindowSize];
+	double a, b;
+	double mOldestX, mNewestX;
+	bool mbHasTime;			// true once a delta has been seen and so intervals can be measured
+	double mLastTime;
+	int mNum;
+	int mPos;
+};
+
+#endif /* defined(__MidiSmoother__LinearRegressionModel__) */
@@ -0,0 +1,128 @@
+//
+//  OneEuroModel.cpp
+//  MidiSmoother
+//
+
+#include "OneEuroModel.h"
+
+#include <math.h>
+
+// messages closer together than this (ms) are merged with the next one rather than differentiated
+static const double kMinimumInterval = 0.5;
+// weighting of the newest interval in the running interval estimate
+static const double kIntervalSmoothing = 0.2;
+static const double kPi = 3.14159265358979;
+
+static double SmoothingFactor( double dt_ms, double cutoff_hz )
+/*
+ * The exponential smoothing factor of a first order low pass at the given cutoff for a sample
+ * that arrived dt_ms after the previous one.
+ */
+{
+	double tau_ms = 1000.0 / ( 2.0 * kPi * cutoff_hz );
+	return 1.0 / ( 1.0 + tau_ms / dt_ms );
+}
+
+OneEuroModel::OneEuroModel( double min_cutoff_hz, double beta, double derivative_cutoff_hz ) :
+mMinCutoff( min_cutoff_hz ),
+mBeta( beta ),
+mDerivativeCutoff( derivative_cutoff_hz )
+/*
+ * Constructor for the One-Euro model.
+ *
+ * @param min_cutoff_hz
+ *		The cutoff used when the velocity is steady. Lower is smoother but later
+ * @param beta
+ *		How quickly the cutoff rises (Hz per unit of velocity change per second)
+ * @param derivative_cutoff_hz
+ *		The cutoff used when filtering the rate of change of velocity
+ */
+{
+	Reset();
+}
+
+void OneEuroModel::Reset()
+{
+	mbHasTime = false;
+	mbHasValue = false;
+	mLastTime = 0;
+	mPendingDistance = 0;
+	mInterval = 0;
+	mVelocity = 0;
+	mDerivative = 0;
+	mCutoff = mMinCutoff;
+	mCurve = VelocityCurve();
+}
+
+void OneEuroModel::AddDelta( double time_ms, double distance_ms )
+/*
+ * Filters the velocity implied by this delta and ramps the published velocity to it over one
+ * message interval, so the output stays continuous between messages.
+ *
+ * @param time_ms
+ *		The arrival time of the delta
+ * @param distance_ms
+ *		The distance moved since the last delta in song ms
+ */
+{
+	mPendingDistance += distance_ms;
+	if( !mbHasTime )
+	{
+		// the first delta covers an unknown amount of time, so it only starts the clock
+		mbHasTime = true;
+		mLastTime = time_ms;
+		mPendingDistance = 0;
+		return;
+	}
+
+	double dt = time_ms - mLastTime;
+	if( dt < kMinimumInterval )
+		return;
+
+	double raw_velocity = mPendingDistance / dt;
+	mPendingDistance = 0;
+	mLastTime = time_ms;
+	mInterval = mInterval > 0 ? mInterval + kIntervalSmoothing * ( dt - mInterval ) : dt;
+
+	double previous = mCurve.Velocity( time_ms );
+	double position = mCurve.Position( time_ms );
+	if( !mbHasValue )
+	{
+		mbHasValue = true;
+		mVelocity = raw_velocity;
+	}
+	else
+	{
+		double raw_derivative = ( raw_velocity - mVelocity ) / ( dt * 0.001 );
+		mDerivative += SmoothingFactor( dt, mDerivativeCutoff ) * ( raw_derivative - mDerivative );
+		mCutoff = mMinCutoff + mBeta * fabs( mDerivative );
+		mVelocity += SmoothingFactor( dt, mCutoff ) * ( raw_velocity - mVelocity );
+	}
+
+	mCurve.t0 = time_ms;
+	mCurve.p0 = position;
+	mCurve.c0 = previous;
+	mCurve.c1 = ( mVelocity - previous ) / mInterval;
+	mCurve.c2 = 0;
+	mCurve.duration = mInterval;
+}
+
+void OneEuroModel::TruncateHistory()
+/*
+ * Restarts the filter from the next raw velocity. The output still ramps there from where it is.
+ */
+{
+	mbHasValue = false;
+	mDerivative = 0;
+	mCutoff = mMinCutoff;
+}
+
+double OneEuroModel::GroupDelay() const
+/*
+ * A first order low pass delays slow motion by its time constant. On top of that each raw
+ * velocity is the average over the previous interval (half an interval late) and the output
+ * ramps to the filtered value over one interval (another half).
+ */
+{
+	return 1000.0 / ( 2.0 * kPi * mCutoff ) + mInterval;
+}
@@ -0,0 +1,46 @@
+//
+//  OneEuroModel.h
+//  MidiSmoother
+//
+//  One-Euro adaptive low pass filter over the per message velocity. The cutoff rises
+//  with the (filtered) rate of change of velocity, so slow spins are smoothed heavily
+//  while scratches follow the platter with little lag. Filter coefficients are derived
+//  from the actual time between messages, so irregular arrival is handled exactly.
+//
+
+#ifndef __MidiSmoother__OneEuroModel__
+#define __MidiSmoother__OneEuroModel__
+
+#include "SmoothingModel.h"
+
+class OneEuroModel : public SmoothingModel
+{
+public:
+	OneEuroModel( double min_cutoff_hz, double beta, double derivative_cutoff_hz );
+
+	virtual void Reset();
+
+	virtual void AddDelta( double time_ms, double distance_ms );
+
+	virtual void TruncateHistory();
+
+	virtual double GroupDelay() const;
+
+	// The cutoff (Hz) chosen for the most recent message
+	double CurrentCutoff() const { return mCutoff; }
+private:
+	const double mMinCutoff;
+	const double mBeta;
+	const double mDerivativeCutoff;
+
+	bool mbHasTime;				// true once a message has been seen and so intervals can be measured
+	bool mbHasValue;			// true once the filter holds a velocity
+	double mLastTime;			// ms
+	double mPendingDistance;	// distance from messages bunched too closely to measure an interval from
+	double mInterval;			// smoothed interval between messages (ms)
+	double mVelocity;			// filtered velocity
+	double mDerivative;			// filtered rate of change of velocity (per second)
+	double mCutoff;
+};
+
+#endif /* defined(__MidiSmoother__OneEuroModel__) */
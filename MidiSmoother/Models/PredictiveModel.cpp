@@ -0,0 +1,131 @@
+//
+//  PredictiveModel.cpp
+//  MidiSmoother
+//
+
+#include "PredictiveModel.h"
+
+#include <algorithm>
+#include <math.h>
+
+// time constant (ms) of the acceleration estimate
+static const double kAccelerationTimeConstant = 30.0;
+// time constant (ms) over which extrapolation is re-enabled after a reversal
+static const double kDampingRecovery = 20.0;
+// never extrapolate further ahead than this (ms), whatever the wrapped model claims
+static const double kMaximumLead = 30.0;
+
+PredictiveModel::PredictiveModel( double latency_budget_ms ) :
+mModel( NULL ),
+mLatencyBudget( latency_budget_ms )
+/*
+ * Constructor for the predictive model. SetModel must be called before any deltas are added.
+ *
+ * @param latency_budget_ms
+ *		The latency (ms) the output is allowed to have
+ */
+{
+	Reset();
+}
+
+void PredictiveModel::SetModel( SmoothingModel* model )
+{
+	mModel = model;
+	Reset();
+}
+
+void PredictiveModel::SetLatencyBudget( double latency_budget_ms )
+{
+	mLatencyBudget = latency_budget_ms;
+}
+
+void PredictiveModel::Reset()
+{
+	if( mModel )
+		mModel->Reset();
+	mbHasVelocity = false;
+	mLastTime = 0;
+	mLastVelocity = 0;
+	mAcceleration = 0;
+	mDamping = 1;
+	mLead = 0;
+	mOffset = 0;
+	mLatency = 0;
+	mLatencyTotal = 0;
+	mLatencyTime = 0;
+	mCurve = VelocityCurve();
+}
+
+void PredictiveModel::AddDelta( double time_ms, double distance_ms )
+/*
+ * Updates the wrapped model and republishes its curve shifted forward in time by the lead
+ * required to meet the latency budget.
+ *
+ * @param time_ms
+ *		The arrival time of the delta
+ * @param distance_ms
+ *		The distance moved since the last delta in song ms
+ */
+{
+	mModel->AddDelta( time_ms, distance_ms );
+	const VelocityCurve& curve = mModel->Curve();
+	double velocity = curve.Velocity( time_ms );
+
+	if( mbHasVelocity )
+	{
+		double dt = time_ms - mLastTime;
+		if( dt > 0 )
+		{
+			double weight = 1.0 - exp( -dt / kAccelerationTimeConstant );
+			mAcceleration += weight * ( ( velocity - mLastVelocity ) / dt - mAcceleration );
+
+			// the trend leading into a reversal says nothing about the motion after it
+			if( velocity * mLastVelocity < 0 )
+				mDamping = 0;
+			else
+				mDamping += ( 1.0 - mDamping ) * ( 1.0 - exp( -dt / kDampingRecovery ) );
+
+			mLatencyTotal += mLatency * dt;
+			mLatencyTime += dt;
+		}
+	}
+	mbHasVelocity = true;
+	mLastTime = time_ms;
+	mLastVelocity = velocity;
+
+	double delay = mModel->GroupDelay();
+	mLead = std::min( std::max( delay - mLatencyBudget, 0.0 ), kMaximumLead ) * mDamping;
+	double offset = mAcceleration * mLead;
+	// don't predict a change of direction the platter hasn't made yet
+	if( ( velocity + offset ) * velocity < 0 )
+		offset = -velocity;
+	mLatency = delay - mLead;
+
+	// blend from the previous offset to the new one over the wrapped segment so the output stays continuous
+	double previous_offset = mOffset;
+	mOffset = offset;
+	mCurve = curve;
+	mCurve.c0 += previous_offset;
+	mCurve.p0 += velocity * mLead;
+	if( curve.duration > 0 && curve.duration < kMaximumLead )
+		mCurve.c1 += ( offset - previous_offset ) / curve.duration;
+	else
+		mCurve.c0 += offset - previous_offset;
+}
+
+void PredictiveModel::TruncateHistory()
+{
+	mModel->TruncateHistory();
+	mAcceleration = 0;
+	mDamping = 0;
+}
+
+double PredictiveModel::GroupDelay() const
+{
+	return mLatency;
+}
+
+double PredictiveModel::AverageLatency() const
+{
+	return mLatencyTime > 0 ? mLatencyTotal / mLatencyTime : mLatency;
+}
@@ -0,0 +1,52 @@
+//
+//  PredictiveModel.h
+//  MidiSmoother
+//
+//  Wraps another model and extrapolates it forward by however much its group delay
+//  exceeds a latency budget. The extrapolation follows the smoothed acceleration of the
+//  wrapped model and is damped away after a change of direction, where following the
+//  trend would overshoot.
+//
+
+#ifndef __MidiSmoother__PredictiveModel__
+#define __MidiSmoother__PredictiveModel__
+
+#include "SmoothingModel.h"
+
+class PredictiveModel : public SmoothingModel
+{
+public:
+	PredictiveModel( double latency_budget_ms );
+
+	void SetModel( SmoothingModel* model );
+
+	void SetLatencyBudget( double latency_budget_ms );
+
+	virtual void Reset();
+
+	virtual void AddDelta( double time_ms, double distance_ms );
+
+	virtual void TruncateHistory();
+
+	// The latency left after extrapolation
+	virtual double GroupDelay() const;
+
+	// The time weighted average of GroupDelay since the last Reset
+	double AverageLatency() const;
+private:
+	SmoothingModel* mModel;
+	double mLatencyBudget;
+
+	bool mbHasVelocity;
+	double mLastTime;
+	double mLastVelocity;		// the wrapped model's velocity at the previous update
+	double mAcceleration;		// smoothed change of the wrapped model's velocity per ms
+	double mDamping;			// 0 straight after a reversal, recovering to 1
+	double mLead;				// ms the wrapped model is currently extrapolated forwards
+	double mOffset;				// velocity added to the wrapped model by the extrapolation
+	double mLatency;
+	double mLatencyTotal;		// sum of latency * time for the average
+	double mLatencyTime;
+};
+
+#endif /* defined(__MidiSmoother__PredictiveModel__) */
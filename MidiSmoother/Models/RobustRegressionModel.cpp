@@ -0,0 +1,126 @@
+//
+//  RobustRegressionModel.cpp
+//  MidiSmoother
+//
+
+#include "RobustRegressionModel.h"
+
+#include <algorithm>
+
+// pairs of knots closer together than this (ms) give no usable slope
+static const double kMinimumInterval = 0.5;
+// weighting of the newest interval in the running interval estimate
+static const double kIntervalSmoothing = 0.2;
+
+RobustRegressionModel::RobustRegressionModel( int window_size ) :
+mWindowSize( std::max( 2, std::min( window_size, (int)kMaxWindowSize ) ) ),
+mSlopes( mWindowSize * ( mWindowSize - 1 ) / 2 )
+/*
+ * Constructor for the robust regression model.
+ *
+ * @param window_size
+ *		The number of most recent knots the slopes are taken between
+ */
+{
+	Reset();
+}
+
+void RobustRegressionModel::Reset()
+{
+	mNumKnots = 0;
+	mNewestKnot = -1;
+	mPosition = 0;
+	mInterval = 0;
+	mSlopes.Clear();
+	mCurve = VelocityCurve();
+}
+
+const RobustRegressionModel::Knot& RobustRegressionModel::KnotFromNewest( int age ) const
+{
+	return mKnots[( mNewestKnot - age + kMaxWindowSize ) % kMaxWindowSize];
+}
+
+bool RobustRegressionModel::PairSlope( const Knot& earlier, const Knot& later, double& slope )
+/*
+ * The slope between two knots. Computed identically on insertion and removal so that the
+ * removed value is bit for bit the inserted one.
+ */
+{
+	double dt = later.time - earlier.time;
+	if( dt < kMinimumInterval )
+		return false;
+	slope = ( later.position - earlier.position ) / dt;
+	return true;
+}
+
+void RobustRegressionModel::AddDelta( double time_ms, double distance_ms )
+/*
+ * Slides the window on by one knot, removing the slopes to the knot that drops out and adding
+ * the slopes to the new one. The published velocity ramps to the new median over one interval.
+ *
+ * @param time_ms
+ *		The arrival time of the delta
+ * @param distance_ms
+ *		The distance moved since the last delta in song ms
+ */
+{
+	double slope;
+	if( mNumKnots == mWindowSize )
+	{
+		const Knot& oldest = KnotFromNewest( mNumKnots - 1 );
+		for( int age = 0; age < mNumKnots - 1; age++ )
+		{
+			if( PairSlope( oldest, KnotFromNewest( age ), slope ) )
+				mSlopes.Erase( slope );
+		}
+		mNumKnots--;
+	}
+
+	if( mNumKnots > 0 )
+	{
+		double interval = time_ms - KnotFromNewest( 0 ).time;
+		if( interval > 0 )
+			mInterval = mInterval > 0 ? mInterval + kIntervalSmoothing * ( interval - mInterval ) : interval;
+	}
+
+	mPosition += distance_ms;
+	Knot knot;
+	knot.time = time_ms;
+	knot.position = mPosition;
+	for( int age = 0; age < mNumKnots; age++ )
+	{
+		if( PairSlope( KnotFromNewest( age ), knot, slope ) )
+			mSlopes.Insert( slope );
+	}
+	mNewestKnot = ( mNewestKnot + 1 ) % kMaxWindowSize;
+	mKnots[mNewestKnot] = knot;
+	mNumKnots++;
+
+	double previous = mCurve.Velocity( time_ms );
+	double target = mSlopes.Size() > 0 ? mSlopes.Median() : previous;
+	double ramp = std::max( mInterval, kMinimumInterval );
+	mCurve.p0 = mCurve.Position( time_ms );
+	mCurve.t0 = time_ms;
+	mCurve.c0 = previous;
+	mCurve.c1 = ( target - previous ) / ramp;
+	mCurve.c2 = 0;
+	mCurve.duration = ramp;
+}
+
+void RobustRegressionModel::TruncateHistory()
+/*
+ * Keeps only the newest knot, dropping every slope.
+ */
+{
+	mNumKnots = std::min( mNumKnots, 1 );
+	mSlopes.Clear();
+}
+
+double RobustRegressionModel::GroupDelay() const
+/*
+ * The median slope describes the middle of the window, and the output takes a further interval
+ * to ramp to it.
+ */
+{
+	return ( std::max( mNumKnots - 1, 0 ) * 0.5 + 0.5 ) * mInterval;
+}
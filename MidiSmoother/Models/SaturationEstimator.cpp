@@ -0,0 +1,83 @@
+//
+//  SaturationEstimator.cpp
+//  MidiSmoother
+//
+
+#include "SaturationEstimator.h"
+
+#include <algorithm>
+#include <math.h>
+
+SaturationEstimator::SaturationEstimator( const DeviceProfile& device, double push_ms, double coast_ms ) :
+mLimitDistance( device.saturation_limit * device.MsPerTick() ),
+mLimitVelocity( device.saturation_limit * device.MsPerTick() * device.message_rate_hz / 1000.0 ),
+mMaxVelocity( std::max( device.max_velocity, mLimitVelocity ) ),
+mPushMs( push_ms ),
+mCoastMs( std::max( coast_ms, push_ms * 2 ) )
+/*
+ * @param device
+ *		The controller, whose saturation limit, message rate and fastest platter bound the estimate
+ * @param push_ms
+ *		The time constant of the push that carried the platter past the limit. Longer carries the
+ *		acceleration the run began with on further
+ * @param coast_ms
+ *		The time constant of the platter slowing back towards the limit's velocity after
+ */
+{
+	Reset();
+}
+
+void SaturationEstimator::Reset()
+{
+	mbSaturated = false;
+	mStartMs = 0;
+	mAcceleration = 0;
+	mPeakVelocity = 0;
+}
+
+void SaturationEstimator::Begin( double time_ms, double velocity, double interval_ms )
+/*
+ * The platter is at least at the limit's velocity by the first saturated message, so what it has
+ * gained since the message before shows how hard it is being pushed.
+ *
+ * @param time_ms
+ *		The arrival of the first saturated message
+ * @param velocity
+ *		The velocity of the message before, along the direction of the saturated messages
+ * @param interval_ms
+ *		The time between the two
+ */
+{
+	mbSaturated = true;
+	mStartMs = time_ms;
+	mAcceleration = std::max( mLimitVelocity - velocity, 0.0 ) / std::max( interval_ms, 1.0 );
+	mPeakVelocity = mLimitVelocity;
+}
+
+double SaturationEstimator::Velocity( double time_ms ) const
+/*
+ * The limit's velocity plus a pulse that starts out at the acceleration the run began with, gives
+ * out over mPushMs and dies away over mCoastMs, as the hand lets go and the platter coasts back
+ * down.
+ */
+{
+	double t = std::max( time_ms - mStartMs, 0.0 );
+	double excess = mAcceleration / ( 1 / mPushMs - 1 / mCoastMs ) * ( exp( -t / mCoastMs ) - exp( -t / mPushMs ) );
+	return std::min( mLimitVelocity + excess, mMaxVelocity );
+}
+
+double SaturationEstimator::Distance( double time_ms, double interval_ms )
+{
+	double velocity = Velocity( time_ms - interval_ms * 0.5 );
+	mPeakVelocity = std::max( mPeakVelocity, velocity );
+	return std::max( velocity * interval_ms, mLimitDistance );
+}
+
+SaturationEstimator::Run SaturationEstimator::End( double time_ms )
+{
+	Run run;
+	run.duration_ms = time_ms - mStartMs;
+	run.peak_velocity = mPeakVelocity;
+	mbSaturated = false;
+	return run;
+}
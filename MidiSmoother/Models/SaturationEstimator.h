@@ -0,0 +1,63 @@
+//
+//  SaturationEstimator.h
+//  MidiSmoother
+//
+//  Fills in the motion a device's messages can't carry. A 7 bit controller reports at most 63
+//  ticks a message, so once the platter moves faster than that many ticks a message interval
+//  (about 14 times normal speed on a 2048 tick platter) every message is clamped to the limit,
+//  and the velocity the messages show flattens there however fast the platter really goes. A
+//  saturated message still says the platter moved at least the limit, and the messages keep
+//  arriving at the device's rate, so the velocity over a run of them is only ever more than the
+//  limit's. How much more is taken from how the platter was accelerating when it reached the
+//  limit: the push is followed on from there and dies away as a flick of the platter does,
+//  bounded by the fastest a hand can turn the platter. Once a message comes in under the limit
+//  again the real velocity is known and the estimate is done with.
+//
+
+#ifndef __MidiSmoother__SaturationEstimator__
+#define __MidiSmoother__SaturationEstimator__
+
+#include "Devices/DeviceProfile.h"
+
+class SaturationEstimator
+{
+public:
+	// A run of saturated messages, as it ended
+	struct Run
+	{
+		double duration_ms;
+		double peak_velocity;	// the fastest the run was taken to be
+	};
+
+	SaturationEstimator( const DeviceProfile& device, double push_ms, double coast_ms );
+
+	void Reset();
+
+	bool IsSaturated() const { return mbSaturated; }
+
+	// Starts a run at the first saturated message, from the velocity of the message before it
+	void Begin( double time_ms, double velocity, double interval_ms );
+
+	// The distance (song ms, positive) most likely covered by a saturated message arriving at
+	// time_ms, interval_ms after the one before it
+	double Distance( double time_ms, double interval_ms );
+
+	// Ends the run at the first message under the limit
+	Run End( double time_ms );
+
+	// The velocity the run is taken to have at time_ms
+	double Velocity( double time_ms ) const;
+private:
+	const double mLimitDistance;	// song ms in a saturated message
+	const double mLimitVelocity;	// the velocity at which messages saturate at the device's rate
+	const double mMaxVelocity;		// the fastest the platter can be turned
+	const double mPushMs;			// time constant of the push that carried the platter past the limit
+	const double mCoastMs;			// time constant of the platter slowing once the push gives out
+
+	bool mbSaturated;
+	double mStartMs;
+	double mAcceleration;	// velocity per ms the platter was gaining as it reached the limit
+	double mPeakVelocity;
+};
+
+#endif /* defined(__MidiSmoother__SaturationEstimator__) */
@@ -0,0 +1,56 @@
+//
+//  SlidingMedian.cpp
+//  MidiSmoother
+//
+
+#include "SlidingMedian.h"
+
+#include <algorithm>
+
+SlidingMedian::SlidingMedian( int capacity ) :
+mValues( std::max( capacity, 1 ) ),
+mSize( 0 )
+/*
+ * @param capacity
+ *		The most values the set will hold at once
+ */
+{
+}
+
+void SlidingMedian::Clear()
+{
+	mSize = 0;
+}
+
+bool SlidingMedian::Insert( double value )
+{
+	if( mSize == (int)mValues.size() )
+		return false;
+	double* begin = mValues.data();
+	double* end = begin + mSize;
+	double* position = std::upper_bound( begin, end, value );
+	std::copy_backward( position, end, end + 1 );
+	*position = value;
+	mSize++;
+	return true;
+}
+
+bool SlidingMedian::Erase( double value )
+{
+	double* begin = mValues.data();
+	double* end = begin + mSize;
+	double* position = std::lower_bound( begin, end, value );
+	if( position == end || *position != value )
+		return false;
+	std::copy( position + 1, end, position );
+	mSize--;
+	return true;
+}
+
+double SlidingMedian::Median() const
+{
+	const double* values = mValues.data();
+	if( mSize & 1 )
+		return values[mSize / 2];
+	return ( values[mSize / 2 - 1] + values[mSize / 2] ) * 0.5;
+}
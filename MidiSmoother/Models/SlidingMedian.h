@@ -0,0 +1,38 @@
+//
+//  SlidingMedian.h
+//  MidiSmoother
+//
+//  Median of a multiset of values that supports insertion and removal of individual
+//  values. The values are kept in order in an array allocated once for the most the set
+//  will hold, so an update is a binary search and a move of the values after it, and
+//  never allocates; the median is always in the middle of the array.
+//
+
+#ifndef __MidiSmoother__SlidingMedian__
+#define __MidiSmoother__SlidingMedian__
+
+#include <vector>
+
+class SlidingMedian
+{
+public:
+	explicit SlidingMedian( int capacity );
+
+	void Clear();
+
+	// Adds a value. Returns false, leaving the set as it was, if it already holds its capacity
+	bool Insert( double value );
+
+	// Removes one instance of value. Returns false if it wasn't present
+	bool Erase( double value );
+
+	int Size() const { return mSize; }
+
+	// The median of the values. Must not be called while empty
+	double Median() const;
+private:
+	std::vector<double> mValues;	// the first mSize in ascending order
+	int mSize;
+};
+
+#endif /* defined(__MidiSmoother__SlidingMedian__) */
@@ -0,0 +1,38 @@
+//
+//  SmoothingModel.h
+//  MidiSmoother
+//
+//  Common interface for the smoothing engines driven by MidiSmoother.
+//
+
+#ifndef __MidiSmoother__SmoothingModel__
+#define __MidiSmoother__SmoothingModel__
+
+#include "VelocityCurve.h"
+
+class SmoothingModel
+{
+public:
+	virtual ~SmoothingModel() {}
+
+	// Forget all history. Called whenever midi processing (re)starts
+	virtual void Reset() = 0;
+
+	// A platter movement of distance_ms (song ms, may be negative) has arrived at time_ms
+	virtual void AddDelta( double time_ms, double distance_ms ) = 0;
+
+	// The platter has changed direction. Forget history from before the change while keeping
+	// the current output, so the model follows the new direction straight away
+	virtual void TruncateHistory() = 0;
+
+	// The current model, valid from its t0 onwards
+	const VelocityCurve& Curve() const { return mCurve; }
+
+	// Estimate of how far (ms) the model currently lags the platter
+	virtual double GroupDelay() const = 0;
+
+protected:
+	VelocityCurve mCurve;
+};
+
+#endif /* defined(__MidiSmoother__SmoothingModel__) */
@@ -0,0 +1,50 @@
+//
+//  VelocityCurve.h
+//  MidiSmoother
+//
+//  The published output of every smoothing model. A model describes the platter
+//  motion from its last update onwards as a velocity polynomial so that callers can
+//  evaluate velocity (and position) at any time without touching the model itself.
+//
+
+#ifndef __MidiSmoother__VelocityCurve__
+#define __MidiSmoother__VelocityCurve__
+
+#include <algorithm>
+
+struct VelocityCurve
+{
+	VelocityCurve() :
+	t0(0), p0(0), c0(0), c1(0), c2(0), duration(0)
+	{}
+
+	double Velocity( double time_ms ) const
+	/*
+	 * Velocity of the curve at the given time. Before t0 the curve holds its start
+	 * velocity, after t0 + duration it holds its end velocity.
+	 */
+	{
+		double dt = std::min( std::max( time_ms - t0, 0.0 ), duration );
+		return c0 + dt * ( c1 + dt * c2 );
+	}
+
+	double Position( double time_ms ) const
+	/*
+	 * Position (in song ms) of the curve at the given time, the integral of Velocity.
+	 */
+	{
+		double dt = std::max( time_ms - t0, 0.0 );
+		double t = std::min( dt, duration );
+		double position = p0 + t * ( c0 + t * ( c1 * 0.5 + t * c2 / 3.0 ) );
+		if( dt > t )
+			position += ( dt - t ) * Velocity( time_ms );
+		return position;
+	}
+
+	double t0;			// the time (ms) the curve is anchored at
+	double p0;			// the position (song ms) at t0
+	double c0, c1, c2;	// velocity is c0 + c1*dt + c2*dt^2 where dt is ms since t0
+	double duration;	// ms after t0 the polynomial applies for. Afterwards the velocity is held
+};
+
+#endif /* defined(__MidiSmoother__VelocityCurve__) */
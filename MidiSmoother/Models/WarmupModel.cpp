@@ -0,0 +1,171 @@
+//
+//  WarmupModel.cpp
+//  MidiSmoother
+//
+
+#include "WarmupModel.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+// the shortest interval (ms) a velocity is calculated over
+static const double kMinimumInterval = 0.5;
+
+static VelocityCurve Reanchor( const VelocityCurve& curve, double time_ms )
+/*
+ * The same curve with its polynomial anchored at time_ms, so curves can be mixed coefficient by
+ * coefficient. A curve that starts later than time_ms holds its start velocity until then, which
+ * is kept, but its shape from there on is not.
+ */
+{
+	VelocityCurve anchored;
+	anchored.t0 = time_ms;
+	anchored.p0 = curve.Position( time_ms );
+	anchored.c0 = curve.Velocity( time_ms );
+	double dt = time_ms - curve.t0;
+	if( dt >= 0 && dt < curve.duration )
+	{
+		anchored.c1 = curve.c1 + 2 * curve.c2 * dt;
+		anchored.c2 = curve.c2;
+		anchored.duration = curve.duration - dt;
+	}
+	else
+	{
+		anchored.duration = std::numeric_limits<double>::infinity();
+	}
+	return anchored;
+}
+
+WarmupModel::WarmupModel( int messages, double message_interval_ms, double slope_span_ms, double start_distance_ms ) :
+mModel( NULL ),
+mWarmupMessages( std::max( 2, messages ) ),
+mMessageInterval( std::max( message_interval_ms, kMinimumInterval ) ),
+mSlopeSpan( slope_span_ms ),
+mStartDistance( start_distance_ms )
+/*
+ * Constructor for the warm-up. SetModel must be called before any deltas are added.
+ *
+ * @param messages
+ *		The messages after a start from rest until the output is the wrapped model's alone
+ * @param message_interval_ms
+ *		The device's interval between messages while moving
+ * @param slope_span_ms
+ *		The time the messages must span before a slope is half trusted. Shorter follows the
+ *		platter's first acceleration sooner but lets the first intervals' jitter through
+ * @param start_distance_ms
+ *		A first message from rest that moves no further than this (song ms) is given no velocity
+ *		until the next message arrives, so that encoder jitter at rest doesn't start the platter
+ */
+{
+	Reset();
+}
+
+void WarmupModel::SetModel( SmoothingModel* model )
+{
+	mModel = model;
+	Reset();
+}
+
+void WarmupModel::Reset()
+{
+	if( mModel )
+		mModel->Reset();
+	mMessages = 0;
+	mbHasTime = false;
+	mLastTime = 0;
+	mOrigin = 0;
+	ClearFit();
+	mConfidence = 0;
+	mWarmupDelay = 0;
+	mCurve = VelocityCurve();
+}
+
+void WarmupModel::ClearFit()
+{
+	mWeight = mWeightX = mWeightY = mWeightXX = mWeightXY = 0;
+}
+
+void WarmupModel::AddDelta( double time_ms, double distance_ms )
+/*
+ * Each message is a point at the middle of the interval it covers, with the velocity over that
+ * interval, weighted by the interval's length: messages bunched together by the transport count
+ * for little, as the time they cover is unknown. The slope is shrunk towards flat by a prior
+ * worth mSlopeSpan of spread, so the first two or three messages give a steady velocity rather
+ * than a steep line through their jitter.
+ *
+ * @param time_ms
+ *		The arrival time of the delta
+ * @param distance_ms
+ *		The distance moved since the last delta in song ms
+ */
+{
+	mModel->AddDelta( time_ms, distance_ms );
+	if( mMessages <= mWarmupMessages )
+		mMessages++;
+	if( mMessages > mWarmupMessages )
+	{
+		mCurve = mModel->Curve();
+		return;
+	}
+
+	double interval = mbHasTime ? std::max( time_ms - mLastTime, kMinimumInterval ) : mMessageInterval;
+	if( !mbHasTime )
+		mOrigin = time_ms;
+	mbHasTime = true;
+	mLastTime = time_ms;
+
+	double x = time_ms - interval * 0.5 - mOrigin;
+	double y = distance_ms / interval;
+	mWeight += interval;
+	mWeightX += interval * x;
+	mWeightY += interval * y;
+	mWeightXX += interval * x * x;
+	mWeightXY += interval * x * y;
+
+	double mean_x = mWeightX / mWeight;
+	double mean_y = mWeightY / mWeight;
+	double spread = std::max( mWeightXX - mWeight * mean_x * mean_x, 0.0 );
+	double prior = mWeight * mSlopeSpan * mSlopeSpan;
+	double slope = ( mWeightXY - mWeight * mean_x * mean_y ) / ( spread + prior );
+	double now = time_ms - mOrigin;
+	double velocity = mean_y + slope * ( now - mean_x );
+	// a tick or two from rest may only be jitter, which the wrapped model has yet to speak for either,
+	// until the next message shows the platter is moving
+	if( mMessages == 1 && fabs( distance_ms ) <= mStartDistance )
+		velocity = slope = 0;
+	// the part of the lag behind the middle of the fit that the shrunk slope doesn't make up
+	mWarmupDelay = ( now - mean_x ) * prior / ( spread + prior );
+
+	// the wrapped model's share grows with the square of its history, as its first few fits are
+	// its least trustworthy
+	double history = ( mMessages - 1 ) / (double)( mWarmupMessages - 1 );
+	mConfidence = history * history;
+
+	VelocityCurve model = Reanchor( mModel->Curve(), time_ms );
+	mCurve.t0 = time_ms;
+	mCurve.p0 = model.p0;
+	mCurve.c0 = velocity + mConfidence * ( model.c0 - velocity );
+	mCurve.c1 = slope + mConfidence * ( model.c1 - slope );
+	mCurve.c2 = mConfidence * model.c2;
+	// the warm-up's own slope is only followed until the next message is due
+	mCurve.duration = std::min( model.duration, mMessageInterval );
+}
+
+void WarmupModel::TruncateHistory()
+/*
+ * A reversal during the warm-up starts its fit again from the new direction. The message count
+ * carries on, as the wrapped model keeps its own view of how much history it has.
+ */
+{
+	mModel->TruncateHistory();
+	if( mMessages <= mWarmupMessages )
+		ClearFit();
+}
+
+double WarmupModel::GroupDelay() const
+{
+	if( mMessages > mWarmupMessages )
+		return mModel->GroupDelay();
+	return mWarmupDelay + mConfidence * ( mModel->GroupDelay() - mWarmupDelay );
+}
@@ -0,0 +1,62 @@
+//
+//  WarmupModel.h
+//  MidiSmoother
+//
+//  Wraps another model for the first messages after a start from rest, where the wrapped model
+//  has too little history to be trusted: the regression, for one, gives the raw velocity of
+//  single messages and then a slope fitted through two or three of them. From the very first
+//  message the warm-up gives a line fitted through everything since the start, weighting each
+//  message by the time it covers, with its slope held back until the messages span enough time
+//  to show one. The first message's interval is unknown, so it is taken to be the device's
+//  message interval. The output hands over to the wrapped model as its history grows, and is
+//  the wrapped model's alone from then until the next start from rest. A first message no bigger
+//  than a reversal is held silent until a second confirms it, so jitter at rest stays silent.
+//
+
+#ifndef __MidiSmoother__WarmupModel__
+#define __MidiSmoother__WarmupModel__
+
+#include "SmoothingModel.h"
+
+class WarmupModel : public SmoothingModel
+{
+public:
+	WarmupModel( int messages, double message_interval_ms, double slope_span_ms, double start_distance_ms );
+
+	void SetModel( SmoothingModel* model );
+
+	void SetStartDistance( double start_distance_ms ) { mStartDistance = start_distance_ms; }
+
+	virtual void Reset();
+
+	virtual void AddDelta( double time_ms, double distance_ms );
+
+	virtual void TruncateHistory();
+
+	virtual double GroupDelay() const;
+
+	// Whether the output is still (partly) the warm-up's own
+	bool IsWarmingUp() const { return mMessages <= mWarmupMessages; }
+private:
+	void ClearFit();
+
+	SmoothingModel* mModel;
+	const int mWarmupMessages;		// messages until the output is the wrapped model's alone
+	const double mMessageInterval;	// ms, assumed for the first message
+	const double mSlopeSpan;		// ms the messages must span before the slope is half trusted
+	double mStartDistance;			// song ms a first message must exceed to be given a velocity alone
+
+	int mMessages;			// since the last Reset
+	bool mbHasTime;
+	double mLastTime;
+	double mOrigin;			// time the fit's sums are measured from, for precision
+	double mWeight;			// sums over the messages of the fit, each weighted by its interval
+	double mWeightX;
+	double mWeightY;
+	double mWeightXX;
+	double mWeightXY;
+	double mConfidence;		// the wrapped model's share of the output
+	double mWarmupDelay;	// the lag of the warm-up's own fit
+};
+
+#endif /* defined(__MidiSmoother__WarmupModel__) */
@@ -0,0 +1,321 @@
+//
+//  MetricsServer.cpp
+//  MidiSmoother
+//
+
+#include "MetricsServer.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// how long the server waits for a connection before checking whether it has been stopped (ms)
+static const int kAcceptWaitMs = 200;
+// how long a client has to send its request before it gets the default format (ms)
+static const int kRequestWaitMs = 100;
+// the interval rates are measured over
+static const double kRateIntervalS = 1.0;
+
+struct MetricValue
+{
+	const char* name;
+	const char* help;
+	const char* type;
+	double value;
+};
+
+static const MetricValue kMetricTemplate[] =
+{
+	{ "midi_events_total", "MIDI messages received by the smoother", "counter", 0 },
+	{ "midi_event_rate_hz", "MIDI messages received per second over the last second", "gauge", 0 },
+	{ "model_updates_total", "Deltas fed to the smoothing model, including replays after a change of model", "counter", 0 },
+	{ "model_update_rate_hz", "Model updates per second over the last second", "gauge", 0 },
+	{ "stops_total", "Times the platter came to a stop", "counter", 0 },
+	{ "saturated_messages_total", "MIDI messages at the device's saturation limit", "counter", 0 },
+	{ "saturated_runs_total", "Runs of saturated messages the platter's velocity was inferred through", "counter", 0 },
+	{ "saturated", "1 while the messages are saturated and the velocity is inferred", "gauge", 0 },
+	{ "latency_ms", "The current model's estimate of its output latency", "gauge", 0 },
+	{ "qos_level", "Steps down the ladder of models from the one selected", "gauge", 0 },
+	{ "qos_downgrades_total", "Steps down to a cheaper model", "counter", 0 },
+	{ "qos_upgrades_total", "Steps back up to a costlier model", "counter", 0 },
+	{ "update_cost_us", "Moving average of the cost of a model update, when there is an update budget", "gauge", 0 },
+	{ "service_wakeups_total", "Runs of the smoother's periodic work", "counter", 0 },
+	{ "wakeups_avoided_total", "Runs of the periodic work skipped while the platter was untouched", "counter", 0 },
+	{ "input_queue_depth", "MIDI events waiting to be handed to the smoother, as last seen", "gauge", 0 },
+	{ "audio_blocks_total", "Blocks of velocity requested by the audio consumer", "counter", 0 },
+	{ "audio_overruns_total", "Audio blocks requested too late to play on time", "counter", 0 },
+	{ "recorder_drops_total", "Audio steps the recorder failed to write", "counter", 0 },
+};
+static const size_t kNumMetrics = sizeof( kMetricTemplate ) / sizeof( kMetricTemplate[0] );
+
+MetricsServer::MetricsServer() :
+mDecks(),
+mSocketPath(),
+mListenSocket( -1 ),
+mServeThread(),
+mbThreadRunning( false ),
+mLastSample()
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+	Stop();
+}
+
+void MetricsServer::AddDeck( const std::string& name, const DeckMetrics& metrics )
+/*
+ * @param name
+ *		The deck label metrics are reported under
+ * @param metrics
+ *		The deck's counters, which must outlive the server
+ */
+{
+	Deck deck;
+	deck.name = name;
+	deck.metrics = &metrics;
+	deck.last_midi_events = metrics.midi_events.Value();
+	deck.last_model_updates = metrics.model_updates.Value();
+	deck.midi_rate_hz = 0;
+	deck.update_rate_hz = 0;
+	mDecks.push_back( deck );
+}
+
+void MetricsServer::SampleRates( std::chrono::steady_clock::time_point now )
+{
+	double seconds = std::chrono::duration<double>( now - mLastSample ).count();
+	if( seconds < kRateIntervalS )
+		return;
+	for( size_t i = 0; i < mDecks.size(); i++ )
+	{
+		Deck& deck = mDecks[i];
+		uint64_t midi_events = deck.metrics->midi_events.Value();
+		uint64_t model_updates = deck.metrics->model_updates.Value();
+		deck.midi_rate_hz = ( midi_events - deck.last_midi_events ) / seconds;
+		deck.update_rate_hz = ( model_updates - deck.last_model_updates ) / seconds;
+		deck.last_midi_events = midi_events;
+		deck.last_model_updates = model_updates;
+	}
+	mLastSample = now;
+}
+
+std::string MetricsServer::Render( bool json ) const
+/*
+ * Prometheus text groups each metric's samples from every deck under one HELP and TYPE; JSON
+ * has an object per deck.
+ */
+{
+	std::vector<std::vector<MetricValue> > values( mDecks.size() );
+	for( size_t d = 0; d < mDecks.size(); d++ )
+	{
+		const Deck& deck = mDecks[d];
+		const DeckMetrics& metrics = *deck.metrics;
+		const double snapshot[kNumMetrics] =
+		{
+			(double)metrics.midi_events.Value(), deck.midi_rate_hz,
+			(double)metrics.model_updates.Value(), deck.update_rate_hz,
+			(double)metrics.stops.Value(), (double)metrics.saturated_messages.Value(),
+			(double)metrics.saturated_runs.Value(), metrics.saturated.Value(),
+			metrics.latency_ms.Value(),
+			metrics.qos_level.Value(), (double)metrics.qos_downgrades.Value(),
+			(double)metrics.qos_upgrades.Value(), metrics.update_cost_us.Value(),
+			(double)metrics.service_wakeups.Value(), (double)metrics.wakeups_avoided.Value(),
+			metrics.input_queue_depth.Value(), (double)metrics.audio_blocks.Value(),
+			(double)metrics.audio_overruns.Value(), (double)metrics.recorder_drops.Value()
+		};
+		values[d].assign( kMetricTemplate, kMetricTemplate + kNumMetrics );
+		for( size_t m = 0; m < kNumMetrics; m++ )
+			values[d][m].value = snapshot[m];
+	}
+
+	std::string text;
+	char line[256];
+	if( json )
+	{
+		text = "{\"decks\":[";
+		for( size_t d = 0; d < mDecks.size(); d++ )
+		{
+			text += d > 0 ? ",{" : "{";
+			snprintf( line, sizeof( line ), "\"deck\":\"%s\"", mDecks[d].name.c_str() );
+			text += line;
+			for( size_t m = 0; m < kNumMetrics; m++ )
+			{
+				snprintf( line, sizeof( line ), ",\"%s\":%.17g", values[d][m].name, values[d][m].value );
+				text += line;
+			}
+			text += "}";
+		}
+		text += "]}\n";
+		return text;
+	}
+
+	for( size_t m = 0; m < kNumMetrics; m++ )
+	{
+		snprintf( line, sizeof( line ), "# HELP midismoother_%s %s\n# TYPE midismoother_%s %s\n", kMetricTemplate[m].name, kMetricTemplate[m].help,
+				 kMetricTemplate[m].name, kMetricTemplate[m].type );
+		text += line;
+		for( size_t d = 0; d < mDecks.size(); d++ )
+		{
+			snprintf( line, sizeof( line ), "midismoother_%s{deck=\"%s\"} %.17g\n", kMetricTemplate[m].name, mDecks[d].name.c_str(), values[d][m].value );
+			text += line;
+		}
+	}
+	return text;
+}
+
+#ifndef _WIN32
+
+static bool SendAll( int socket, const std::string& text )
+{
+#ifdef MSG_NOSIGNAL
+	const int flags = MSG_NOSIGNAL;
+#else
+	const int flags = 0;
+#endif
+	size_t sent = 0;
+	while( sent < text.size() )
+	{
+		ssize_t result = send( socket, text.data() + sent, text.size() - sent, flags );
+		if( result <= 0 )
+			return false;
+		sent += (size_t)result;
+	}
+	return true;
+}
+
+bool MetricsServer::Start( const std::string& socket_path )
+{
+	Stop();
+	struct sockaddr_un address;
+	memset( &address, 0, sizeof( address ) );
+	address.sun_family = AF_UNIX;
+	if( socket_path.empty() || socket_path.size() >= sizeof( address.sun_path ) )
+		return false;
+	memcpy( address.sun_path, socket_path.c_str(), socket_path.size() );
+
+	// a socket left by an earlier run is replaced, but anything else at the path is left alone
+	struct stat status;
+	if( lstat( socket_path.c_str(), &status ) == 0 )
+	{
+		if( !S_ISSOCK( status.st_mode ) )
+			return false;
+		unlink( socket_path.c_str() );
+	}
+
+	mListenSocket = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( mListenSocket < 0 )
+		return false;
+	if( bind( mListenSocket, (struct sockaddr*)&address, sizeof( address ) ) != 0 || listen( mListenSocket, 8 ) != 0 )
+	{
+		close( mListenSocket );
+		mListenSocket = -1;
+		return false;
+	}
+	mSocketPath = socket_path;
+	mLastSample = std::chrono::steady_clock::now();
+	mbThreadRunning = true;
+	mServeThread = std::thread( &MetricsServer::ServeThreadFunction, this );
+	return true;
+}
+
+void MetricsServer::Stop()
+{
+	mbThreadRunning = false;
+	if( mServeThread.joinable() )
+		mServeThread.join();
+	if( mListenSocket >= 0 )
+	{
+		close( mListenSocket );
+		mListenSocket = -1;
+		unlink( mSocketPath.c_str() );
+	}
+}
+
+void MetricsServer::ServeThreadFunction()
+/*
+ * Clients are served one at a time, each getting a single snapshot.
+ */
+{
+	while( mbThreadRunning )
+	{
+		struct pollfd listener;
+		listener.fd = mListenSocket;
+		listener.events = POLLIN;
+		listener.revents = 0;
+		int ready = poll( &listener, 1, kAcceptWaitMs );
+		SampleRates( std::chrono::steady_clock::now() );
+		if( ready <= 0 )
+			continue;
+		int client = accept( mListenSocket, NULL, NULL );
+		if( client < 0 )
+			continue;
+		ServeClient( client );
+		close( client );
+	}
+}
+
+void MetricsServer::ServeClient( int client )
+{
+	char request[1024];
+	ssize_t received = 0;
+	struct pollfd input;
+	input.fd = client;
+	input.events = POLLIN;
+	input.revents = 0;
+	if( poll( &input, 1, kRequestWaitMs ) > 0 )
+		received = recv( client, request, sizeof( request ) - 1, 0 );
+	request[received > 0 ? received : 0] = '\0';
+
+	bool http = strncmp( request, "GET ", 4 ) == 0;
+	bool json;
+	if( http )
+	{
+		const char* path = request + 4;
+		std::string target( path, strcspn( path, " \r\n" ) );
+		json = target.find( "json" ) != std::string::npos;
+	}
+	else
+	{
+		json = strncmp( request, "json", 4 ) == 0;
+	}
+
+	std::string body = Render( json );
+	if( http )
+	{
+		char header[256];
+		snprintf( header, sizeof( header ), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+				 json ? "application/json" : "text/plain; version=0.0.4", body.size() );
+		body = header + body;
+	}
+	SendAll( client, body );
+}
+
+#else
+
+bool MetricsServer::Start( const std::string& socket_path )
+{
+	(void)socket_path;
+	return false;
+}
+
+void MetricsServer::Stop()
+{
+}
+
+void MetricsServer::ServeThreadFunction()
+{
+}
+
+void MetricsServer::ServeClient( int client )
+{
+	(void)client;
+}
+
+#endif
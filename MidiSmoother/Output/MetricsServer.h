@@ -0,0 +1,73 @@
+//
+//  MetricsServer.h
+//  MidiSmoother
+//
+//  Serves a snapshot of each deck's DeckMetrics over a local Unix domain socket while the decks
+//  run, in Prometheus text format or as JSON. The server's thread only ever reads the counters,
+//  so a scrape never waits on, or holds up, the midi or audio threads. Rates are worked out on
+//  the server's thread once a second from the change in the counters.
+//
+//  A client can speak HTTP ("curl --unix-socket <path> http://localhost/metrics", adding
+//  ?format=json for JSON) or just connect and read, sending "json" first for JSON.
+//
+//  Only available on POSIX systems; elsewhere Start fails.
+//
+
+#ifndef __MidiSmoother__MetricsServer__
+#define __MidiSmoother__MetricsServer__
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Threading/Metrics.h"
+
+class MetricsServer
+{
+public:
+	MetricsServer();
+
+	~MetricsServer();
+
+	// Adds a deck to report. Must be called before Start
+	void AddDeck( const std::string& name, const DeckMetrics& metrics );
+
+	// Listens on the given socket path, replacing any socket already there. Fails, touching
+	// nothing, if something other than a socket is at the path
+	bool Start( const std::string& socket_path );
+
+	// Stops serving and removes the socket
+	void Stop();
+private:
+	MetricsServer( const MetricsServer& );
+	MetricsServer& operator=( const MetricsServer& );
+
+	struct Deck
+	{
+		std::string name;
+		const DeckMetrics* metrics;
+		uint64_t last_midi_events;
+		uint64_t last_model_updates;
+		double midi_rate_hz;
+		double update_rate_hz;
+	};
+
+	void ServeThreadFunction();
+
+	void SampleRates( std::chrono::steady_clock::time_point now );
+
+	void ServeClient( int client );
+
+	std::string Render( bool json ) const;
+
+	std::vector<Deck> mDecks;
+	std::string mSocketPath;
+	int mListenSocket;
+	std::thread mServeThread;
+	std::atomic<bool> mbThreadRunning;
+	std::chrono::steady_clock::time_point mLastSample;
+};
+
+#endif /* defined(__MidiSmoother__MetricsServer__) */
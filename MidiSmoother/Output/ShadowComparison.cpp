@@ -0,0 +1,215 @@
+//
+//  ShadowComparison.cpp
+//  MidiSmoother
+//
+
+#include "ShadowComparison.h"
+#include "Tools/Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+
+// events and audio steps in flight to the comparison, several seconds of each
+static const size_t kShadowQueueSize = 8192;
+// with no audio step to line up with, midi older than this is fed to the shadow anyway (ms)
+static const double kShadowHoldMs = 20.0;
+// how long the comparison sleeps with nothing to do (ms)
+static const int kShadowPollMs = 1;
+// audio steps kept for measuring the lag, about 12 minutes
+static const size_t kMaxLagSamples = 1 << 20;
+
+ShadowComparison::ShadowComparison( MidiSmoother& primary, MidiSmoother& shadow ) :
+mPrimary( primary ),
+mShadow( shadow ),
+mMidi( kShadowQueueSize ),
+mSamples( kShadowQueueSize ),
+mMidiDrops(),
+mSampleDrops(),
+mCompareThread(),
+mbThreadRunning( false ),
+mUpdates( 0 ),
+mPrimaryCostNs( 0 ),
+mShadowCostNs( 0 ),
+mCompared( 0 ),
+mTotalDivergence( 0 ),
+mTotalSquaredDivergence( 0 ),
+mMaxDivergence( 0 ),
+mPrimaryLatencyMs( 0 ),
+mShadowLatencyMs( 0 ),
+mTimes(),
+mPrimaryVelocity(),
+mShadowVelocity()
+/*
+ * @param primary
+ *		The smoother the deck plays
+ * @param shadow
+ *		The smoother to compare with it, configured but not started
+ */
+{
+}
+
+ShadowComparison::~ShadowComparison()
+{
+	End();
+	Finish();
+}
+
+void ShadowComparison::Begin()
+{
+	mShadow.StartMidiProcessing();
+	mShadow.FollowClock( mPrimary );
+	mbThreadRunning = true;
+	mCompareThread = std::thread( &ShadowComparison::CompareThreadFunction, this );
+}
+
+void ShadowComparison::End()
+{
+	mbThreadRunning = false;
+}
+
+void ShadowComparison::Finish()
+{
+	if( mCompareThread.joinable() )
+		mCompareThread.join();
+}
+
+void ShadowComparison::NotifyMidi( int32_t ticks, double time_ms, double cost_ns )
+{
+	ShadowMidi midi;
+	midi.ticks = ticks;
+	midi.time_ms = time_ms;
+	midi.cost_ns = cost_ns;
+	if( !mMidi.Push( midi ) )
+		mMidiDrops.Add();
+}
+
+void ShadowComparison::NotifyOutput( double time_ms, double velocity )
+{
+	ShadowSample sample;
+	sample.time_ms = time_ms;
+	sample.velocity = velocity;
+	if( !mSamples.Push( sample ) )
+		mSampleDrops.Add();
+}
+
+void ShadowComparison::CompareThreadFunction()
+/*
+ * Midi is fed to the shadow up to the time of the next audio step, so the shadow is read
+ * knowing only what the primary knew when it was read. Once the firer has finished, whatever
+ * is still queued is compared before the shadow is stopped.
+ */
+{
+	ShadowMidi midi;
+	ShadowSample sample;
+	bool has_midi = false, has_sample = false;
+	for( ;; )
+	{
+		bool running = mbThreadRunning.load();
+		if( !has_sample )
+			has_sample = mSamples.Pop( sample );
+		double feed_until = has_sample ? sample.time_ms : mShadow.CurrentTimeMs() - kShadowHoldMs;
+		bool progressed = false;
+		for( ;; )
+		{
+			if( !has_midi )
+				has_midi = mMidi.Pop( midi );
+			if( !has_midi || ( running && midi.time_ms > feed_until ) || ( has_sample && midi.time_ms > sample.time_ms ) )
+				break;
+			Feed( midi );
+			has_midi = false;
+			progressed = true;
+		}
+		if( has_sample )
+		{
+			Compare( sample );
+			has_sample = false;
+			continue;
+		}
+		if( !progressed )
+		{
+			if( !running && !has_midi )
+				break;
+			std::this_thread::sleep_for( std::chrono::milliseconds( kShadowPollMs ) );
+		}
+	}
+	mShadow.StopMidiProcessing();
+}
+
+void ShadowComparison::Feed( const ShadowMidi& midi )
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	mShadow.NotifyMidiValue( midi.ticks, midi.time_ms );
+	mShadowCostNs += std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count();
+	mPrimaryCostNs += midi.cost_ns;
+	mUpdates++;
+}
+
+void ShadowComparison::Compare( const ShadowSample& sample )
+{
+	double shadow_velocity = mShadow.VelocityAt( sample.time_ms );
+	double divergence = fabs( shadow_velocity - sample.velocity );
+	mCompared++;
+	mTotalDivergence += divergence;
+	mTotalSquaredDivergence += divergence * divergence;
+	mMaxDivergence = std::max( mMaxDivergence, divergence );
+	mPrimaryLatencyMs += mPrimary.Metrics().latency_ms.Value();
+	mShadowLatencyMs += mShadow.Metrics().latency_ms.Value();
+	if( mTimes.size() < kMaxLagSamples )
+	{
+		mTimes.push_back( sample.time_ms );
+		mPrimaryVelocity.push_back( sample.velocity );
+		mShadowVelocity.push_back( shadow_velocity );
+	}
+}
+
+static void Resample( const std::vector<double>& times, const std::vector<double>& values, double step_ms, std::vector<double>& grid )
+/*
+ * Linearly interpolates values taken at times onto a grid of step_ms from the first time. The
+ * audio takes its steps in bursts, a block at a time, so the times are far from even.
+ */
+{
+	grid.clear();
+	if( times.empty() )
+		return;
+	size_t next = 0;
+	for( double t = times.front(); t <= times.back(); t += step_ms )
+	{
+		while( next + 1 < times.size() && times[next + 1] <= t )
+			next++;
+		if( next + 1 < times.size() && times[next + 1] > times[next] )
+		{
+			double fraction = ( t - times[next] ) / ( times[next + 1] - times[next] );
+			grid.push_back( values[next] + ( values[next + 1] - values[next] ) * fraction );
+		}
+		else
+		{
+			grid.push_back( values[next] );
+		}
+	}
+}
+
+void ShadowComparison::Report( std::ostream& stream ) const
+{
+	MidiSmoother::QosStats primary = mPrimary.GetQosStats();
+	MidiSmoother::QosStats shadow = mShadow.GetQosStats();
+	stream << "Shadow: " << MidiSmoother::SmoothingModeName( shadow.mode ) << " against primary " << MidiSmoother::SmoothingModeName( primary.mode )
+		<< ", " << mCompared << " audio steps compared, " << mUpdates << " midi events" << std::endl;
+	if( mMidiDrops.Value() > 0 || mSampleDrops.Value() > 0 )
+		stream << "  dropped " << mMidiDrops.Value() << " midi events and " << mSampleDrops.Value() << " audio steps, the shadow fell behind" << std::endl;
+	if( mCompared == 0 )
+		return;
+
+	stream << "  divergence: mean " << mTotalDivergence / mCompared << ", rms " << sqrt( mTotalSquaredDivergence / mCompared )
+		<< ", max " << mMaxDivergence << std::endl;
+
+	std::vector<double> primary_grid, shadow_grid;
+	Resample( mTimes, mPrimaryVelocity, kReplayStepMs, primary_grid );
+	Resample( mTimes, mShadowVelocity, kReplayStepMs, shadow_grid );
+	ReplayQuality quality = ScoreReplay( shadow_grid, primary_grid );
+	stream << "  lag behind primary " << quality.lag_ms << "ms, smoothness (mean step) " << quality.mean_step << " against "
+		<< ScoreReplay( primary_grid, primary_grid ).mean_step << std::endl;
+	stream << "  estimated latency: primary " << mPrimaryLatencyMs / mCompared << "ms, shadow " << mShadowLatencyMs / mCompared << "ms" << std::endl;
+	if( mUpdates > 0 )
+		stream << "  update cost: primary " << mPrimaryCostNs / mUpdates << "ns, shadow " << mShadowCostNs / mUpdates << "ns" << std::endl;
+}
@@ -0,0 +1,104 @@
+//
+//  ShadowComparison.h
+//  MidiSmoother
+//
+//  Runs a second "shadow" smoother on the live midi alongside the deck's primary one, so a new
+//  engine or setting can be judged on real input before anything is switched to it. Only the
+//  primary is heard. The firer hands each event to the shadow after the primary has it, and
+//  the audio consumer hands over each velocity it was given with its timestamp; both go through
+//  queues that drop rather than wait, so nothing the shadow does can hold up the deck.
+//
+//  The comparison runs on its own thread, feeding the shadow the midi up to each audio
+//  timestamp and reading the shadow's velocity at that timestamp, which is what the audio would
+//  have been given had the shadow been the primary. It accumulates the divergence between the
+//  two, the lag of the shadow behind the primary, both models' latency estimates and what an
+//  update costs each of them.
+//
+
+#ifndef __MidiSmoother__ShadowComparison__
+#define __MidiSmoother__ShadowComparison__
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "MidiSmoother.h"
+#include "Threading/Metrics.h"
+#include "Threading/SpscQueue.h"
+
+class ShadowComparison
+{
+public:
+	ShadowComparison( MidiSmoother& primary, MidiSmoother& shadow );
+
+	~ShadowComparison();
+
+	// Called by the firer once the primary has started processing. Starts the shadow on the
+	// primary's clock
+	void Begin();
+
+	// Called by the firer once it has fired everything. Never waits
+	void End();
+
+	// Waits for the comparison to finish everything handed to it. Call before Report
+	void Finish();
+
+	// Firer only: the primary has just been given an event, which took it cost_ns
+	void NotifyMidi( int32_t ticks, double time_ms, double cost_ns );
+
+	// Audio consumer only: the primary gave this velocity for this time
+	void NotifyOutput( double time_ms, double velocity );
+
+	void Report( std::ostream& stream ) const;
+private:
+	ShadowComparison( const ShadowComparison& );
+	ShadowComparison& operator=( const ShadowComparison& );
+
+	struct ShadowMidi
+	{
+		int32_t ticks;
+		double time_ms;
+		double cost_ns;
+	};
+
+	struct ShadowSample
+	{
+		double time_ms;
+		double velocity;
+	};
+
+	void CompareThreadFunction();
+
+	void Feed( const ShadowMidi& midi );
+
+	void Compare( const ShadowSample& sample );
+
+	MidiSmoother& mPrimary;
+	MidiSmoother& mShadow;
+
+	SpscQueue<ShadowMidi> mMidi;
+	SpscQueue<ShadowSample> mSamples;
+	MetricCounter mMidiDrops;		// written by the firer
+	MetricCounter mSampleDrops;		// written by the audio consumer
+
+	std::thread mCompareThread;
+	std::atomic<bool> mbThreadRunning;
+
+	// only touched by the comparison thread until it has finished
+	uint64_t mUpdates;
+	double mPrimaryCostNs;
+	double mShadowCostNs;
+	uint64_t mCompared;
+	double mTotalDivergence;
+	double mTotalSquaredDivergence;
+	double mMaxDivergence;
+	double mPrimaryLatencyMs;
+	double mShadowLatencyMs;
+	std::vector<double> mTimes;		// the first kMaxLagSamples steps, for measuring lag
+	std::vector<double> mPrimaryVelocity;
+	std::vector<double> mShadowVelocity;
+};
+
+#endif /* defined(__MidiSmoother__ShadowComparison__) */
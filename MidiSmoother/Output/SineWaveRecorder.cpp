@@ -14,7 +14,8 @@
 
 const float SineWaveRecorder::kGain = 0.8f;
 
-SineWaveRecorder::SineWaveRecorder(const std::string filename) :
+SineWaveRecorder::SineWaveRecorder(const std::string filename, const std::string trace_filename, bool real_time) :
+mTrace(VelocitySink::kSinkText, trace_filename, 2, real_time, true),
 mBytesWritten(0),
 mSinePhase(0),
 mPreviousVelocity(0)
@@ -23,6 +24,11 @@ mPreviousVelocity(0)
  *
  * @param filename
  *		The filename to save output to
+ * @param trace_filename
+ *		The filename to save the velocity trace (step ms, velocity) to
+ * @param real_time
+ *		Whether recording happens on a real time thread, which drops trace lines rather than
+ *		waiting for them to be written
  */
 {
 	mOutputFile = fopen( filename.c_str(), "wb" );
@@ -46,7 +52,6 @@ mPreviousVelocity(0)
 	
 	
 	mBaseSineStep = kBaseFrequency*(2.0*3.14159)/(kSampleRate*0.001);
-	mcsvFile = fopen("out.csv", "wb");
 }
 
 SineWaveRecorder::~SineWaveRecorder()
@@ -66,16 +71,9 @@ SineWaveRecorder::~SineWaveRecorder()
 		fclose( mOutputFile );
 		mOutputFile = NULL;
 	}
-
-	if (mcsvFile)
-	{
-		fclose(mcsvFile);
-		mcsvFile = NULL;
-	}
-
 }
 
-void SineWaveRecorder::RecordVelocity( double velocity, double for_time_ms)
+bool SineWaveRecorder::RecordVelocity( double velocity, double for_time_ms)
 /*
  * Creates new samples and records them to file for a given velocity and time step. The timestep determines how many samples 
  * to write
@@ -85,6 +83,8 @@ void SineWaveRecorder::RecordVelocity( double velocity, double for_time_ms)
  * 
  * @param for_time_ms
  *		the timestep (in milliseconds) that this velocity corresponds to
+ * @return
+ *		False if the step couldn't be written in full
  */
 {
 	float samples[256];
@@ -99,12 +99,13 @@ void SineWaveRecorder::RecordVelocity( double velocity, double for_time_ms)
 		mSinePhase += sine_step;
 		mSinePhase = fmod( mSinePhase, 2.0f * 3.14159f );
 	}
-	fwrite(&samples[0],sizeof(float)*num_samples,1,mOutputFile);
-	char str[200];
-	sprintf(str, "%f,%f\n", for_time_ms, velocity);
-	fwrite(&str, strlen(str), 1, mcsvFile);
-	
-	mBytesWritten += sizeof(float)*num_samples;
-	
 	mPreviousVelocity = velocity;
+	if( !mOutputFile || !mTrace.IsOpen() )
+		return false;
+	bool written = num_samples <= 0 || fwrite(&samples[0],sizeof(float)*num_samples,1,mOutputFile) == 1;
+	written = mTrace.Write(for_time_ms, velocity) && written;
+	
+	if( written )
+		mBytesWritten += sizeof(float)*num_samples;
+	return written;
 }
@@ -9,22 +9,25 @@
 #ifndef __MidiSmoother__SineWaveRecorder__
 #define __MidiSmoother__SineWaveRecorder__
 
+#include <cstdio>
 #include <string>
 
+#include "VelocitySink.h"
+
 class SineWaveRecorder
 {
 public:
-	SineWaveRecorder(const std::string filename);
+	SineWaveRecorder(const std::string filename, const std::string trace_filename = "out.csv", bool real_time = true);
 	~SineWaveRecorder();
 	
-	void RecordVelocity( double velocity, double for_time_ms);
+	bool RecordVelocity( double velocity, double for_time_ms);
 private:
 	static const int kSampleRate = 48000;
 	static const int kBaseFrequency = 1;
 	static const float kGain;
 	
 	FILE* mOutputFile;
-	FILE* mcsvFile;
+	VelocitySink mTrace;
 	unsigned long mBytesWritten;
 	
 	double mBaseSineStep;
@@ -0,0 +1,289 @@
+//
+//  VelocityCapture.cpp
+//  MidiSmoother
+//
+
+#include "VelocityCapture.h"
+#include "VelocitySink.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <math.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const char kSpillMagic[8] = { 'M', 'S', 'C', 'A', 'P', 'T', '0', '1' };
+// slower than this the platter counts as stopped (1 is normal speed)
+static const double kStoppedVelocity = 0.01;
+
+VelocityCapture::VelocityCapture( size_t max_records, const std::string& spill_filename ) :
+mbOpen( false ),
+mCapacity( 0 ),
+mPages(),
+mPageStorage(),
+mpMapping( NULL ),
+mMappingBytes( 0 ),
+mpHeader( NULL ),
+mCount( 0 ),
+mDrops( 0 )
+/*
+ * @param max_records
+ *		The records to make room for. At the consumer's rate a minute is about 83000
+ * @param spill_filename
+ *		A file to keep the pages in, or empty to keep them in memory
+ */
+{
+	size_t pages = ( max_records + kPageRecords - 1 ) / kPageRecords;
+	if( spill_filename.empty() )
+	{
+		AllocatePages( pages );
+		mbOpen = true;
+	}
+	else
+	{
+		mbOpen = MapSpillFile( spill_filename, pages );
+	}
+}
+
+VelocityCapture::~VelocityCapture()
+{
+	Release();
+}
+
+void VelocityCapture::AllocatePages( size_t pages )
+/*
+ * The pages are value initialised, which touches every one of them now rather than on the audio
+ * thread's first write.
+ */
+{
+	mPageStorage.assign( pages, std::vector<CapturedVelocity>() );
+	mPages.resize( pages );
+	for( size_t i = 0; i < pages; i++ )
+	{
+		mPageStorage[i].resize( kPageRecords );
+		mPages[i] = mPageStorage[i].data();
+	}
+	mCapacity = pages * kPageRecords;
+}
+
+#ifndef _WIN32
+
+bool VelocityCapture::MapSpillFile( const std::string& filename, size_t pages )
+/*
+ * The file is sized for every page up front and the mapping zeroed, so the file's blocks and the
+ * mapping's pages all exist before the audio thread writes to them.
+ */
+{
+	size_t bytes = sizeof( SpillHeader ) + pages * kPageRecords * sizeof( CapturedVelocity );
+	int file = open( filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+	if( file < 0 )
+		return false;
+	void* mapping = MAP_FAILED;
+	if( ftruncate( file, (off_t)bytes ) == 0 )
+		mapping = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0 );
+	close( file );
+	if( mapping == MAP_FAILED )
+		return false;
+
+	memset( mapping, 0, bytes );
+	mpMapping = mapping;
+	mMappingBytes = bytes;
+	mpHeader = (SpillHeader*)mapping;
+	memcpy( mpHeader->magic, kSpillMagic, sizeof( kSpillMagic ) );
+	mpHeader->capacity = pages * kPageRecords;
+	mpHeader->count = 0;
+
+	CapturedVelocity* records = (CapturedVelocity*)( mpHeader + 1 );
+	mPages.resize( pages );
+	for( size_t i = 0; i < pages; i++ )
+		mPages[i] = records + i * kPageRecords;
+	mCapacity = pages * kPageRecords;
+	return true;
+}
+
+void VelocityCapture::Release()
+{
+	if( mpMapping )
+	{
+		msync( mpMapping, mMappingBytes, MS_SYNC );
+		munmap( mpMapping, mMappingBytes );
+	}
+	mpMapping = NULL;
+	mMappingBytes = 0;
+	mpHeader = NULL;
+	mPages.clear();
+	mPageStorage.clear();
+	mCapacity = 0;
+}
+
+#else
+
+bool VelocityCapture::MapSpillFile( const std::string& filename, size_t pages )
+{
+	(void)filename;
+	(void)pages;
+	return false;
+}
+
+void VelocityCapture::Release()
+{
+	mPages.clear();
+	mPageStorage.clear();
+	mCapacity = 0;
+}
+
+#endif
+
+bool VelocityCapture::Append( double time_ms, double velocity )
+{
+	size_t count = mCount.load( std::memory_order_relaxed );
+	if( count == mCapacity )
+	{
+		mDrops.store( mDrops.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+		return false;
+	}
+	CapturedVelocity& record = mPages[count / kPageRecords][count % kPageRecords];
+	record.time_ms = time_ms;
+	record.velocity = velocity;
+	mCount.store( count + 1, std::memory_order_release );
+	if( mpHeader )
+		mpHeader->count = count + 1;
+	return true;
+}
+
+bool VelocityCapture::Load( const std::string& filename )
+{
+	FILE* file = fopen( filename.c_str(), "rb" );
+	if( !file )
+		return false;
+	SpillHeader header;
+	bool loaded = fread( &header, sizeof( header ), 1, file ) == 1 && memcmp( header.magic, kSpillMagic, sizeof( kSpillMagic ) ) == 0
+		&& header.count <= header.capacity;
+	// a truncated or corrupt file may claim more records than it holds, which mustn't be allocated
+	if( loaded )
+	{
+		long records_end = fseek( file, 0, SEEK_END ) == 0 ? ftell( file ) : -1;
+		loaded = records_end >= (long)sizeof( header ) && fseek( file, (long)sizeof( header ), SEEK_SET ) == 0 &&
+			header.count <= (uint64_t)( records_end - (long)sizeof( header ) ) / sizeof( CapturedVelocity );
+	}
+	if( loaded )
+	{
+		Release();
+		AllocatePages( (size_t)( header.count + kPageRecords - 1 ) / kPageRecords );
+		size_t remaining = (size_t)header.count;
+		for( size_t i = 0; i < mPages.size() && loaded; i++ )
+		{
+			size_t records = std::min( remaining, kPageRecords );
+			loaded = fread( mPages[i], sizeof( CapturedVelocity ), records, file ) == records;
+			remaining -= records;
+		}
+		mCount.store( loaded ? (size_t)header.count : 0, std::memory_order_release );
+		mDrops.store( 0, std::memory_order_relaxed );
+		mbOpen = loaded;
+	}
+	fclose( file );
+	return loaded;
+}
+
+bool VelocityCapture::Dump( const std::string& filename ) const
+{
+	FILE* file = fopen( filename.c_str(), "w" );
+	if( !file )
+		return false;
+	bool written = true;
+	std::vector<char> text( kPageRecords * 66 );
+	const size_t count = Size();
+	for( size_t start = 0; start < count && written; start += kPageRecords )
+	{
+		char* p = text.data();
+		for( size_t i = start; i < std::min( count, start + kPageRecords ); i++ )
+		{
+			p += FormatFixed6( (*this)[i].time_ms, p );
+			*p++ = ',';
+			p += FormatFixed6( (*this)[i].velocity, p );
+			*p++ = '\n';
+		}
+		written = fwrite( text.data(), 1, p - text.data(), file ) == (size_t)( p - text.data() );
+	}
+	return fclose( file ) == 0 && written;
+}
+
+void VelocityCapture::Report( std::ostream& stream ) const
+/*
+ * The mean step is the same smoothness measure the benchmark scores models by. The longest gap
+ * between reads shows where the audio thread ran late.
+ */
+{
+	const size_t count = Size();
+	stream << "Capture: " << count << " of " << mCapacity << " records";
+	if( Drops() > 0 )
+		stream << ", " << Drops() << " dropped when full";
+	stream << std::endl;
+	if( count < 2 )
+		return;
+
+	double total_velocity = 0, peak_velocity = 0, total_step = 0, max_step = 0, max_gap_ms = 0, stopped_ms = 0;
+	int reversals = 0, direction = 0;
+	for( size_t i = 0; i < count; i++ )
+	{
+		const CapturedVelocity& record = (*this)[i];
+		total_velocity += record.velocity;
+		peak_velocity = std::max( peak_velocity, fabs( record.velocity ) );
+		if( fabs( record.velocity ) >= kStoppedVelocity )
+		{
+			int sign = record.velocity > 0 ? 1 : -1;
+			if( direction != 0 && sign != direction )
+				reversals++;
+			direction = sign;
+		}
+		if( i == 0 )
+			continue;
+		const CapturedVelocity& previous = (*this)[i - 1];
+		double step = fabs( record.velocity - previous.velocity );
+		total_step += step;
+		max_step = std::max( max_step, step );
+		double gap_ms = record.time_ms - previous.time_ms;
+		max_gap_ms = std::max( max_gap_ms, gap_ms );
+		if( fabs( previous.velocity ) < kStoppedVelocity )
+			stopped_ms += gap_ms;
+	}
+	double span_ms = (*this)[count - 1].time_ms - (*this)[0].time_ms;
+	stream << "  " << span_ms << "ms from " << (*this)[0].time_ms << "ms, longest gap between reads " << max_gap_ms << "ms" << std::endl;
+	stream << "  velocity mean " << total_velocity / count << ", peak " << peak_velocity << ", stopped "
+		<< ( span_ms > 0 ? 100.0 * stopped_ms / span_ms : 0 ) << "% of the time, " << reversals << " reversals" << std::endl;
+	stream << "  smoothness: mean step " << total_step / ( count - 1 ) << ", max step " << max_step << std::endl;
+}
+
+static void PrintCaptureReportUsage()
+{
+	std::printf( "Usage: MidiSmoother --capture-report <capture_file> [output_csv]\n" );
+	std::printf( "       Summarises a capture left by --capture, and optionally writes it out as time_ms,velocity lines\n" );
+}
+
+int RunCaptureReport( int argc, const char* argv[] )
+{
+	if( argc < 1 || argc > 2 )
+	{
+		PrintCaptureReportUsage();
+		return -1;
+	}
+
+	VelocityCapture capture( 0 );
+	if( !capture.Load( argv[0] ) )
+	{
+		std::printf( "Failed to read capture %s\n", argv[0] );
+		return -1;
+	}
+	capture.Report( std::cout );
+	if( argc == 2 && !capture.Dump( argv[1] ) )
+	{
+		std::printf( "Failed to write %s\n", argv[1] );
+		return -1;
+	}
+	return 0;
+}
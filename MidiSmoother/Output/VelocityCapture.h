@@ -0,0 +1,95 @@
+//
+//  VelocityCapture.h
+//  MidiSmoother
+//
+//  An in-memory record of every velocity the audio consumer was given, with the time it was read
+//  for, kept for analysis once the session is over. All of the space is taken when the capture
+//  is made, as fixed-size pages, so appending on the audio thread never allocates; once the
+//  pages are full further records are dropped and counted. The pages may instead be an mmapped
+//  file, which lets the kernel write a long capture out as it goes and leaves it on disk after
+//  the run for "--capture-report".
+//
+
+#ifndef __MidiSmoother__VelocityCapture__
+#define __MidiSmoother__VelocityCapture__
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct CapturedVelocity
+{
+	double time_ms;		// the smoother's time the velocity was read for
+	double velocity;
+};
+
+class VelocityCapture
+{
+public:
+	// records in a page
+	static const size_t kPageRecords = 4096;
+
+	// Room for max_records, rounded up to whole pages. With a spill_filename the pages are that
+	// file, mapped, and it is left holding the capture
+	VelocityCapture( size_t max_records, const std::string& spill_filename = "" );
+
+	~VelocityCapture();
+
+	bool IsOpen() const { return mbOpen; }
+
+	// Only one thread may append. Returns false if the capture is full
+	bool Append( double time_ms, double velocity );
+
+	// Records appended so far, safe to read from any thread
+	size_t Size() const { return mCount.load( std::memory_order_acquire ); }
+
+	size_t Capacity() const { return mCapacity; }
+
+	uint64_t Drops() const { return mDrops.load( std::memory_order_relaxed ); }
+
+	const CapturedVelocity& operator[]( size_t index ) const { return mPages[index / kPageRecords][index % kPageRecords]; }
+
+	// Replaces the contents with a capture left by a spill file. Not while anything appends
+	bool Load( const std::string& filename );
+
+	// Writes "time_ms,velocity" lines like the recorder's trace
+	bool Dump( const std::string& filename ) const;
+
+	void Report( std::ostream& stream ) const;
+private:
+	VelocityCapture( const VelocityCapture& );
+	VelocityCapture& operator=( const VelocityCapture& );
+
+	// the start of a spill file, followed by the records
+	struct SpillHeader
+	{
+		char magic[8];
+		uint64_t capacity;
+		uint64_t count;
+		uint64_t reserved[5];
+	};
+
+	void AllocatePages( size_t pages );
+
+	bool MapSpillFile( const std::string& filename, size_t pages );
+
+	void Release();
+
+	bool mbOpen;
+	size_t mCapacity;
+	std::vector<CapturedVelocity*> mPages;
+	std::vector<std::vector<CapturedVelocity> > mPageStorage;	// the pages when there is no spill file
+	void* mpMapping;
+	size_t mMappingBytes;
+	SpillHeader* mpHeader;		// in the mapping, kept up to date as records are appended
+
+	std::atomic<size_t> mCount;
+	std::atomic<uint64_t> mDrops;
+};
+
+// Entry point for "MidiSmoother --capture-report ...". argv holds the arguments after --capture-report
+int RunCaptureReport( int argc, const char* argv[] );
+
+#endif /* defined(__MidiSmoother__VelocityCapture__) */
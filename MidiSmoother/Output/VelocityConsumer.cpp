@@ -7,24 +7,41 @@
 //
 
 #include "VelocityConsumer.h"
+#include "Threading/ThreadConfig.h"
+#include "Threading/Tracer.h"
+#include "Tools/Benchmark.h"
 #include <algorithm>
-#include <iostream>
 
+// the audio steps (kReplayStepMs each) in the block requested each period
+static const int kIterationsPerBlock = 7;
 
 
 
-VelocityConsumer::VelocityConsumer( MidiSmoother& smoother, const std::string& output ) :
+
+VelocityConsumer::VelocityConsumer( MidiSmoother& smoother, const std::string& output, const std::string& trace, VelocitySink::Mode velocity_out ) :
 mMidiSmoother( smoother ),
+mReader( smoother, "audio" ),
 mThreadStartMutex(),
 mThreadStart(),
 mConsumeThread(),
 mbThreadRunning(false),
-mSineWaveRecorder( output )
+mSineWaveRecorder( output, trace ),
+mVelocityOut( velocity_out, "-", 1 ),
+mWakeupLatency(),
+mNextBlockTime(),
+mpShadow( NULL ),
+mpCapture( NULL )
 /*
  * Constructor for VelocityConsumer.
  * 
  * @param smoother
  *		The provided smoother that will be providing the midi values.
+ * @param output
+ *		The wav file the velocity is rendered to
+ * @param trace
+ *		The csv file the velocity of each step is written to
+ * @param velocity_out
+ *		How the velocity of each step is written to stdout
  */
 {
 }
@@ -50,6 +67,30 @@ void VelocityConsumer::Start()
     mThreadStart.notify_all();
 }
 
+void VelocityConsumer::Schedule( Reactor& reactor )
+/*
+ * Requests velocity from a task on the given reactor rather than from the consumer's own thread.
+ * Blocks are requested on a fixed schedule, and the task finishes once there is no more midi.
+ */
+{
+	mNextBlockTime = Reactor::Clock::now();
+	reactor.Schedule( "consumer", mNextBlockTime, [this]( Reactor::Clock::time_point now, Reactor::Clock::time_point& next )
+	{
+		if( !mMidiSmoother.MidiIsProcessing() )
+			return false;
+		RequestBlock();
+		mNextBlockTime += std::chrono::duration_cast<Reactor::Clock::duration>( std::chrono::duration<double, std::milli>( kReplayStepMs * kIterationsPerBlock ) );
+		// a block that can no longer be on time is skipped rather than played late
+		if( mNextBlockTime < now )
+		{
+			mNextBlockTime = now;
+			mMidiSmoother.Metrics().audio_overruns.Add();
+		}
+		next = mNextBlockTime;
+		return true;
+	} );
+}
+
 void VelocityConsumer::Stop()
 /*
  * Stop the firing of midi events. This will wait for the thread to end
@@ -76,21 +117,39 @@ void VelocityConsumer::WaitForCompletion()
 
 void VelocityConsumer::RequestAndTrackVelocity( double ms_to_process )
 /*
- * Requests a value from the midi smoother and will track the returned velocity for evaluation. Currently this means printing the velocity to std::cout
+ * Requests a value from the midi smoother and will track the returned velocity for evaluation: it is rendered by the recorder and
+ * written to stdout through mVelocityOut, neither of which formats or writes on this thread.
  *
  * @param ms_to_process
  *		The number of ms that we intend to step forwards.
  */
 {
-	double ms_to_step = mMidiSmoother.RequestMSToMoveValue( ms_to_process );
-	double velocity = ms_to_step / ms_to_process;
-    std::cout << velocity << "\n";
-	//mX[mNum] = ms_to_process;
-	//mY[mNum++] = velocity;
-	mSineWaveRecorder.RecordVelocity(velocity, ms_to_process);
+	double time_ms = mMidiSmoother.CurrentTimeMs();
+	double velocity = mReader.VelocityAt( time_ms );
+	if( mpShadow )
+		mpShadow->NotifyOutput( time_ms, velocity );
+	if( mpCapture )
+		mpCapture->Append( time_ms, velocity );
+	bool recorded = mVelocityOut.Write( velocity );
+	if( !mSineWaveRecorder.RecordVelocity(velocity, ms_to_process) || !recorded )
+		mMidiSmoother.Metrics().recorder_drops.Add();
 	
 }
 
+void VelocityConsumer::RequestBlock()
+/*
+ * Requests a block of updates.
+ */
+{
+	TraceBatch batch;
+	Trace( kTraceAudioBlock, kIterationsPerBlock, kReplayStepMs );
+	mMidiSmoother.Metrics().audio_blocks.Add();
+	for( int i=0;i<kIterationsPerBlock;i++ )
+	{
+		RequestAndTrackVelocity( kReplayStepMs );
+	}
+}
+
 void VelocityConsumer::ConsumeThreadFunction()
 /*
  * Static function run by the thread. This is responsible for requesting velocity in some pattern
@@ -99,6 +158,7 @@ void VelocityConsumer::ConsumeThreadFunction()
  *		The provided threading context. In this case it is an instance of a VelocityConsumer
  */
 {
+	ApplyThreadSettings( kThreadRoleAudio );
     
     // wait for the explicit start message
 	{
@@ -109,18 +169,20 @@ void VelocityConsumer::ConsumeThreadFunction()
 	}
     
 	// determine our request frequency
-	const int iterations_per_block = 7;
-	const double ms_request_per_iteration = 32/44.1;
-	const int total_interval_microseconds = (int)(ms_request_per_iteration*iterations_per_block*1000);
+	const int total_interval_microseconds = (int)(kReplayStepMs*kIterationsPerBlock*1000);
+	std::chrono::steady_clock::time_point previous_start;
+	bool first_block = true;
 	// continue asking until we are told to stop or there is no more midi
 	while( mbThreadRunning && mMidiSmoother.MidiIsProcessing())
     {
 		// request a block of updates
 		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-		for( int i=0;i<iterations_per_block;i++ )
-		{
-			RequestAndTrackVelocity( ms_request_per_iteration );
-		}
+		// with a block buffered, a block requested more than a period late has left nothing to play
+		if( !first_block && start - previous_start > std::chrono::microseconds( 2 * total_interval_microseconds ) )
+			mMidiSmoother.Metrics().audio_overruns.Add();
+		previous_start = start;
+		first_block = false;
+		RequestBlock();
 		
 		// calculate how long it took us to get here
 		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
@@ -130,5 +192,6 @@ void VelocityConsumer::ConsumeThreadFunction()
         std::chrono::microseconds interval = std::chrono::microseconds( microseconds ) ;
 		// and sleep
         std::this_thread::sleep_for( interval );
+		mWakeupLatency.Record( std::chrono::duration<double,std::micro>( std::chrono::steady_clock::now() - ( end + interval ) ).count() );
     }
 }
\ No newline at end of file
@@ -15,26 +15,43 @@
 
 #include "MidiSmoother.h"
 #include "SineWaveRecorder.h"
-
-#define MAX_NUM 2048
+#include "ShadowComparison.h"
+#include "VelocityCapture.h"
+#include "VelocitySink.h"
+#include "VelocityReader.h"
 
 class VelocityConsumer {
 public:
-	VelocityConsumer( MidiSmoother& smoother, const std::string& output );
+	VelocityConsumer( MidiSmoother& smoother, const std::string& output, const std::string& trace = "out.csv",
+					 VelocitySink::Mode velocity_out = VelocitySink::kSinkText );
 	
 	~VelocityConsumer();
 	
     void Start();
+
+	void Schedule( Reactor& reactor );
 	
     void Stop();
 	
 	void WaitForCompletion();
+
+	// Hands each velocity and the time it was read for to a shadow comparison. Set before starting
+	void SetShadow( ShadowComparison* shadow ) { mpShadow = shadow; }
+
+	// Appends each velocity and the time it was read for to a capture. Set before starting
+	void SetCapture( VelocityCapture* capture ) { mpCapture = capture; }
+
+	// How late the audio thread woke for each block, in us. Read once the consumer has finished
+	const LatencyHistogram& WakeupLatency() const { return mWakeupLatency; }
 private:
     void ConsumeThreadFunction( );
 	
 	void RequestAndTrackVelocity( double ms_to_process );
+
+	void RequestBlock();
 	
     MidiSmoother& mMidiSmoother;
+    VelocityReader mReader;
     
     std::mutex mThreadStartMutex;
     std::condition_variable mThreadStart;
@@ -42,6 +59,13 @@ private:
     bool mbThreadRunning;
 
 	SineWaveRecorder mSineWaveRecorder;
+	VelocitySink mVelocityOut;
+
+	LatencyHistogram mWakeupLatency;
+	Reactor::Clock::time_point mNextBlockTime;	// when the next block is due, when run on a reactor
+
+	ShadowComparison* mpShadow;
+	VelocityCapture* mpCapture;
 };
 
 #endif /* defined(__MidiSmoother__VelocityConsumer__) */
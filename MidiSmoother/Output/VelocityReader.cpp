@@ -0,0 +1,97 @@
+//
+//  VelocityReader.cpp
+//  MidiSmoother
+//
+
+#include "VelocityReader.h"
+#include "Threading/Tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// one read in this many is timed, so that timing costs nothing measurable
+static const uint64_t kTimedReadInterval = 256;
+
+VelocityReader::VelocityReader( MidiSmoother& smoother, const std::string& name ) :
+mMidiSmoother( smoother ),
+mName( name ),
+mReads( 0 ),
+mRetries( 0 ),
+mTimedReads( 0 ),
+mTimedNs( 0 ),
+mMaxNs( 0 )
+/*
+ * Constructor for a reader, which registers it with the smoother.
+ *
+ * @param smoother
+ *		The smoother to read
+ * @param name
+ *		What the reader is for, used when reporting
+ */
+{
+	mMidiSmoother.RegisterReader( this );
+}
+
+VelocityReader::~VelocityReader()
+{
+	mMidiSmoother.UnregisterReader( this );
+}
+
+double VelocityReader::VelocityAt( double time_ms )
+{
+	uint64_t reads = mReads.load( std::memory_order_relaxed );
+	bool timed = reads % kTimedReadInterval == 0;
+	std::chrono::steady_clock::time_point start;
+	if( timed )
+		start = std::chrono::steady_clock::now();
+
+	MidiSmoother::PublishedVelocity published;
+	int retries = mMidiSmoother.ReadPublished( published );
+	double velocity = published.Velocity( time_ms );
+	Trace( kTraceRead, retries, time_ms, velocity );
+
+	if( timed )
+	{
+		uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+		mTimedReads.store( mTimedReads.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+		mTimedNs.store( mTimedNs.load( std::memory_order_relaxed ) + ns, std::memory_order_relaxed );
+		mMaxNs.store( std::max( mMaxNs.load( std::memory_order_relaxed ), ns ), std::memory_order_relaxed );
+	}
+	if( retries > 0 )
+		mRetries.store( mRetries.load( std::memory_order_relaxed ) + retries, std::memory_order_relaxed );
+	mReads.store( reads + 1, std::memory_order_relaxed );
+	return velocity;
+}
+
+double VelocityReader::RequestMSToMoveValue( double ms_to_process )
+{
+	return VelocityAt( mMidiSmoother.CurrentTimeMs() ) * ms_to_process;
+}
+
+VelocityReader::Stats VelocityReader::GetStats() const
+{
+	Stats stats;
+	stats.reads = mReads.load( std::memory_order_relaxed );
+	stats.retries = mRetries.load( std::memory_order_relaxed );
+	uint64_t timed = mTimedReads.load( std::memory_order_relaxed );
+	stats.mean_ns = timed > 0 ? mTimedNs.load( std::memory_order_relaxed ) / (double)timed : 0;
+	stats.max_ns = (double)mMaxNs.load( std::memory_order_relaxed );
+	return stats;
+}
+
+void VelocityReader::Report( const MidiSmoother& smoother, std::ostream& stream )
+{
+	std::vector<VelocityReader*> readers = smoother.Readers();
+	char line[128];
+	snprintf( line, sizeof( line ), "%-16s %12s %10s %10s %10s", "reader", "reads", "retries", "mean ns", "max ns" );
+	stream << line << std::endl;
+	for( size_t i = 0; i < readers.size(); i++ )
+	{
+		Stats stats = readers[i]->GetStats();
+		snprintf( line, sizeof( line ), "%-16s %12llu %10llu %10.1f %10.0f", readers[i]->Name().c_str(),
+				 (unsigned long long)stats.reads, (unsigned long long)stats.retries, stats.mean_ns, stats.max_ns );
+		stream << line << std::endl;
+	}
+}
@@ -0,0 +1,69 @@
+//
+//  VelocityReader.h
+//  MidiSmoother
+//
+//  A registered reader of a MidiSmoother's published output. Each thread that needs the
+//  platter's velocity (the audio mixer, a waveform renderer, a recorder, a sync engine) owns
+//  its own reader, queries the smoother at whatever timestamps it likes without locking, and
+//  keeps its own statistics on a cache line no other reader writes to.
+//
+
+#ifndef __MidiSmoother__VelocityReader__
+#define __MidiSmoother__VelocityReader__
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <stdint.h>
+
+#include "MidiSmoother.h"
+#include "Threading/SpscQueue.h"
+
+class VelocityReader
+{
+public:
+	struct Stats
+	{
+		uint64_t reads;
+		uint64_t retries;		// reads that collided with a publish and were repeated
+		double mean_ns;			// cost of a read, from a sample of them
+		double max_ns;
+	};
+
+	VelocityReader( MidiSmoother& smoother, const std::string& name );
+
+	~VelocityReader();
+
+	const std::string& Name() const { return mName; }
+
+	// The velocity at a time on the smoother's clock. Only call from the reader's own thread
+	double VelocityAt( double time_ms );
+
+	// As MidiSmoother::RequestMSToMoveValue. Only call from the reader's own thread
+	double RequestMSToMoveValue( double ms_to_process );
+
+	// Safe to call from any thread
+	Stats GetStats() const;
+
+	// Prints the statistics of every reader registered with a smoother
+	static void Report( const MidiSmoother& smoother, std::ostream& stream );
+private:
+	VelocityReader( const VelocityReader& );
+	VelocityReader& operator=( const VelocityReader& );
+
+	MidiSmoother& mMidiSmoother;
+	const std::string mName;
+
+	// written only by the reading thread, so they are plain loads and stores rather than
+	// read-modify-writes, and padded apart from anything another thread writes. Padding rather
+	// than alignas, so that readers can be allocated with a plain new
+	char mLeadingPadding[kCacheLineSize];
+	std::atomic<uint64_t> mReads;
+	std::atomic<uint64_t> mRetries;
+	std::atomic<uint64_t> mTimedReads;
+	std::atomic<uint64_t> mTimedNs;
+	std::atomic<uint64_t> mMaxNs;
+	char mTrailingPadding[kCacheLineSize];
+};
+
+#endif /* defined(__MidiSmoother__VelocityReader__) */
@@ -0,0 +1,266 @@
+//
+//  VelocitySink.cpp
+//  MidiSmoother
+//
+
+#include "VelocitySink.h"
+
+#include <chrono>
+#include <cstring>
+#include <math.h>
+
+// doubles per buffer, and buffers in flight: about a second of a busy deck before any drop
+static const size_t kBufferValues = 8192;
+static const size_t kNumBuffers = 8;
+// how often the sink's thread looks for full buffers, and a blocked writer for a free one (ms)
+static const int kWriterPollMs = 2;
+// the longest line a text record makes: two numbers, a comma and a newline
+static const size_t kMaxLineChars = 2 * 32 + 2;
+
+static const char* const kModeNames[VelocitySink::kNumSinkModes] =
+{
+	"none", "binary", "text"
+};
+
+int FormatFixed6( double value, char* out )
+/*
+ * Works in integer millionths, which covers any velocity or time this program writes. Anything
+ * too big for that, or not finite, goes to snprintf.
+ */
+{
+	if( !( fabs( value ) < 9e12 ) )
+		return snprintf( out, 32, "%g", value );
+	char* p = out;
+	if( signbit( value ) )
+		*p++ = '-';
+	uint64_t millionths = (uint64_t)llround( fabs( value ) * 1e6 );
+	uint64_t whole = millionths / 1000000;
+	uint32_t fraction = (uint32_t)( millionths % 1000000 );
+
+	char digits[20];
+	int count = 0;
+	do
+	{
+		digits[count++] = (char)( '0' + whole % 10 );
+		whole /= 10;
+	} while( whole > 0 );
+	while( count > 0 )
+		*p++ = digits[--count];
+	*p++ = '.';
+	for( int i = 5; i >= 0; i-- )
+	{
+		p[i] = (char)( '0' + fraction % 10 );
+		fraction /= 10;
+	}
+	p += 6;
+	return (int)( p - out );
+}
+
+const char* VelocitySink::ModeName( Mode mode )
+{
+	return mode >= 0 && mode < kNumSinkModes ? kModeNames[mode] : "unknown";
+}
+
+bool VelocitySink::ModeFromName( const std::string& name, Mode& mode )
+{
+	for( int i = 0; i < kNumSinkModes; i++ )
+	{
+		if( name == kModeNames[i] )
+		{
+			mode = (Mode)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+VelocitySink::VelocitySink( Mode mode, const std::string& filename, int columns, bool real_time, bool fixed_text ) :
+mMode( mode ),
+mColumns( columns < 1 ? 1 : ( columns > 2 ? 2 : columns ) ),
+mbRealTime( real_time ),
+mbFixedText( fixed_text ),
+mFile( NULL ),
+mbOwnsFile( false ),
+mBuffers( kNumBuffers ),
+mCurrent( NULL ),
+mFull( kNumBuffers ),
+mFree( kNumBuffers ),
+mSubmitted( 0 ),
+mWritten( 0 ),
+mDrops( 0 ),
+mText( kBufferValues * kMaxLineChars ),
+mWriterThread(),
+mbThreadRunning( false )
+/*
+ * @param mode
+ *		How records are written
+ * @param filename
+ *		Where to, or "-" for stdout
+ * @param columns
+ *		The numbers in each record, 1 or 2
+ * @param real_time
+ *		Whether the writing thread must never wait for the sink's thread
+ * @param fixed_text
+ *		Whether text is written with 6 decimals like %f, rather than the 6 significant digits
+ *		std::cout gives by default
+ */
+{
+	if( mMode == kSinkNone )
+		return;
+	if( filename == "-" )
+	{
+		mFile = stdout;
+	}
+	else
+	{
+		mFile = fopen( filename.c_str(), mMode == kSinkBinary ? "wb" : "w" );
+		mbOwnsFile = true;
+	}
+	if( !mFile )
+		return;
+
+	for( size_t i = 0; i < mBuffers.size(); i++ )
+	{
+		mBuffers[i].values.resize( kBufferValues - kBufferValues % mColumns );
+		mBuffers[i].count = 0;
+		mFree.Push( &mBuffers[i] );
+	}
+	mbThreadRunning = true;
+	mWriterThread = std::thread( &VelocitySink::WriterThreadFunction, this );
+}
+
+VelocitySink::~VelocitySink()
+{
+	if( !mWriterThread.joinable() )
+		return;
+	Submit();
+	mbThreadRunning = false;
+	mWriterThread.join();
+	fflush( mFile );
+	if( mbOwnsFile )
+		fclose( mFile );
+}
+
+double* VelocitySink::Reserve()
+/*
+ * Space for one record in the current buffer, taking a free buffer if need be. NULL if there is
+ * none and the sink is real time.
+ */
+{
+	if( !mCurrent )
+	{
+		while( !mFree.Pop( mCurrent ) )
+		{
+			if( mbRealTime )
+			{
+				mCurrent = NULL;
+				mDrops.store( mDrops.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+				return NULL;
+			}
+			std::this_thread::sleep_for( std::chrono::milliseconds( kWriterPollMs ) );
+		}
+		mCurrent->count = 0;
+	}
+	double* record = &mCurrent->values[mCurrent->count];
+	mCurrent->count += mColumns;
+	return record;
+}
+
+void VelocitySink::Submit()
+{
+	if( !mCurrent )
+		return;
+	mSubmitted.store( mSubmitted.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+	mFull.Push( mCurrent );
+	mCurrent = NULL;
+}
+
+bool VelocitySink::Write( double value )
+{
+	if( !mWriterThread.joinable() )
+		return mMode == kSinkNone;
+	double* record = Reserve();
+	if( !record )
+		return false;
+	record[0] = value;
+	if( mColumns > 1 )
+		record[1] = 0;
+	if( mCurrent->count == mCurrent->values.size() )
+		Submit();
+	return true;
+}
+
+bool VelocitySink::Write( double first, double second )
+{
+	if( !mWriterThread.joinable() )
+		return mMode == kSinkNone;
+	double* record = Reserve();
+	if( !record )
+		return false;
+	record[0] = first;
+	if( mColumns > 1 )
+		record[1] = second;
+	if( mCurrent->count == mCurrent->values.size() )
+		Submit();
+	return true;
+}
+
+void VelocitySink::Flush()
+{
+	if( !mWriterThread.joinable() )
+		return;
+	Submit();
+	while( mWritten.load( std::memory_order_acquire ) < mSubmitted.load( std::memory_order_relaxed ) )
+		std::this_thread::sleep_for( std::chrono::milliseconds( kWriterPollMs ) );
+	fflush( mFile );
+}
+
+void VelocitySink::WriterThreadFunction()
+/*
+ * Writes full buffers until stopped, then whatever is left.
+ */
+{
+	for( ;; )
+	{
+		bool running = mbThreadRunning.load();
+		Buffer* buffer;
+		if( mFull.Pop( buffer ) )
+		{
+			WriteBuffer( *buffer );
+			mFree.Push( buffer );
+			mWritten.store( mWritten.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+			continue;
+		}
+		if( !running )
+			break;
+		std::this_thread::sleep_for( std::chrono::milliseconds( kWriterPollMs ) );
+	}
+}
+
+static int FormatGeneral( double value, char* out )
+{
+	return snprintf( out, 32, "%g", value );
+}
+
+void VelocitySink::WriteBuffer( const Buffer& buffer )
+{
+	if( mMode == kSinkBinary )
+	{
+		fwrite( buffer.values.data(), sizeof( double ), buffer.count, mFile );
+		return;
+	}
+
+	int (*format)( double, char* ) = mbFixedText ? FormatFixed6 : FormatGeneral;
+	char* p = mText.data();
+	for( size_t i = 0; i < buffer.count; i += mColumns )
+	{
+		p += format( buffer.values[i], p );
+		if( mColumns > 1 )
+		{
+			*p++ = ',';
+			p += format( buffer.values[i + 1], p );
+		}
+		*p++ = '\n';
+	}
+	fwrite( mText.data(), 1, p - mText.data(), mFile );
+}
@@ -0,0 +1,98 @@
+//
+//  VelocitySink.h
+//  MidiSmoother
+//
+//  Writes a stream of velocity records (one or two numbers each) to a file or stdout without
+//  doing any formatting or io on the thread that produces them. Records are appended as raw
+//  doubles to large preallocated buffers; full buffers go through a queue to the sink's own
+//  thread, which writes them as they are (binary) or formats a whole buffer of lines at once
+//  (text) and hands the buffer back. If the writer falls behind a real time producer, records
+//  are dropped and counted rather than waited for.
+//
+
+#ifndef __MidiSmoother__VelocitySink__
+#define __MidiSmoother__VelocitySink__
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "Threading/SpscQueue.h"
+
+class VelocitySink
+{
+public:
+	enum Mode
+	{
+		kSinkNone,		// records are discarded
+		kSinkBinary,	// native doubles, each record's numbers in turn
+		kSinkText,		// a line per record, numbers comma separated like %g, or %f if fixed_text
+		kNumSinkModes
+	};
+
+	static const char* ModeName( Mode mode );
+
+	static bool ModeFromName( const std::string& name, Mode& mode );
+
+	// filename may be "-" for stdout. A real time sink drops records when the writer is behind;
+	// otherwise Write waits for it
+	VelocitySink( Mode mode, const std::string& filename, int columns, bool real_time = true, bool fixed_text = false );
+
+	~VelocitySink();
+
+	// Only one thread may write. Returns false if the record was dropped
+	bool Write( double value );
+
+	bool Write( double first, double second );
+
+	// Writes everything so far and waits for it to reach the file. Not for the real time thread
+	void Flush();
+
+	bool IsOpen() const { return mMode == kSinkNone || mFile != NULL; }
+
+	uint64_t Drops() const { return mDrops.load( std::memory_order_relaxed ); }
+private:
+	VelocitySink( const VelocitySink& );
+	VelocitySink& operator=( const VelocitySink& );
+
+	struct Buffer
+	{
+		std::vector<double> values;
+		size_t count;
+	};
+
+	double* Reserve();
+
+	void Submit();
+
+	void WriterThreadFunction();
+
+	void WriteBuffer( const Buffer& buffer );
+
+	const Mode mMode;
+	const int mColumns;
+	const bool mbRealTime;
+	const bool mbFixedText;
+	FILE* mFile;
+	bool mbOwnsFile;
+
+	std::vector<Buffer> mBuffers;
+	Buffer* mCurrent;				// the buffer being filled, owned by the writing thread
+	SpscQueue<Buffer*> mFull;		// to the sink's thread
+	SpscQueue<Buffer*> mFree;		// back from it
+	std::atomic<uint64_t> mSubmitted;
+	std::atomic<uint64_t> mWritten;
+	std::atomic<uint64_t> mDrops;
+	std::vector<char> mText;		// the sink's thread's formatting buffer
+
+	std::thread mWriterThread;
+	std::atomic<bool> mbThreadRunning;
+};
+
+// Formats value like printf's %f into out, which must hold 32 characters. Returns the length
+int FormatFixed6( double value, char* out );
+
+#endif /* defined(__MidiSmoother__VelocitySink__) */
@@ -0,0 +1,85 @@
+//
+//  LatencyHistogram.cpp
+//  MidiSmoother
+//
+
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <math.h>
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+void LatencyHistogram::Reset()
+{
+	std::fill( mBuckets, mBuckets + kNumBuckets, 0 );
+	mCount = 0;
+	mTotal = 0;
+	mMax = 0;
+}
+
+int LatencyHistogram::BucketFor( double latency_us )
+/*
+ * Whole microseconds below kLinearBuckets, then kSubBuckets per power of two above.
+ */
+{
+	if( latency_us < kLinearBuckets )
+		return std::max( 0, (int)latency_us );
+	int exponent;
+	double mantissa = frexp( latency_us / kLinearBuckets, &exponent );	// latency = 64 * mantissa * 2^exponent, mantissa in [0.5, 1)
+	int bucket = kLinearBuckets + ( exponent - 1 ) * kSubBuckets + (int)( ( mantissa * 2 - 1 ) * kSubBuckets );
+	return std::min( bucket, kNumBuckets - 1 );
+}
+
+double LatencyHistogram::BucketUpperBound( int bucket )
+{
+	if( bucket < kLinearBuckets )
+		return bucket + 1;
+	int octave = ( bucket - kLinearBuckets ) / kSubBuckets;
+	int step = ( bucket - kLinearBuckets ) % kSubBuckets;
+	return ldexp( (double)kLinearBuckets, octave ) * ( 1 + ( step + 1 ) / (double)kSubBuckets );
+}
+
+void LatencyHistogram::Record( double latency_us )
+{
+	mBuckets[BucketFor( latency_us )]++;
+	mCount++;
+	mTotal += latency_us;
+	mMax = std::max( mMax, latency_us );
+}
+
+void LatencyHistogram::Merge( const LatencyHistogram& other )
+{
+	for( int i = 0; i < kNumBuckets; i++ )
+		mBuckets[i] += other.mBuckets[i];
+	mCount += other.mCount;
+	mTotal += other.mTotal;
+	mMax = std::max( mMax, other.mMax );
+}
+
+double LatencyHistogram::Mean() const
+{
+	return mCount > 0 ? mTotal / mCount : 0;
+}
+
+double LatencyHistogram::Percentile( double fraction ) const
+/*
+ * @return
+ *		The upper bound of the bucket holding the percentile, never more than the largest sample
+ */
+{
+	if( mCount == 0 )
+		return 0;
+	uint64_t target = (uint64_t)ceil( std::max( 0.0, std::min( fraction, 1.0 ) ) * mCount );
+	uint64_t seen = 0;
+	for( int i = 0; i < kNumBuckets; i++ )
+	{
+		seen += mBuckets[i];
+		if( seen >= target && seen > 0 )
+			return std::min( BucketUpperBound( i ), mMax );
+	}
+	return mMax;
+}
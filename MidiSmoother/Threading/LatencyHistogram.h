@@ -0,0 +1,50 @@
+//
+//  LatencyHistogram.h
+//  MidiSmoother
+//
+//  Fixed size histogram of latencies in microseconds, cheap enough to record into from a
+//  real time thread. Buckets are linear to 64us and then split each power of two into 8,
+//  so percentiles are accurate to within 12.5% at any scale. Recording is not thread safe:
+//  each thread keeps its own histogram and they are merged when reported.
+//
+
+#ifndef __MidiSmoother__LatencyHistogram__
+#define __MidiSmoother__LatencyHistogram__
+
+#include <stdint.h>
+
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void Reset();
+
+	void Record( double latency_us );
+
+	void Merge( const LatencyHistogram& other );
+
+	uint64_t Count() const { return mCount; }
+
+	double Mean() const;
+
+	double Max() const { return mMax; }
+
+	// The latency below which the given fraction (0-1) of the samples fell
+	double Percentile( double fraction ) const;
+private:
+	static const int kLinearBuckets = 64;
+	static const int kSubBuckets = 8;
+	static const int kNumBuckets = kLinearBuckets + 32 * kSubBuckets;
+
+	static int BucketFor( double latency_us );
+
+	static double BucketUpperBound( int bucket );
+
+	uint64_t mBuckets[kNumBuckets];
+	uint64_t mCount;
+	double mTotal;
+	double mMax;
+};
+
+#endif /* defined(__MidiSmoother__LatencyHistogram__) */
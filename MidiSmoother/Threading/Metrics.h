@@ -0,0 +1,86 @@
+//
+//  Metrics.h
+//  MidiSmoother
+//
+//  Live counters describing a deck, kept so they can be read while it runs (see MetricsServer)
+//  without the reader ever taking a lock the midi or audio paths take. Each counter and gauge
+//  has one writer at a time, so writing is a relaxed load and store rather than a locked read
+//  modify write, and costs the same as bumping a plain integer. Readers may see a value a
+//  moment old, never a torn one.
+//
+
+#ifndef __MidiSmoother__Metrics__
+#define __MidiSmoother__Metrics__
+
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+
+class MetricCounter
+{
+public:
+	MetricCounter() : mValue( 0 ) {}
+
+	// Only one thread may add at a time
+	void Add( uint64_t count = 1 )
+	{
+		mValue.store( mValue.load( std::memory_order_relaxed ) + count, std::memory_order_relaxed );
+	}
+
+	uint64_t Value() const { return mValue.load( std::memory_order_relaxed ); }
+private:
+	MetricCounter( const MetricCounter& );
+	MetricCounter& operator=( const MetricCounter& );
+
+	std::atomic<uint64_t> mValue;
+};
+
+class MetricGauge
+{
+public:
+	MetricGauge() : mBits( 0 ) {}
+
+	void Set( double value )
+	{
+		uint64_t bits;
+		memcpy( &bits, &value, sizeof( bits ) );
+		mBits.store( bits, std::memory_order_relaxed );
+	}
+
+	double Value() const
+	{
+		uint64_t bits = mBits.load( std::memory_order_relaxed );
+		double value;
+		memcpy( &value, &bits, sizeof( value ) );
+		return value;
+	}
+private:
+	MetricGauge( const MetricGauge& );
+	MetricGauge& operator=( const MetricGauge& );
+
+	std::atomic<uint64_t> mBits;
+};
+
+// Everything reported for one deck. Each is written by the part of the deck named
+struct DeckMetrics
+{
+	MetricCounter midi_events;		// MidiSmoother, with its mutex held
+	MetricCounter model_updates;	// MidiSmoother, including replays into a model stepped to
+	MetricCounter stops;			// MidiSmoother
+	MetricCounter saturated_messages;	// MidiSmoother, messages at the device's saturation limit
+	MetricCounter saturated_runs;	// MidiSmoother, runs of saturated messages the velocity was inferred through
+	MetricGauge saturated;			// MidiSmoother, 1 while in a run of saturated messages
+	MetricCounter qos_downgrades;	// MidiSmoother
+	MetricCounter qos_upgrades;		// MidiSmoother
+	MetricGauge qos_level;			// MidiSmoother, 0 on the selected model
+	MetricGauge update_cost_us;		// MidiSmoother, only measured with an update budget
+	MetricGauge latency_ms;			// MidiSmoother, the model's current latency estimate
+	MetricCounter service_wakeups;	// MidiSmoother's thread or task
+	MetricCounter wakeups_avoided;	// MidiSmoother's thread or task
+	MetricGauge input_queue_depth;	// MidiFirer or SharedMemoryIngress, events waiting as last seen
+	MetricCounter audio_blocks;		// VelocityConsumer
+	MetricCounter audio_overruns;	// VelocityConsumer, blocks requested too late to play on time
+	MetricCounter recorder_drops;	// VelocityConsumer, steps the recorder couldn't write
+};
+
+#endif /* defined(__MidiSmoother__Metrics__) */
@@ -0,0 +1,101 @@
+//
+//  Reactor.cpp
+//  MidiSmoother
+//
+
+#include "Reactor.h"
+
+#include <cstdio>
+
+Reactor::Reactor() :
+mTasks(),
+mDeadlines(),
+mNextOrder( 0 ),
+mWakeups( 0 ),
+mStopMutex(),
+mStopSignal(),
+mbStopping( false )
+{
+}
+
+void Reactor::Schedule( const std::string& name, Clock::time_point first, const Task& task )
+/*
+ * @param name
+ *		What the task is, used when reporting
+ * @param first
+ *		When the task first runs
+ * @param task
+ *		The work to do at each deadline
+ */
+{
+	TaskState state;
+	state.name = name;
+	state.task = task;
+	state.runs = 0;
+	mTasks.push_back( state );
+
+	Deadline deadline;
+	deadline.when = first;
+	deadline.order = mNextOrder++;
+	deadline.task = mTasks.size() - 1;
+	mDeadlines.push( deadline );
+}
+
+void Reactor::Run()
+{
+	{
+		std::lock_guard<std::mutex> lock( mStopMutex );
+		mbStopping = false;
+	}
+	while( !mDeadlines.empty() )
+	{
+		Deadline deadline = mDeadlines.top();
+		Clock::time_point now = Clock::now();
+		if( deadline.when > now )
+		{
+			// sleep until the deadline, unless told to stop first
+			std::unique_lock<std::mutex> lock( mStopMutex );
+			if( !mbStopping )
+				mStopSignal.wait_until( lock, deadline.when );
+			if( mbStopping )
+				break;
+			mWakeups++;
+			continue;
+		}
+		mDeadlines.pop();
+
+		TaskState& state = mTasks[deadline.task];
+		state.runs++;
+		state.lateness.Record( std::chrono::duration<double, std::micro>( now - deadline.when ).count() );
+		Clock::time_point next = now;
+		if( state.task( now, next ) )
+		{
+			deadline.when = next;
+			deadline.order = mNextOrder++;
+			mDeadlines.push( deadline );
+		}
+	}
+}
+
+void Reactor::Stop()
+{
+	std::lock_guard<std::mutex> lock( mStopMutex );
+	mbStopping = true;
+	mStopSignal.notify_all();
+}
+
+void Reactor::Report( std::ostream& stream ) const
+{
+	char line[128];
+	snprintf( line, sizeof( line ), "reactor: %llu wakeups", (unsigned long long)mWakeups );
+	stream << line << std::endl;
+	snprintf( line, sizeof( line ), "%-16s %10s %12s %12s %12s", "task", "runs", "mean late us", "p99 late us", "max late us" );
+	stream << line << std::endl;
+	for( size_t i = 0; i < mTasks.size(); i++ )
+	{
+		const LatencyHistogram& lateness = mTasks[i].lateness;
+		snprintf( line, sizeof( line ), "%-16s %10llu %12.1f %12.1f %12.1f", mTasks[i].name.c_str(), (unsigned long long)mTasks[i].runs,
+				 lateness.Mean(), lateness.Percentile( 0.99 ), lateness.Max() );
+		stream << line << std::endl;
+	}
+}
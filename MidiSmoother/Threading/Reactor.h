@@ -0,0 +1,87 @@
+//
+//  Reactor.h
+//  MidiSmoother
+//
+//  Single threaded, deadline ordered scheduler. Each task is a function that does one unit of
+//  work when its deadline arrives and says when it next wants to run. The thread running the
+//  reactor sleeps until the earliest deadline and runs tasks in deadline order, so a whole
+//  deck (MidiFirer, MidiSmoother and VelocityConsumer), or several decks, share one thread and
+//  wake once per deadline rather than once per thread per period.
+//
+//  Tasks are cooperative: a task that runs long delays every task due after it, which shows
+//  up as lateness in Report.
+//
+
+#ifndef __MidiSmoother__Reactor__
+#define __MidiSmoother__Reactor__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "LatencyHistogram.h"
+
+class Reactor
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// Called at or after its deadline. Returns false once finished, otherwise sets next to the
+	// next deadline (which may already have passed)
+	typedef std::function<bool( Clock::time_point now, Clock::time_point& next )> Task;
+
+	Reactor();
+
+	// Adds a task. Only call before Run or from a task
+	void Schedule( const std::string& name, Clock::time_point first, const Task& task );
+
+	// Runs tasks on the calling thread until none remain or Stop is called
+	void Run();
+
+	// Safe to call from any thread
+	void Stop();
+
+	// The number of times the reactor slept waiting for a deadline
+	uint64_t Wakeups() const { return mWakeups; }
+
+	// How late each task ran against its deadline
+	void Report( std::ostream& stream ) const;
+private:
+	struct TaskState
+	{
+		std::string name;
+		Task task;
+		uint64_t runs;
+		LatencyHistogram lateness;	// us
+	};
+
+	struct Deadline
+	{
+		Clock::time_point when;
+		uint64_t order;		// breaks ties first come first served
+		size_t task;
+
+		bool operator>( const Deadline& other ) const
+		{
+			return when != other.when ? when > other.when : order > other.order;
+		}
+	};
+
+	std::deque<TaskState> mTasks;		// a deque, so tasks scheduled while another runs don't move it
+	std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline> > mDeadlines;
+	uint64_t mNextOrder;
+	uint64_t mWakeups;
+
+	std::mutex mStopMutex;
+	std::condition_variable mStopSignal;
+	bool mbStopping;
+};
+
+#endif /* defined(__MidiSmoother__Reactor__) */
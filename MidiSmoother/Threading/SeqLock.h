@@ -0,0 +1,88 @@
+//
+//  SeqLock.h
+//  MidiSmoother
+//
+//  Publishes a small value from one writer to any number of readers without locking. The
+//  writer bumps a sequence number to odd, writes the value and bumps it back to even; a
+//  reader copies the value and retries if the sequence was odd or changed meanwhile. Readers
+//  never write shared memory, so however many there are they only share cache lines that
+//  stay clean until the next publish. The value is held as relaxed atomic words, so the
+//  copy a reader throws away is never a data race.
+//
+
+#ifndef __MidiSmoother__SeqLock__
+#define __MidiSmoother__SeqLock__
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+#include <stdint.h>
+
+#include "SpscQueue.h"
+
+template<typename T>
+class SeqLock
+{
+public:
+	SeqLock();
+
+	// Only one thread may store at a time
+	void Store( const T& value );
+
+	// Returns the number of times the read had to be retried because a store was in progress
+	int Load( T& value ) const;
+private:
+	SeqLock( const SeqLock& );
+	SeqLock& operator=( const SeqLock& );
+
+	static const size_t kWords = ( sizeof( T ) + sizeof( uint64_t ) - 1 ) / sizeof( uint64_t );
+
+	alignas( kCacheLineSize ) std::atomic<uint32_t> mSequence;
+	std::atomic<uint64_t> mWords[kWords];
+};
+
+template<typename T>
+SeqLock<T>::SeqLock() :
+mSequence( 0 )
+{
+	static_assert( std::is_trivially_copyable<T>::value, "SeqLock values are copied word by word" );
+	for( size_t i = 0; i < kWords; i++ )
+		mWords[i].store( 0, std::memory_order_relaxed );
+	Store( T() );
+}
+
+template<typename T>
+void SeqLock<T>::Store( const T& value )
+{
+	uint64_t words[kWords] = { 0 };
+	memcpy( words, &value, sizeof( T ) );
+
+	uint32_t sequence = mSequence.load( std::memory_order_relaxed );
+	mSequence.store( sequence + 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+	for( size_t i = 0; i < kWords; i++ )
+		mWords[i].store( words[i], std::memory_order_relaxed );
+	mSequence.store( sequence + 2, std::memory_order_release );
+}
+
+template<typename T>
+int SeqLock<T>::Load( T& value ) const
+{
+	uint64_t words[kWords];
+	for( int retries = 0; ; retries++ )
+	{
+		uint32_t before = mSequence.load( std::memory_order_acquire );
+		if( before & 1 )
+			continue;
+		for( size_t i = 0; i < kWords; i++ )
+			words[i] = mWords[i].load( std::memory_order_relaxed );
+		std::atomic_thread_fence( std::memory_order_acquire );
+		if( mSequence.load( std::memory_order_relaxed ) == before )
+		{
+			memcpy( &value, words, sizeof( T ) );
+			return retries;
+		}
+	}
+}
+
+#endif /* defined(__MidiSmoother__SeqLock__) */
@@ -0,0 +1,113 @@
+//
+//  SpscQueue.h
+//  MidiSmoother
+//
+//  Bounded lock-free queue for exactly one producer thread and one consumer thread. The
+//  capacity is fixed at construction, so once built the queue never allocates. Each side
+//  keeps a private copy of the other side's index and only reloads the shared one when its
+//  copy says the queue is full (or empty), so in the steady state the two threads don't
+//  touch each other's cache lines.
+//
+
+#ifndef __MidiSmoother__SpscQueue__
+#define __MidiSmoother__SpscQueue__
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+static const size_t kCacheLineSize = 64;
+
+template<typename T>
+class SpscQueue
+{
+public:
+	explicit SpscQueue( size_t capacity );
+
+	// Producer only. Returns false if the queue is full
+	bool Push( const T& value );
+
+	// Consumer only. Returns false if the queue is empty
+	bool Pop( T& value );
+
+	// A snapshot that may be out of date by the time it is used
+	size_t Size() const;
+
+	size_t Capacity() const { return mSlots.size(); }
+private:
+	SpscQueue( const SpscQueue& );
+	SpscQueue& operator=( const SpscQueue& );
+
+	static size_t RoundUpToPowerOfTwo( size_t value );
+
+	std::vector<T> mSlots;
+	const size_t mMask;
+
+	alignas( kCacheLineSize ) std::atomic<size_t> mHead;	// next slot to pop, written by the consumer
+	size_t mCachedTail;										// consumer's copy of mTail
+
+	alignas( kCacheLineSize ) std::atomic<size_t> mTail;	// next slot to push, written by the producer
+	size_t mCachedHead;										// producer's copy of mHead
+};
+
+template<typename T>
+size_t SpscQueue<T>::RoundUpToPowerOfTwo( size_t value )
+{
+	size_t power = 1;
+	while( power < value )
+		power <<= 1;
+	return power;
+}
+
+template<typename T>
+SpscQueue<T>::SpscQueue( size_t capacity ) :
+mSlots( RoundUpToPowerOfTwo( capacity < 2 ? 2 : capacity ) ),
+mMask( mSlots.size() - 1 ),
+mHead( 0 ),
+mCachedTail( 0 ),
+mTail( 0 ),
+mCachedHead( 0 )
+/*
+ * @param capacity
+ *		The least number of values the queue must hold. Rounded up to a power of two
+ */
+{
+}
+
+template<typename T>
+bool SpscQueue<T>::Push( const T& value )
+{
+	size_t tail = mTail.load( std::memory_order_relaxed );
+	if( tail - mCachedHead == mSlots.size() )
+	{
+		mCachedHead = mHead.load( std::memory_order_acquire );
+		if( tail - mCachedHead == mSlots.size() )
+			return false;
+	}
+	mSlots[tail & mMask] = value;
+	mTail.store( tail + 1, std::memory_order_release );
+	return true;
+}
+
+template<typename T>
+bool SpscQueue<T>::Pop( T& value )
+{
+	size_t head = mHead.load( std::memory_order_relaxed );
+	if( head == mCachedTail )
+	{
+		mCachedTail = mTail.load( std::memory_order_acquire );
+		if( head == mCachedTail )
+			return false;
+	}
+	value = mSlots[head & mMask];
+	mHead.store( head + 1, std::memory_order_release );
+	return true;
+}
+
+template<typename T>
+size_t SpscQueue<T>::Size() const
+{
+	return mTail.load( std::memory_order_acquire ) - mHead.load( std::memory_order_acquire );
+}
+
+#endif /* defined(__MidiSmoother__SpscQueue__) */
@@ -0,0 +1,197 @@
+//
+//  ThreadConfig.cpp
+//  MidiSmoother
+//
+
+#include "ThreadConfig.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+// stack touched by a thread with real time settings, so the audio path never faults it in
+static const size_t kDefaultPrefaultStackBytes = 64 * 1024;
+static const size_t kPrefaultFrameBytes = 4096;
+
+static const char* const kRoleNames[kNumThreadRoles] =
+{
+	"midi", "smoother", "audio", "reactor"
+};
+
+// written before any thread starts, then only read
+static ThreadSettings sThreadSettings[kNumThreadRoles];
+
+ThreadSettings::ThreadSettings() :
+policy( kThreadPolicyDefault ),
+priority( 0 ),
+cpu( -1 ),
+prefault_stack_bytes( 0 )
+{
+}
+
+const char* ThreadRoleName( ThreadRole role )
+{
+	return role >= 0 && role < kNumThreadRoles ? kRoleNames[role] : "unknown";
+}
+
+bool ParseThreadSettings( const std::string& text, ThreadRole& role, ThreadSettings& settings )
+{
+	size_t equals = text.find( '=' );
+	if( equals == std::string::npos )
+		return false;
+	std::string role_name = text.substr( 0, equals );
+	std::string rest = text.substr( equals + 1 );
+
+	int found = -1;
+	for( int i = 0; i < kNumThreadRoles; i++ )
+	{
+		if( role_name == kRoleNames[i] )
+			found = i;
+	}
+	if( found < 0 )
+		return false;
+	role = (ThreadRole)found;
+	settings = ThreadSettings();
+
+	size_t at = rest.find( '@' );
+	if( at != std::string::npos )
+	{
+		settings.cpu = atoi( rest.c_str() + at + 1 );
+		rest = rest.substr( 0, at );
+	}
+	size_t colon = rest.find( ':' );
+	if( colon != std::string::npos )
+	{
+		settings.priority = atoi( rest.c_str() + colon + 1 );
+		rest = rest.substr( 0, colon );
+	}
+	if( rest == "fifo" )
+		settings.policy = kThreadPolicyFifo;
+	else if( rest == "rr" )
+		settings.policy = kThreadPolicyRoundRobin;
+	else if( rest != "default" )
+		return false;
+	if( settings.policy != kThreadPolicyDefault && settings.priority <= 0 )
+		settings.priority = 1;
+	if( settings.policy != kThreadPolicyDefault || settings.cpu >= 0 )
+		settings.prefault_stack_bytes = kDefaultPrefaultStackBytes;
+	return true;
+}
+
+void SetThreadSettings( ThreadRole role, const ThreadSettings& settings )
+{
+	sThreadSettings[role] = settings;
+}
+
+const ThreadSettings& GetThreadSettings( ThreadRole role )
+{
+	return sThreadSettings[role];
+}
+
+static void Warn( ThreadRole role, const char* what )
+/*
+ * Reports a setting that couldn't be applied, once per role and setting.
+ */
+{
+	static std::mutex warned_mutex;
+	static bool warned[kNumThreadRoles][3] = {};
+	int kind = strcmp( what, "scheduling" ) == 0 ? 0 : ( strcmp( what, "affinity" ) == 0 ? 1 : 2 );
+	std::lock_guard<std::mutex> lock( warned_mutex );
+	if( warned[role][kind] )
+		return;
+	warned[role][kind] = true;
+	fprintf( stderr, "Couldn't apply %s for the %s thread, continuing without it\n", what, ThreadRoleName( role ) );
+}
+
+static void PrefaultStack( size_t bytes )
+/*
+ * Touches the given amount of stack below the caller, a page sized frame at a time.
+ */
+{
+	volatile char frame[kPrefaultFrameBytes];
+	for( size_t i = 0; i < kPrefaultFrameBytes; i += 64 )
+		frame[i] = 0;
+	if( bytes > kPrefaultFrameBytes )
+		PrefaultStack( bytes - kPrefaultFrameBytes );
+	frame[0] = frame[kPrefaultFrameBytes - 1];
+}
+
+#ifdef _WIN32
+
+static bool ApplyScheduling( const ThreadSettings& settings )
+{
+	int priority = settings.priority >= 90 ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+	return SetThreadPriority( GetCurrentThread(), priority ) != 0;
+}
+
+static bool ApplyAffinity( int cpu )
+{
+	return SetThreadAffinityMask( GetCurrentThread(), (DWORD_PTR)1 << cpu ) != 0;
+}
+
+bool LockProcessMemory()
+{
+	return false;
+}
+
+#else
+
+static bool ApplyScheduling( const ThreadSettings& settings )
+{
+	int policy = settings.policy == kThreadPolicyFifo ? SCHED_FIFO : SCHED_RR;
+	struct sched_param param;
+	memset( &param, 0, sizeof( param ) );
+	param.sched_priority = std::max( sched_get_priority_min( policy ), std::min( settings.priority, sched_get_priority_max( policy ) ) );
+	return pthread_setschedparam( pthread_self(), policy, &param ) == 0;
+}
+
+static bool ApplyAffinity( int cpu )
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO( &set );
+	CPU_SET( cpu, &set );
+	return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+#else
+	(void)cpu;
+	return false;
+#endif
+}
+
+bool LockProcessMemory()
+{
+	return mlockall( MCL_CURRENT | MCL_FUTURE ) == 0;
+}
+
+#endif
+
+bool ApplyThreadSettings( ThreadRole role )
+{
+	const ThreadSettings& settings = sThreadSettings[role];
+	bool applied = true;
+	SetTraceThreadName( ThreadRoleName( role ) );
+	if( settings.policy != kThreadPolicyDefault && !ApplyScheduling( settings ) )
+	{
+		Warn( role, "scheduling" );
+		applied = false;
+	}
+	if( settings.cpu >= 0 && !ApplyAffinity( settings.cpu ) )
+	{
+		Warn( role, "affinity" );
+		applied = false;
+	}
+	if( settings.prefault_stack_bytes > 0 )
+		PrefaultStack( settings.prefault_stack_bytes );
+	return applied;
+}
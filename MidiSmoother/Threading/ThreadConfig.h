@@ -0,0 +1,64 @@
+//
+//  ThreadConfig.h
+//  MidiSmoother
+//
+//  Real time settings for the threads of a deck. Settings are chosen per role, normally from
+//  the command line, and each thread applies the settings for its role as it starts: a real
+//  time scheduling policy and priority, pinning to a CPU, and pre-faulting its stack so the
+//  first deep call on the audio path doesn't take a page fault. Memory locking applies to the
+//  whole process.
+//
+//  Without the privileges for real time scheduling or memory locking the request is reported
+//  once and the thread carries on with normal scheduling.
+//
+
+#ifndef __MidiSmoother__ThreadConfig__
+#define __MidiSmoother__ThreadConfig__
+
+#include <cstddef>
+#include <string>
+
+enum ThreadRole
+{
+	kThreadRoleMidi,		// MidiFirer and the shared memory ingress
+	kThreadRoleSmoother,	// MidiSmoother's periodic thread
+	kThreadRoleAudio,		// VelocityConsumer
+	kThreadRoleReactor,		// the thread running a Reactor
+	kNumThreadRoles
+};
+
+enum ThreadPolicy
+{
+	kThreadPolicyDefault,	// leave the scheduling alone
+	kThreadPolicyFifo,		// SCHED_FIFO
+	kThreadPolicyRoundRobin	// SCHED_RR
+};
+
+struct ThreadSettings
+{
+	ThreadSettings();
+
+	ThreadPolicy policy;
+	int priority;				// for the real time policies, 1-99 on Linux
+	int cpu;					// the CPU to pin to, or -1 for any
+	size_t prefault_stack_bytes;
+};
+
+const char* ThreadRoleName( ThreadRole role );
+
+// Parses "<role>=<policy>[:<priority>][@<cpu>]", for example "audio=fifo:80@2". The policy is
+// one of default, fifo and rr
+bool ParseThreadSettings( const std::string& text, ThreadRole& role, ThreadSettings& settings );
+
+void SetThreadSettings( ThreadRole role, const ThreadSettings& settings );
+
+const ThreadSettings& GetThreadSettings( ThreadRole role );
+
+// Applies the settings for a role to the calling thread and names its trace ring after the
+// role. Returns false if any part of the settings could not be applied
+bool ApplyThreadSettings( ThreadRole role );
+
+// Locks the process's current and future memory into RAM. Returns false if it isn't permitted
+bool LockProcessMemory();
+
+#endif /* defined(__MidiSmoother__ThreadConfig__) */
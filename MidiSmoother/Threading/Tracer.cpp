@@ -0,0 +1,352 @@
+//
+//  Tracer.cpp
+//  MidiSmoother
+//
+
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+static const char kTraceMagic[8] = { 'M', 'S', 'T', 'R', 'A', 'C', 'E', '1' };
+// threads beyond this many record into a ring that is never dumped
+static const size_t kMaxTraceRings = 64;
+// how often the signal watcher looks for a dump request
+static const int kSignalPollMs = 50;
+
+static const char* const kEventTypeNames[kNumTraceEventTypes] =
+{
+	"midi", "model update", "model change", "stop", "read", "audio block", "saturation"
+};
+
+std::atomic<bool> gTracing( true );
+thread_local TraceRing* tTraceRing = NULL;
+thread_local uint64_t tTraceBatchTime = 0;
+
+static_assert( sizeof( TraceEvent ) == 40, "trace events are written to file as they are laid out" );
+
+// the clock pair that cycle counts are measured from, taken when the first ring is registered
+struct TraceEpoch
+{
+	uint64_t cycles;
+	std::chrono::steady_clock::time_point time;
+};
+
+static std::mutex sRingsMutex;
+static std::vector<std::unique_ptr<TraceRing> > sRings;
+static TraceEpoch sEpoch;
+
+static std::mutex sSignalMutex;
+static std::thread sSignalThread;
+static std::string sSignalFilename;
+static std::atomic<bool> sSignalWatching( false );
+static std::atomic<bool> sDumpRequested( false );
+
+TraceRing::TraceRing( uint16_t index, uint64_t capacity ) :
+mIndex( index ),
+mMask( capacity - 1 ),
+mHead( 0 ),
+mWords( capacity * kWords )
+/*
+ * @param index
+ *		The ring's position in dumps
+ * @param capacity
+ *		The number of events kept, a power of two
+ */
+{
+	snprintf( mName, sizeof( mName ), "thread %d", (int)index );
+}
+
+void TraceRing::Snapshot( std::vector<TraceEvent>& events ) const
+/*
+ * The owner may overwrite slots while they are copied. When it writes event n it overwrites
+ * event n - capacity, so anything at or before that, for the newest n it could have been
+ * writing by the end of the copy, is dropped.
+ */
+{
+	const uint64_t capacity = mMask + 1;
+	uint64_t head = mHead.load( std::memory_order_acquire );
+	uint64_t first = head > capacity ? head - capacity : 0;
+	std::vector<TraceEvent> copied( (size_t)( head - first ) );
+	for( uint64_t i = first; i < head; i++ )
+	{
+		const std::atomic<uint64_t>* slot = &mWords[( i & mMask ) * kWords];
+		TraceEvent& event = copied[(size_t)( i - first )];
+		event.time_ns = slot[0].load( std::memory_order_relaxed );
+		uint64_t header = slot[1].load( std::memory_order_relaxed );
+		event.type = (uint16_t)( header & 0xffff );
+		event.thread = (uint16_t)( header >> 16 & 0xffff );
+		event.arg = (int32_t)(uint32_t)( header >> 32 );
+		for( int v = 0; v < 3; v++ )
+		{
+			uint64_t bits = slot[2 + v].load( std::memory_order_relaxed );
+			memcpy( &event.values[v], &bits, sizeof( bits ) );
+		}
+	}
+	std::atomic_thread_fence( std::memory_order_acquire );
+	uint64_t after = mHead.load( std::memory_order_relaxed );
+	uint64_t valid = after >= capacity ? after - capacity + 1 : 0;
+	size_t skip = (size_t)( std::min( std::max( valid, first ), head ) - first );
+	events.assign( copied.begin() + skip, copied.end() );
+}
+
+void TraceRing::SetName( const char* name )
+{
+	std::lock_guard<std::mutex> lock( sRingsMutex );
+	snprintf( mName, sizeof( mName ), "%s", name );
+}
+
+std::string TraceRing::Name() const
+{
+	std::lock_guard<std::mutex> lock( sRingsMutex );
+	return mName;
+}
+
+TraceRing* AcquireTraceRing()
+/*
+ * Rings outlive their threads, so a dump still shows what a thread did before it finished.
+ */
+{
+	static TraceRing discard( 0xffff, 1 );
+	std::lock_guard<std::mutex> lock( sRingsMutex );
+	if( sRings.empty() )
+	{
+		sEpoch.cycles = TraceClock();
+		sEpoch.time = std::chrono::steady_clock::now();
+	}
+	if( sRings.size() < kMaxTraceRings )
+	{
+		sRings.push_back( std::unique_ptr<TraceRing>( new TraceRing( (uint16_t)sRings.size(), kTraceRingEvents ) ) );
+		tTraceRing = sRings.back().get();
+	}
+	else
+	{
+		tTraceRing = &discard;
+	}
+	return tTraceRing;
+}
+
+void SetTracing( bool enabled )
+{
+	gTracing.store( enabled, std::memory_order_relaxed );
+}
+
+void SetTraceThreadName( const char* name )
+{
+	TraceRing* ring = tTraceRing ? tTraceRing : AcquireTraceRing();
+	ring->SetName( name );
+}
+
+const char* TraceEventTypeName( TraceEventType type )
+{
+	return type >= 0 && type < kNumTraceEventTypes ? kEventTypeNames[type] : "unknown";
+}
+
+static bool WriteBytes( FILE* file, const void* data, size_t bytes )
+{
+	return bytes == 0 || fwrite( data, bytes, 1, file ) == 1;
+}
+
+static bool ReadBytes( FILE* file, void* data, size_t bytes )
+{
+	return bytes == 0 || fread( data, bytes, 1, file ) == 1;
+}
+
+bool DumpTrace( const std::string& filename )
+/*
+ * The file is the magic, the number of threads, then for each thread its name (length and
+ * bytes), its number of events and the events as TraceEvent, all in the machine's byte order.
+ * Times are ns since the first ring was registered.
+ */
+{
+	std::vector<TraceRing*> rings;
+	TraceEpoch epoch;
+	{
+		std::lock_guard<std::mutex> lock( sRingsMutex );
+		for( size_t i = 0; i < sRings.size(); i++ )
+			rings.push_back( sRings[i].get() );
+		epoch = sEpoch;
+	}
+
+	std::vector<TraceThread> threads( rings.size() );
+	for( size_t i = 0; i < rings.size(); i++ )
+	{
+		threads[i].name = rings[i]->Name();
+		rings[i]->Snapshot( threads[i].events );
+	}
+
+	// cycles are scaled to the steady clock over everything since the epoch
+	uint64_t now_cycles = TraceClock();
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+#ifdef TRACE_CYCLE_COUNTER
+	double elapsed_ns = std::chrono::duration<double, std::nano>( now - epoch.time ).count();
+	double ns_per_cycle = now_cycles > epoch.cycles ? elapsed_ns / (double)( now_cycles - epoch.cycles ) : 1.0;
+#else
+	double ns_per_cycle = 1.0;
+#endif
+	for( size_t i = 0; i < threads.size(); i++ )
+	{
+		for( size_t e = 0; e < threads[i].events.size(); e++ )
+		{
+			uint64_t cycles = threads[i].events[e].time_ns;
+			threads[i].events[e].time_ns = cycles > epoch.cycles ? (uint64_t)( ( cycles - epoch.cycles ) * ns_per_cycle ) : 0;
+		}
+	}
+
+	FILE* file = fopen( filename.c_str(), "wb" );
+	if( !file )
+		return false;
+	uint32_t count = (uint32_t)threads.size();
+	bool ok = WriteBytes( file, kTraceMagic, sizeof( kTraceMagic ) ) && WriteBytes( file, &count, sizeof( count ) );
+	for( size_t i = 0; ok && i < threads.size(); i++ )
+	{
+		uint32_t name_length = (uint32_t)threads[i].name.size();
+		uint32_t events = (uint32_t)threads[i].events.size();
+		ok = WriteBytes( file, &name_length, sizeof( name_length ) ) && WriteBytes( file, threads[i].name.data(), name_length ) &&
+			WriteBytes( file, &events, sizeof( events ) ) && WriteBytes( file, threads[i].events.data(), events * sizeof( TraceEvent ) );
+	}
+	return fclose( file ) == 0 && ok;
+}
+
+bool LoadTrace( const std::string& filename, std::vector<TraceThread>& threads )
+{
+	FILE* file = fopen( filename.c_str(), "rb" );
+	if( !file )
+		return false;
+	char magic[sizeof( kTraceMagic )];
+	uint32_t count = 0;
+	bool ok = ReadBytes( file, magic, sizeof( magic ) ) && memcmp( magic, kTraceMagic, sizeof( magic ) ) == 0 &&
+		ReadBytes( file, &count, sizeof( count ) ) && count <= kMaxTraceRings;
+	threads.assign( ok ? count : 0, TraceThread() );
+	for( size_t i = 0; ok && i < threads.size(); i++ )
+	{
+		uint32_t name_length = 0, events = 0;
+		ok = ReadBytes( file, &name_length, sizeof( name_length ) ) && name_length < 256;
+		if( ok )
+		{
+			threads[i].name.resize( name_length );
+			ok = ReadBytes( file, &threads[i].name[0], name_length ) && ReadBytes( file, &events, sizeof( events ) ) && events <= kTraceRingEvents;
+		}
+		if( ok )
+		{
+			threads[i].events.resize( events );
+			ok = ReadBytes( file, threads[i].events.data(), events * sizeof( TraceEvent ) );
+		}
+	}
+	fclose( file );
+	return ok;
+}
+
+#ifndef _WIN32
+
+static void HandleDumpSignal( int )
+{
+	sDumpRequested.store( true );
+}
+
+static void SignalWatcherFunction()
+/*
+ * Signal handlers can't do file io, so the handler only flags the request and this thread
+ * does the dump.
+ */
+{
+	while( sSignalWatching.load() )
+	{
+		if( sDumpRequested.exchange( false ) )
+		{
+			std::string filename;
+			{
+				std::lock_guard<std::mutex> lock( sSignalMutex );
+				filename = sSignalFilename;
+			}
+			if( DumpTrace( filename ) )
+				fprintf( stderr, "Trace dumped to %s\n", filename.c_str() );
+			else
+				fprintf( stderr, "Couldn't dump the trace to %s\n", filename.c_str() );
+		}
+		std::this_thread::sleep_for( std::chrono::milliseconds( kSignalPollMs ) );
+	}
+}
+
+static void StopSignalWatcher()
+/*
+ * Registered with atexit so that an exit while watching joins the watcher before its thread
+ * object is destroyed, which would otherwise terminate the process.
+ */
+{
+	DumpTraceOnSignal( "" );
+}
+
+#endif
+
+void DumpTraceOnSignal( const std::string& filename )
+{
+#ifndef _WIN32
+	std::thread watcher;
+	{
+		std::lock_guard<std::mutex> lock( sSignalMutex );
+		sSignalFilename = filename;
+		if( !filename.empty() && !sSignalWatching.load() )
+		{
+			static bool registered = false;
+			if( !registered )
+				registered = atexit( StopSignalWatcher ) == 0;
+			sSignalWatching.store( true );
+			sSignalThread = std::thread( SignalWatcherFunction );
+			signal( SIGUSR1, HandleDumpSignal );
+		}
+		else if( filename.empty() && sSignalWatching.load() )
+		{
+			signal( SIGUSR1, SIG_DFL );
+			sSignalWatching.store( false );
+			watcher.swap( sSignalThread );
+		}
+	}
+	// joined outside the lock, which the watcher takes to read the filename
+	if( watcher.joinable() )
+		watcher.join();
+#else
+	(void)filename;
+#endif
+}
+
+double MeasureTraceCost( double& clock_ns, double& batched_ns )
+/*
+ * Records a ring's worth of events a few times over, so the cost includes wrapping. Batches are
+ * of kBatchEvents, an audio block's reads and the block itself.
+ */
+{
+	const int kEvents = (int)kTraceRingEvents * 8;
+	const int kBatchEvents = 8;
+	Trace( kTraceRead, 0 );
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for( int i = 0; i < kEvents; i++ )
+		Trace( kTraceRead, i, i * 0.5, 1.0, 0.0 );
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+	std::chrono::steady_clock::time_point batched_start = std::chrono::steady_clock::now();
+	for( int i = 0; i < kEvents; i += kBatchEvents )
+	{
+		TraceBatch batch;
+		for( int j = i; j < i + kBatchEvents; j++ )
+			Trace( kTraceRead, j, j * 0.5, 1.0, 0.0 );
+	}
+	std::chrono::steady_clock::time_point batched_end = std::chrono::steady_clock::now();
+	batched_ns = std::chrono::duration<double, std::nano>( batched_end - batched_start ).count() / kEvents;
+
+	volatile uint64_t sink = 0;
+	std::chrono::steady_clock::time_point clock_start = std::chrono::steady_clock::now();
+	for( int i = 0; i < kEvents; i++ )
+		sink = sink + TraceClock();
+	std::chrono::steady_clock::time_point clock_end = std::chrono::steady_clock::now();
+	clock_ns = std::chrono::duration<double, std::nano>( clock_end - clock_start ).count() / kEvents;
+	return std::chrono::duration<double, std::nano>( end - start ).count() / kEvents;
+}
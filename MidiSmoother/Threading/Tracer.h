@@ -0,0 +1,195 @@
+//
+//  Tracer.h
+//  MidiSmoother
+//
+//  An always on flight recorder for reconstructing what the deck was doing when something
+//  went wrong. Each thread records fixed size events into its own ring, overwriting the
+//  oldest, so recording never locks or allocates and threads never share a cache line. The
+//  rings can be dumped at any time to a compact binary file, which --trace-export (see
+//  TraceExport.h) turns into Chrome trace JSON for viewing as a timeline.
+//
+//  A slot is held as relaxed atomic words, like SeqLock, so a dump racing the owner never
+//  reads torn memory; it copies a ring and then drops whatever the owner may have overwritten
+//  while it did. Timestamps are the CPU's cycle counter where there is one, converted to
+//  nanoseconds on the steady clock when the rings are dumped, and read once for a whole
+//  TraceBatch of events on the hot paths.
+//
+
+#ifndef __MidiSmoother__Tracer__
+#define __MidiSmoother__Tracer__
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+#include <intrin.h>
+#define TRACE_CYCLE_COUNTER 1
+#elif defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#define TRACE_CYCLE_COUNTER 1
+#endif
+
+enum TraceEventType
+{
+	kTraceMidi,			// a midi message reached the smoother. arg: ticks, values: time ms
+	kTraceModelUpdate,	// the model took a delta. arg: mode, values: c0, c1, c2 of the new curve
+	kTraceModelChange,	// the QoS ladder changed model. arg: mode, values: time ms, update cost us
+	kTraceStop,			// the platter stopped and the model was reset. values: time ms
+	kTraceRead,			// a reader asked for velocity. arg: retries, values: time ms, velocity
+	kTraceAudioBlock,	// VelocityConsumer started an audio block. arg: steps, values: step ms
+	kTraceSaturation,	// a run of saturated messages began (arg 1, values: time ms, velocity and interval ms of
+						// the message before) or ended (arg 0, values: time ms, duration ms, peak inferred velocity)
+	kNumTraceEventTypes
+};
+
+// An event as dumped. The thread is the index of its ring in the dump
+struct TraceEvent
+{
+	uint64_t time_ns;
+	uint16_t type;
+	uint16_t thread;
+	int32_t arg;
+	double values[3];
+};
+
+struct TraceThread
+{
+	std::string name;
+	std::vector<TraceEvent> events;
+};
+
+// events each thread keeps, enough for several seconds of a busy deck
+static const uint64_t kTraceRingEvents = 1 << 15;
+
+class TraceRing
+{
+public:
+	explicit TraceRing( uint16_t index, uint64_t capacity );
+
+	void Record( uint64_t time, TraceEventType type, int32_t arg, double a, double b, double c )
+	/*
+	 * Only the ring's owning thread may record.
+	 */
+	{
+		uint64_t head = mHead.load( std::memory_order_relaxed );
+		std::atomic<uint64_t>* slot = &mWords[( head & mMask ) * kWords];
+		slot[0].store( time, std::memory_order_relaxed );
+		slot[1].store( (uint64_t)type | (uint64_t)mIndex << 16 | (uint64_t)(uint32_t)arg << 32, std::memory_order_relaxed );
+		slot[2].store( Bits( a ), std::memory_order_relaxed );
+		slot[3].store( Bits( b ), std::memory_order_relaxed );
+		slot[4].store( Bits( c ), std::memory_order_relaxed );
+		mHead.store( head + 1, std::memory_order_release );
+	}
+
+	// Copies out the events still in the ring, oldest first, with their raw timestamps
+	void Snapshot( std::vector<TraceEvent>& events ) const;
+
+	void SetName( const char* name );
+	std::string Name() const;
+private:
+	TraceRing( const TraceRing& );
+	TraceRing& operator=( const TraceRing& );
+
+	static const size_t kWords = 5;
+
+	static uint64_t Bits( double value )
+	{
+		uint64_t bits;
+		memcpy( &bits, &value, sizeof( bits ) );
+		return bits;
+	}
+
+	const uint16_t mIndex;
+	const uint64_t mMask;
+	std::atomic<uint64_t> mHead;
+	std::vector<std::atomic<uint64_t> > mWords;
+	char mName[32];
+};
+
+extern std::atomic<bool> gTracing;
+extern thread_local TraceRing* tTraceRing;
+
+// The ring for the calling thread, registering one the first time
+TraceRing* AcquireTraceRing();
+
+inline uint64_t TraceClock()
+{
+#ifdef TRACE_CYCLE_COUNTER
+	return __rdtsc();
+#else
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+#endif
+}
+
+// the timestamp of the calling thread's outermost TraceBatch, 0 outside one
+extern thread_local uint64_t tTraceBatchTime;
+
+inline void Trace( TraceEventType type, int32_t arg, double a = 0, double b = 0, double c = 0 )
+/*
+ * Records an event on the calling thread's ring, if tracing is on.
+ */
+{
+	if( !gTracing.load( std::memory_order_relaxed ) )
+		return;
+	TraceRing* ring = tTraceRing;
+	if( !ring )
+		ring = AcquireTraceRing();
+	uint64_t time = tTraceBatchTime;
+	ring->Record( time ? time : TraceClock(), type, arg, a, b, c );
+}
+
+class TraceBatch
+/*
+ * Events traced on a thread while one is in scope share the timestamp taken when it was made, so
+ * a burst of events (a midi message and the model update it causes, an audio block and its reads)
+ * reads the clock once. Where the cycle counter traps to a hypervisor the read is most of the cost
+ * of an event. Batches may nest, the outermost one's time being kept.
+ */
+{
+public:
+	TraceBatch() :
+	mbOuter( tTraceBatchTime == 0 && gTracing.load( std::memory_order_relaxed ) )
+	{
+		if( mbOuter )
+			tTraceBatchTime = TraceClock();
+	}
+
+	~TraceBatch()
+	{
+		if( mbOuter )
+			tTraceBatchTime = 0;
+	}
+private:
+	TraceBatch( const TraceBatch& );
+	TraceBatch& operator=( const TraceBatch& );
+
+	const bool mbOuter;
+};
+
+// Tracing is on from the start; this turns it off or back on for every thread
+void SetTracing( bool enabled );
+
+// Names the calling thread's ring in dumps
+void SetTraceThreadName( const char* name );
+
+const char* TraceEventTypeName( TraceEventType type );
+
+// Writes every ring to a binary trace file. Safe to call from any thread at any time
+bool DumpTrace( const std::string& filename );
+
+bool LoadTrace( const std::string& filename, std::vector<TraceThread>& threads );
+
+// Dumps the trace to the given file whenever the process gets SIGUSR1, where there is one.
+// An empty filename stops it
+void DumpTraceOnSignal( const std::string& filename );
+
+// The mean cost in ns of recording one event on the calling thread, of taking its timestamp
+// alone, which dominates where reading the cycle counter traps to a hypervisor, and of an event
+// recorded in a TraceBatch of an audio block's worth of events
+double MeasureTraceCost( double& clock_ns, double& batched_ns );
+
+#endif /* defined(__MidiSmoother__Tracer__) */
@@ -0,0 +1,130 @@
+//
+//  WorkStealingPool.cpp
+//  MidiSmoother
+//
+
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+
+// the pool and queue the calling thread works for, so jobs submitted from a job stay local
+static thread_local const WorkStealingPool* sCurrentPool = NULL;
+static thread_local int sCurrentQueue = -1;
+
+WorkStealingPool::WorkStealingPool( int threads ) :
+mQueues(),
+mThreads(),
+mNextQueue( 0 ),
+mQueued( 0 ),
+mSteals( 0 ),
+mMutex(),
+mWorkAvailable(),
+mAllDone(),
+mUnfinished( 0 ),
+mbStopping( false )
+/*
+ * @param threads
+ *		The number of workers, or 0 for one per hardware thread
+ */
+{
+	if( threads <= 0 )
+		threads = std::max( 1, (int)std::thread::hardware_concurrency() );
+	mQueues.resize( threads );
+	for( int i = 0; i < threads; i++ )
+		mThreads.push_back( std::thread( &WorkStealingPool::WorkerThreadFunction, this, i ) );
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	Wait();
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mbStopping = true;
+		mWorkAvailable.notify_all();
+	}
+	for( size_t i = 0; i < mThreads.size(); i++ )
+		mThreads[i].join();
+}
+
+void WorkStealingPool::Submit( const Job& job )
+{
+	int index = sCurrentPool == this ? sCurrentQueue : (int)( mNextQueue++ % mQueues.size() );
+	// counted before it can be taken, so a worker finishing it first never takes the counts below
+	// what is really outstanding, and Wait can't see none left while a job's children are coming
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mUnfinished++;
+		mQueued++;
+	}
+	{
+		std::lock_guard<std::mutex> lock( mQueues[index].mutex );
+		mQueues[index].jobs.push_back( job );
+	}
+	mWorkAvailable.notify_one();
+}
+
+void WorkStealingPool::Wait()
+{
+	std::unique_lock<std::mutex> lock( mMutex );
+	while( mUnfinished > 0 )
+		mAllDone.wait( lock );
+}
+
+bool WorkStealingPool::TakeJob( int index, Job& job )
+/*
+ * Takes the newest job from the worker's own queue, or failing that the oldest job from the
+ * first other queue that has one.
+ */
+{
+	{
+		Queue& own = mQueues[index];
+		std::lock_guard<std::mutex> lock( own.mutex );
+		if( !own.jobs.empty() )
+		{
+			job.swap( own.jobs.back() );
+			own.jobs.pop_back();
+			mQueued--;
+			return true;
+		}
+	}
+	for( size_t i = 1; i < mQueues.size(); i++ )
+	{
+		Queue& victim = mQueues[( index + i ) % mQueues.size()];
+		std::lock_guard<std::mutex> lock( victim.mutex );
+		if( !victim.jobs.empty() )
+		{
+			job.swap( victim.jobs.front() );
+			victim.jobs.pop_front();
+			mQueued--;
+			mSteals++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkStealingPool::WorkerThreadFunction( int index )
+{
+	sCurrentPool = this;
+	sCurrentQueue = index;
+	Job job;
+	while( true )
+	{
+		if( TakeJob( index, job ) )
+		{
+			job();
+			job = Job();
+			std::lock_guard<std::mutex> lock( mMutex );
+			if( --mUnfinished == 0 )
+				mAllDone.notify_all();
+			continue;
+		}
+
+		// nothing to take anywhere, so sleep until a job is submitted
+		std::unique_lock<std::mutex> lock( mMutex );
+		while( mQueued == 0 && !mbStopping )
+			mWorkAvailable.wait( lock );
+		if( mbStopping && mQueued == 0 )
+			return;
+	}
+}
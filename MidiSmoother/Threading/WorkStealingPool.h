@@ -0,0 +1,71 @@
+//
+//  WorkStealingPool.h
+//  MidiSmoother
+//
+//  A fixed set of worker threads for offline work such as tuning and batch rendering. Each
+//  worker has its own queue: it takes its newest job first, and once its queue is empty it
+//  steals the oldest job from another worker's, so uneven jobs still keep every core busy.
+//  Jobs submitted from inside a job go on the submitting worker's own queue.
+//
+
+#ifndef __MidiSmoother__WorkStealingPool__
+#define __MidiSmoother__WorkStealingPool__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+class WorkStealingPool
+{
+public:
+	typedef std::function<void()> Job;
+
+	// 0 threads uses one per hardware thread
+	explicit WorkStealingPool( int threads );
+
+	// Waits for the submitted jobs to finish
+	~WorkStealingPool();
+
+	int Threads() const { return (int)mThreads.size(); }
+
+	// Safe to call from any thread, including from a job
+	void Submit( const Job& job );
+
+	// Blocks until every job submitted so far, and every job they submit, has finished. Don't call from a job
+	void Wait();
+
+	// The number of jobs run by a worker other than the one they were queued on
+	uint64_t Steals() const { return mSteals; }
+private:
+	WorkStealingPool( const WorkStealingPool& );
+	WorkStealingPool& operator=( const WorkStealingPool& );
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void WorkerThreadFunction( int index );
+
+	bool TakeJob( int index, Job& job );
+
+	std::deque<Queue> mQueues;		// one per worker. A deque, as queues can't be moved
+	std::vector<std::thread> mThreads;
+	std::atomic<unsigned> mNextQueue;	// where jobs from outside the pool go, round robin
+	std::atomic<size_t> mQueued;	// jobs waiting in any queue
+	std::atomic<uint64_t> mSteals;
+
+	std::mutex mMutex;
+	std::condition_variable mWorkAvailable;
+	std::condition_variable mAllDone;
+	size_t mUnfinished;			// jobs submitted and not yet finished
+	bool mbStopping;
+};
+
+#endif /* defined(__MidiSmoother__WorkStealingPool__) */
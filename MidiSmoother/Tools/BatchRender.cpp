@@ -0,0 +1,367 @@
+//
+//  BatchRender.cpp
+//  MidiSmoother
+//
+//  Output for each capture goes to <out>/<name>.wav and <out>/<name>.csv, and the metrics of
+//  every capture to <out>/summary.csv. A manifest lists one capture per line, optionally
+//  followed by the name of the device it was recorded from. Relative paths are relative to the
+//  manifest, and lines starting with # are ignored.
+//
+
+#include "BatchRender.h"
+#include "Benchmark.h"
+#include "Capture.h"
+#include "MidiSmoother.h"
+#include "Reference.h"
+#include "Output/SineWaveRecorder.h"
+#include "Threading/WorkStealingPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// One capture to render, and what came of it
+struct BatchJob
+{
+	std::string input;
+	std::string name;		// unique within the batch, used for the output files
+	const DeviceProfile* device;
+
+	bool succeeded;
+	size_t messages;
+	double duration_ms;
+	double render_ms;		// wall clock time taken to render
+	ReplayQuality quality;
+};
+
+// The settings every job is rendered with
+struct BatchSettings
+{
+	std::string output_directory;
+	const char* mode_name;	// NULL for each device's default
+	double latency_budget;
+};
+
+static void PrintBatchUsage()
+{
+	std::printf( "Usage: MidiSmoother --batch [--threads <n>] [--out <dir>] [--device <name>] [--mode <name>] [--latency <ms>] <directory | manifest>...\n" );
+	std::printf( "  --threads  captures rendered at once (default one per core)\n" );
+	std::printf( "  --out      where the wav, trace and summary files go (default batch)\n" );
+	std::printf( "  --device   the device captures were recorded from, unless their manifest says (default %s)\n", DefaultDeviceProfile().name );
+	std::printf( "A directory renders every .csv file in it. A manifest lists one capture per line, optionally followed by its device\n" );
+}
+
+static bool IsDirectory( const std::string& path )
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA( path.c_str() );
+	return attributes != INVALID_FILE_ATTRIBUTES && ( attributes & FILE_ATTRIBUTE_DIRECTORY );
+#else
+	struct stat info;
+	return stat( path.c_str(), &info ) == 0 && S_ISDIR( info.st_mode );
+#endif
+}
+
+static bool MakeDirectory( const std::string& path )
+/*
+ * Creates a directory unless it already exists.
+ */
+{
+	if( IsDirectory( path ) )
+		return true;
+#ifdef _WIN32
+	return _mkdir( path.c_str() ) == 0;
+#else
+	return mkdir( path.c_str(), 0755 ) == 0;
+#endif
+}
+
+static bool ListCaptures( const std::string& directory, std::vector<std::string>& files )
+/*
+ * Every .csv file in a directory, in name order.
+ */
+{
+	std::vector<std::string> names;
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA( ( directory + "\\*.csv" ).c_str(), &found );
+	if( find == INVALID_HANDLE_VALUE )
+		return false;
+	do
+		names.push_back( found.cFileName );
+	while( FindNextFileA( find, &found ) );
+	FindClose( find );
+#else
+	DIR* dir = opendir( directory.c_str() );
+	if( !dir )
+		return false;
+	while( struct dirent* entry = readdir( dir ) )
+	{
+		std::string name = entry->d_name;
+		if( name.size() > 4 && name.compare( name.size() - 4, 4, ".csv" ) == 0 )
+			names.push_back( name );
+	}
+	closedir( dir );
+#endif
+	std::sort( names.begin(), names.end() );
+	for( size_t i = 0; i < names.size(); i++ )
+		files.push_back( directory + "/" + names[i] );
+	return true;
+}
+
+static bool ReadManifest( const std::string& manifest, const DeviceProfile* device, std::vector<BatchJob>& jobs )
+/*
+ * Adds a job for each capture a manifest lists.
+ */
+{
+	std::ifstream stream( manifest.c_str() );
+	if( !stream )
+		return false;
+	size_t slash = manifest.find_last_of( "/\\" );
+	std::string base = slash == std::string::npos ? "" : manifest.substr( 0, slash + 1 );
+	std::string line;
+	while( std::getline( stream, line ) )
+	{
+		std::istringstream fields( line );
+		std::string path, device_name;
+		if( !( fields >> path ) || path[0] == '#' )
+			continue;
+		BatchJob job = BatchJob();
+		job.input = path[0] == '/' || path[0] == '\\' || ( path.size() > 1 && path[1] == ':' ) ? path : base + path;
+		job.device = device;
+		if( fields >> device_name )
+		{
+			job.device = FindDeviceProfile( device_name );
+			if( !job.device )
+			{
+				std::printf( "Unknown device %s for %s\n", device_name.c_str(), path.c_str() );
+				return false;
+			}
+		}
+		jobs.push_back( job );
+	}
+	return true;
+}
+
+static void NameJobs( std::vector<BatchJob>& jobs )
+/*
+ * Names each job's output after its capture, numbering captures that share a name.
+ */
+{
+	std::set<std::string> used;
+	for( size_t i = 0; i < jobs.size(); i++ )
+	{
+		std::string name = jobs[i].input.substr( jobs[i].input.find_last_of( "/\\" ) + 1 );
+		if( name.size() > 4 && name.compare( name.size() - 4, 4, ".csv" ) == 0 )
+			name.resize( name.size() - 4 );
+		std::string unique = name;
+		for( int n = 2; used.count( unique ); n++ )
+		{
+			std::ostringstream numbered;
+			numbered << name << "_" << n;
+			unique = numbered.str();
+		}
+		used.insert( unique );
+		jobs[i].name = unique;
+	}
+}
+
+static void RenderJob( BatchJob& job, const BatchSettings& settings )
+/*
+ * Plays a capture through a smoother on a virtual clock, each message delivered with its
+ * capture timestamp and the output read on the audio step grid, as VelocityConsumer would.
+ */
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<CaptureEvent> events;
+	job.succeeded = LoadCapture( job.input, events );
+	if( !job.succeeded )
+		return;
+	job.messages = events.size();
+	job.duration_ms = events.empty() ? 0 : events.back().time_ms;
+
+	MidiSmoother smoother( *job.device );
+	MidiSmoother::SmoothingMode mode;
+	if( settings.mode_name && MidiSmoother::SmoothingModeFromName( settings.mode_name, mode ) )
+		smoother.SetSmoothingMode( mode );
+	smoother.SetLatencyBudget( settings.latency_budget );
+
+	std::vector<double> output;
+	{
+		std::string path = settings.output_directory + "/" + job.name;
+		SineWaveRecorder recorder( path + ".wav", path + ".csv", false );
+		size_t next = 0;
+		for( double now = 0; now < job.duration_ms; now += kReplayStepMs )
+		{
+			while( next < events.size() && events[next].time_ms <= now )
+			{
+				smoother.NotifyMidiValue( events[next].midi_value, events[next].time_ms );
+				next++;
+			}
+			double velocity = smoother.VelocityAt( now );
+			recorder.RecordVelocity( velocity, kReplayStepMs );
+			output.push_back( velocity );
+		}
+	}
+	std::vector<double> reference;
+	ReferenceVelocity( *job.device, events, kReplayStepMs, reference );
+	job.quality = ScoreReplay( output, reference );
+	job.render_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+static bool WriteSummary( const std::vector<BatchJob>& jobs, const BatchSettings& settings )
+/*
+ * One line per capture, then the whole corpus with the metrics weighted by duration.
+ */
+{
+	std::string path = settings.output_directory + "/summary.csv";
+	FILE* file = fopen( path.c_str(), "wb" );
+	if( !file )
+		return false;
+	fprintf( file, "capture,device,messages,duration_ms,step,rmse,lag_ms,render_ms,status\n" );
+	double duration = 0, step = 0, rmse = 0, lag = 0;
+	size_t messages = 0;
+	int failed = 0;
+	for( size_t i = 0; i < jobs.size(); i++ )
+	{
+		const BatchJob& job = jobs[i];
+		if( !job.succeeded )
+		{
+			fprintf( file, "%s,%s,,,,,,,failed\n", job.input.c_str(), job.device->name );
+			failed++;
+			continue;
+		}
+		fprintf( file, "%s,%s,%llu,%.1f,%.4f,%.4f,%.2f,%.1f,ok\n", job.input.c_str(), job.device->name, (unsigned long long)job.messages,
+				job.duration_ms, job.quality.mean_step, job.quality.rmse, job.quality.lag_ms, job.render_ms );
+		messages += job.messages;
+		duration += job.duration_ms;
+		step += job.quality.mean_step * job.duration_ms;
+		rmse += job.quality.rmse * job.duration_ms;
+		lag += job.quality.lag_ms * job.duration_ms;
+	}
+	if( duration > 0 )
+		fprintf( file, "all,,%llu,%.1f,%.4f,%.4f,%.2f,,%d failed\n", (unsigned long long)messages, duration, step / duration, rmse / duration, lag / duration, failed );
+	fclose( file );
+
+	std::printf( "%-32s %10s %10s %10s %10s %10s\n", "capture", "seconds", "step", "rmse", "lag ms", "render ms" );
+	for( size_t i = 0; i < jobs.size(); i++ )
+	{
+		const BatchJob& job = jobs[i];
+		if( job.succeeded )
+			std::printf( "%-32s %10.1f %10.4f %10.4f %10.2f %10.1f\n", job.name.c_str(), job.duration_ms / 1000, job.quality.mean_step, job.quality.rmse,
+						job.quality.lag_ms, job.render_ms );
+		else
+			std::printf( "%-32s failed to read %s\n", job.name.c_str(), job.input.c_str() );
+	}
+	if( duration > 0 )
+		std::printf( "%-32s %10.1f %10.4f %10.4f %10.2f\n", "all", duration / 1000, step / duration, rmse / duration, lag / duration );
+	return failed == 0;
+}
+
+int RunBatch( int argc, const char* argv[] )
+{
+	int threads = 0;
+	BatchSettings settings;
+	settings.output_directory = "batch";
+	settings.mode_name = NULL;
+	settings.latency_budget = -1;
+	const DeviceProfile* device = &DefaultDeviceProfile();
+	std::vector<std::string> inputs;
+	for( int i = 0; i < argc; i++ )
+	{
+		std::string arg = argv[i];
+		MidiSmoother::SmoothingMode mode;
+		if( arg == "--threads" && i + 1 < argc )
+			threads = std::max( 0, atoi( argv[++i] ) );
+		else if( arg == "--out" && i + 1 < argc )
+			settings.output_directory = argv[++i];
+		else if( arg == "--device" && i + 1 < argc && ( device = FindDeviceProfile( argv[i + 1] ) ) != NULL )
+			i++;
+		else if( arg == "--mode" && i + 1 < argc && MidiSmoother::SmoothingModeFromName( argv[i + 1], mode ) )
+			settings.mode_name = argv[++i];
+		else if( arg == "--latency" && i + 1 < argc )
+			settings.latency_budget = atof( argv[++i] );
+		else if( arg[0] != '-' )
+			inputs.push_back( arg );
+		else
+		{
+			PrintBatchUsage();
+			return -1;
+		}
+	}
+	if( inputs.empty() )
+	{
+		PrintBatchUsage();
+		return -1;
+	}
+
+	std::vector<BatchJob> jobs;
+	for( size_t i = 0; i < inputs.size(); i++ )
+	{
+		if( IsDirectory( inputs[i] ) )
+		{
+			std::vector<std::string> files;
+			if( !ListCaptures( inputs[i], files ) )
+			{
+				std::printf( "Failed to list %s\n", inputs[i].c_str() );
+				return -1;
+			}
+			for( size_t f = 0; f < files.size(); f++ )
+			{
+				BatchJob job = BatchJob();
+				job.input = files[f];
+				job.device = device;
+				jobs.push_back( job );
+			}
+		}
+		else if( !ReadManifest( inputs[i], device, jobs ) )
+		{
+			std::printf( "Failed to read manifest %s\n", inputs[i].c_str() );
+			return -1;
+		}
+	}
+	if( !MakeDirectory( settings.output_directory ) )
+	{
+		std::printf( "Failed to create %s\n", settings.output_directory.c_str() );
+		return -1;
+	}
+	NameJobs( jobs );
+
+	// each job writes only its own files and its own slot
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int workers;
+	{
+		WorkStealingPool pool( threads );
+		workers = pool.Threads();
+		for( size_t i = 0; i < jobs.size(); i++ )
+		{
+			BatchJob* job = &jobs[i];
+			const BatchSettings* shared = &settings;
+			pool.Submit( [job, shared]() { RenderJob( *job, *shared ); } );
+		}
+		pool.Wait();
+	}
+	double elapsed_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+
+	bool all_succeeded = WriteSummary( jobs, settings );
+	double captured_ms = 0;
+	for( size_t i = 0; i < jobs.size(); i++ )
+		captured_ms += jobs[i].succeeded ? jobs[i].duration_ms : 0;
+	std::printf( "Rendered %d captures (%.1fs) on %d threads in %.2fs, %.0fx real time. Summary in %s/summary.csv\n", (int)jobs.size(), captured_ms / 1000,
+				workers, elapsed_ms / 1000, elapsed_ms > 0 ? captured_ms / elapsed_ms : 0, settings.output_directory.c_str() );
+	return all_succeeded ? 0 : -1;
+}
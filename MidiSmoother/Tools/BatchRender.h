@@ -0,0 +1,16 @@
+//
+//  BatchRender.h
+//  MidiSmoother
+//
+//  Offline rendering of a whole corpus of captures. Each capture is played through its own
+//  MidiSmoother on a virtual clock, as fast as the cores allow, and rendered to a wav and a
+//  velocity trace of its own, with its metrics collected into one summary for the corpus.
+//
+
+#ifndef __MidiSmoother__BatchRender__
+#define __MidiSmoother__BatchRender__
+
+// Entry point for "MidiSmoother --batch ...". argv holds the arguments after --batch
+int RunBatch( int argc, const char* argv[] );
+
+#endif /* defined(__MidiSmoother__BatchRender__) */
@@ -0,0 +1,382 @@
+//
+//  Benchmark.cpp
+//  MidiSmoother
+//
+//  Replays each capture through every model on a virtual clock, sampling the output on
+//  the same 32 sample grid VelocityConsumer uses, and reports:
+//    ns/update  - mean and worst cost of AddDelta
+//    step       - mean |change in velocity| between consecutive audio steps (smoothness)
+//    rmse       - error against the zero phase reference velocity (see Reference.h)
+//    lag        - the delay of the output that best matches the reference
+//  then how each model settles after every start from rest, with and without the warm-up
+//  (see WarmupModel.h), and what recording a trace event costs, which every update and read pays.
+//
+
+#include "Benchmark.h"
+#include "Capture.h"
+#include "MidiSmoother.h"
+#include "Models/WarmupModel.h"
+#include "Reference.h"
+#include "Threading/Tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+const double kReplayStepMs = 32 / 44.1;
+static const double kStepMs = kReplayStepMs;
+// ms left unscored at each end of a capture, where the reference has only one side to go on
+static const double kScoreMarginMs = 15.0;
+// how far behind the next message a bunched message arrives (ms)
+static const double kBunchGapMs = 0.05;
+// the range of delays searched for the lag, in audio steps
+static const int kMinLagSteps = -30;
+static const int kMaxLagSteps = 90;
+// how long after a start from rest the output is scored for settling (ms)
+static const double kOnsetWindowMs = 60.0;
+// the output has settled once it stays within this fraction of the reference, plus kSettledFloor
+static const double kSettledFraction = 0.1;
+static const double kSettledFloor = 0.05;
+
+struct BenchmarkResult
+{
+	double mean_ns;
+	double max_ns;
+	double mean_step;
+	double rmse;
+	double lag_ms;
+};
+
+// a capture kept for scoring the starts from rest once every capture has been benchmarked
+struct OnsetCapture
+{
+	std::string name;
+	std::vector<CaptureEvent> arrivals;
+	std::vector<double> reference;
+};
+
+static void PrintBenchmarkUsage()
+{
+	std::printf( "Usage: MidiSmoother --bench [--device <name>] [--bunch <fraction>] [--repeat <n>] <midi_file>...\n" );
+	std::printf( "  --device  the device the captures were recorded from (default %s)\n", DefaultDeviceProfile().name );
+	std::printf( "  --bunch   fraction of messages delayed until just before the next one, as USB bunching does\n" );
+	std::printf( "  --repeat  passes used to time the updates (default 200)\n" );
+}
+
+ReplayQuality ReplayModel( SmoothingModel& model, const DeviceProfile& device, const std::vector<CaptureEvent>& arrivals, const std::vector<double>& reference )
+/*
+ * @param model
+ *		The model to replay through. It is reset first
+ * @param device
+ *		The device the capture was recorded from
+ * @param arrivals
+ *		The capture as the model sees it (possibly with bunching applied)
+ * @param reference
+ *		The reference velocity of the capture as recorded, which sets the length of the replay
+ */
+{
+	const double ms_per_value = device.MsPerTick();
+	model.Reset();
+	size_t next = 0;
+	std::vector<double> output( reference.size() );
+	for( size_t k = 0; k < output.size(); k++ )
+	{
+		double now = k * kStepMs;
+		while( next < arrivals.size() && arrivals[next].time_ms <= now )
+		{
+			model.AddDelta( arrivals[next].time_ms, arrivals[next].midi_value * ms_per_value );
+			next++;
+		}
+		output[k] = model.Curve().Velocity( now );
+	}
+	return ScoreReplay( output, reference );
+}
+
+OnsetQuality ReplayOnsets( SmoothingModel& model, const DeviceProfile& device, const std::vector<CaptureEvent>& arrivals, const std::vector<double>& reference )
+/*
+ * Each motion is scored from its first message for kOnsetWindowMs, or until the next motion if
+ * that starts sooner. The output has settled from the first step after which it stays near the
+ * reference to the end of the window; if it never does, settling takes the whole window.
+ *
+ * @param model
+ *		The model to replay through. It is reset at every start from rest
+ * @param device
+ *		The device the capture was recorded from, whose stop timeout separates the motions
+ * @param arrivals
+ *		The capture as the model sees it (possibly with bunching applied)
+ * @param reference
+ *		The reference velocity of the capture as recorded
+ */
+{
+	OnsetQuality quality;
+	quality.onsets = 0;
+	quality.settle_ms = quality.worst_error = quality.rmse = 0;
+	const double ms_per_value = device.MsPerTick();
+	// the smoother's stop timeout stretches to twice the latest interval, so a slow crawl isn't a stop
+	std::vector<size_t> onsets;
+	double last_interval = 0;
+	for( size_t i = 0; i < arrivals.size(); i++ )
+	{
+		double interval = i > 0 ? arrivals[i].time_ms - arrivals[i - 1].time_ms : 0;
+		if( i == 0 || interval > std::max( device.stop_timeout_ms, 2 * last_interval ) )
+		{
+			onsets.push_back( i );
+			interval = 0;
+		}
+		last_interval = interval;
+	}
+
+	double total_error = 0;
+	int scored_steps = 0;
+	for( size_t o = 0; o < onsets.size(); o++ )
+	{
+		const double start_ms = arrivals[onsets[o]].time_ms;
+		double end_ms = start_ms + kOnsetWindowMs;
+		if( o + 1 < onsets.size() )
+			end_ms = std::min( end_ms, arrivals[onsets[o + 1]].time_ms );
+		const size_t last_message = o + 1 < onsets.size() ? onsets[o + 1] : arrivals.size();
+
+		model.Reset();
+		size_t next = onsets[o];
+		double settled_ms = start_ms, worst_error = 0, stop_ms = start_ms + device.stop_timeout_ms;
+		int steps = 0;
+		for( long k = (long)ceil( start_ms / kStepMs ); k < (long)reference.size() && k * kStepMs < end_ms; k++ )
+		{
+			double now = k * kStepMs;
+			while( next < last_message && arrivals[next].time_ms <= now )
+			{
+				model.AddDelta( arrivals[next].time_ms, arrivals[next].midi_value * ms_per_value );
+				if( next > onsets[o] )
+					stop_ms = arrivals[next].time_ms + std::max( device.stop_timeout_ms, 2 * ( arrivals[next].time_ms - arrivals[next - 1].time_ms ) );
+				next++;
+			}
+			// a motion that goes quiet stops, as the smoother's readers ramp it to
+			double velocity = now < stop_ms ? model.Curve().Velocity( now ) : 0;
+			double error = velocity - reference[k];
+			if( fabs( error ) > kSettledFraction * fabs( reference[k] ) + kSettledFloor )
+				settled_ms = now + kStepMs;
+			worst_error = std::max( worst_error, fabs( error ) );
+			total_error += error * error;
+			scored_steps++;
+			steps++;
+		}
+		if( steps == 0 )
+			continue;
+		quality.onsets++;
+		quality.settle_ms += std::min( settled_ms, end_ms ) - start_ms;
+		quality.worst_error += worst_error;
+	}
+	if( quality.onsets > 0 )
+	{
+		quality.settle_ms /= quality.onsets;
+		quality.worst_error /= quality.onsets;
+	}
+	quality.rmse = scored_steps > 0 ? sqrt( total_error / scored_steps ) : 0;
+	return quality;
+}
+
+ReplayQuality ScoreReplay( const std::vector<double>& output, const std::vector<double>& reference )
+/*
+ * @param output
+ *		The velocity at each audio step from time 0
+ * @param reference
+ *		The reference velocity on the same grid
+ */
+{
+	const long steps = (long)std::min( output.size(), reference.size() );
+	const long edge = (long)ceil( kScoreMarginMs / kStepMs ) + 1;
+	double previous_velocity = 0, total_step = 0, total_error = 0;
+	int scored_steps = 0;
+	for( long i = 0; i < steps; i++ )
+	{
+		total_step += fabs( output[i] - previous_velocity );
+		previous_velocity = output[i];
+		if( i >= edge && i < steps - edge )
+		{
+			total_error += ( output[i] - reference[i] ) * ( output[i] - reference[i] );
+			scored_steps++;
+		}
+	}
+
+	// the error with the output shifted back by each candidate lag, scored over the steps every lag can see
+	const long first = edge + kMaxLagSteps;
+	const long last = steps - edge + kMinLagSteps;
+	double best_error = -1;
+	int best_lag = 0;
+	std::vector<double> errors( kMaxLagSteps - kMinLagSteps + 1, 0.0 );
+	for( int lag = kMinLagSteps; lag <= kMaxLagSteps; lag++ )
+	{
+		double error = 0;
+		for( long i = first; i < last; i++ )
+		{
+			double difference = output[i] - reference[i - lag];
+			error += difference * difference;
+		}
+		errors[lag - kMinLagSteps] = error;
+		if( best_error < 0 || error < best_error )
+		{
+			best_error = error;
+			best_lag = lag;
+		}
+	}
+
+	ReplayQuality quality;
+	quality.mean_step = steps > 0 ? total_step / steps : 0;
+	quality.rmse = scored_steps > 0 ? sqrt( total_error / scored_steps ) : 0;
+	// refine the best lag between steps with a parabola through its neighbours
+	double offset = 0;
+	if( best_lag > kMinLagSteps && best_lag < kMaxLagSteps )
+	{
+		double before = errors[best_lag - 1 - kMinLagSteps], after = errors[best_lag + 1 - kMinLagSteps];
+		double curvature = before - 2 * best_error + after;
+		if( curvature > 0 )
+			offset = 0.5 * ( before - after ) / curvature;
+	}
+	quality.lag_ms = ( best_lag + offset ) * kStepMs;
+	return quality;
+}
+
+static BenchmarkResult BenchmarkModel( MidiSmoother::SmoothingMode mode, const DeviceProfile& device, const std::vector<double>& reference, const std::vector<CaptureEvent>& arrivals, int repeat )
+/*
+ * Runs a single model over a capture.
+ *
+ * @param device
+ *		The device the capture was recorded from
+ * @param reference
+ *		The reference velocity of the capture as recorded
+ * @param arrivals
+ *		The capture as the model sees it (possibly with bunching applied)
+ */
+{
+	BenchmarkResult result;
+	std::unique_ptr<SmoothingModel> model( MidiSmoother::CreateModel( mode ) );
+	const double ms_per_value = device.MsPerTick();
+
+	// cost: whole passes timed together for the mean, single updates for the worst case
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for( int pass = 0; pass < repeat; pass++ )
+	{
+		model->Reset();
+		for( size_t i = 0; i < arrivals.size(); i++ )
+			model->AddDelta( arrivals[i].time_ms, arrivals[i].midi_value * ms_per_value );
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	result.mean_ns = std::chrono::duration<double, std::nano>( end - start ).count() / std::max( (size_t)1, arrivals.size() * repeat );
+
+	result.max_ns = 0;
+	model->Reset();
+	for( size_t i = 0; i < arrivals.size(); i++ )
+	{
+		std::chrono::steady_clock::time_point update_start = std::chrono::steady_clock::now();
+		model->AddDelta( arrivals[i].time_ms, arrivals[i].midi_value * ms_per_value );
+		std::chrono::steady_clock::time_point update_end = std::chrono::steady_clock::now();
+		result.max_ns = std::max( result.max_ns, std::chrono::duration<double, std::nano>( update_end - update_start ).count() );
+	}
+
+	ReplayQuality quality = ReplayModel( *model, device, arrivals, reference );
+	result.mean_step = quality.mean_step;
+	result.rmse = quality.rmse;
+	result.lag_ms = quality.lag_ms;
+	return result;
+}
+
+int RunBenchmark( int argc, const char* argv[] )
+{
+	const DeviceProfile* device = &DefaultDeviceProfile();
+	double bunch_fraction = 0;
+	int repeat = 200;
+	std::vector<std::string> files;
+	for( int i = 0; i < argc; i++ )
+	{
+		std::string arg = argv[i];
+		if( arg == "--device" && i + 1 < argc )
+		{
+			device = FindDeviceProfile( argv[++i] );
+			if( !device )
+			{
+				PrintBenchmarkUsage();
+				return -1;
+			}
+		}
+		else if( arg == "--bunch" && i + 1 < argc )
+			bunch_fraction = atof( argv[++i] );
+		else if( arg == "--repeat" && i + 1 < argc )
+			repeat = std::max( 1, atoi( argv[++i] ) );
+		else if( arg[0] != '-' )
+			files.push_back( arg );
+		else
+		{
+			PrintBenchmarkUsage();
+			return -1;
+		}
+	}
+	if( files.empty() )
+	{
+		PrintBenchmarkUsage();
+		return -1;
+	}
+
+	std::printf( "%-32s %-12s %10s %10s %10s %10s %10s\n", "capture", "mode", "ns/update", "worst ns", "step", "rmse", "lag ms" );
+	std::vector<OnsetCapture> onsets;
+	for( size_t f = 0; f < files.size(); f++ )
+	{
+		std::vector<CaptureEvent> events;
+		if( !LoadCapture( files[f], events ) )
+		{
+			std::printf( "Failed to open file %s\n", files[f].c_str() );
+			return -1;
+		}
+
+		// bunching delays a message until just before the one after it
+		std::vector<CaptureEvent> arrivals = events;
+		std::mt19937 random( 1234 );
+		std::uniform_real_distribution<double> uniform( 0.0, 1.0 );
+		for( size_t i = 0; i + 1 < arrivals.size(); i++ )
+		{
+			if( uniform( random ) < bunch_fraction )
+				arrivals[i].time_ms = std::max( arrivals[i].time_ms, arrivals[i + 1].time_ms - kBunchGapMs );
+		}
+
+		std::vector<double> reference;
+		ReferenceVelocity( *device, events, kStepMs, reference );
+
+		std::string name = files[f].substr( files[f].find_last_of( "/\\" ) + 1 );
+		for( int mode = 0; mode < MidiSmoother::kNumSmoothingModes; mode++ )
+		{
+			BenchmarkResult result = BenchmarkModel( (MidiSmoother::SmoothingMode)mode, *device, reference, arrivals, repeat );
+			std::printf( "%-32s %-12s %10.1f %10.1f %10.4f %10.4f %10.2f\n", name.c_str(), MidiSmoother::SmoothingModeName( (MidiSmoother::SmoothingMode)mode ),
+						result.mean_ns, result.max_ns, result.mean_step, result.rmse, result.lag_ms );
+		}
+		onsets.push_back( OnsetCapture() );
+		onsets.back().name = name;
+		onsets.back().arrivals = arrivals;
+		onsets.back().reference = reference;
+	}
+
+	std::printf( "\n%-32s %-12s %8s %10s %10s %10s %10s %10s %10s\n", "capture", "mode", "onsets", "settle ms", "worst", "rmse",
+				"+warm-up", "worst", "rmse" );
+	for( size_t f = 0; f < onsets.size(); f++ )
+	{
+		for( int mode = 0; mode < MidiSmoother::kNumSmoothingModes; mode++ )
+		{
+			std::unique_ptr<SmoothingModel> model( MidiSmoother::CreateModel( (MidiSmoother::SmoothingMode)mode ) );
+			OnsetQuality plain = ReplayOnsets( *model, *device, onsets[f].arrivals, onsets[f].reference );
+			WarmupModel warmup( WarmupMessages, 1000.0 / device->message_rate_hz, WarmupSlopeSpanMs, device->reversal_ticks * device->MsPerTick() );
+			warmup.SetModel( model.get() );
+			OnsetQuality warm = ReplayOnsets( warmup, *device, onsets[f].arrivals, onsets[f].reference );
+			std::printf( "%-32s %-12s %8d %10.2f %10.4f %10.4f %10.2f %10.4f %10.4f\n", onsets[f].name.c_str(), MidiSmoother::SmoothingModeName( (MidiSmoother::SmoothingMode)mode ),
+						plain.onsets, plain.settle_ms, plain.worst_error, plain.rmse, warm.settle_ms, warm.worst_error, warm.rmse );
+		}
+	}
+	double clock_ns = 0, batched_ns = 0;
+	double trace_ns = MeasureTraceCost( clock_ns, batched_ns );
+	std::printf( "Tracing: %.1f ns per event, %.1f ns of it the timestamp, %.1f ns per event in a batch\n", trace_ns, clock_ns, batched_ns );
+	return 0;
+}
@@ -0,0 +1,54 @@
+//
+//  Benchmark.h
+//  MidiSmoother
+//
+//  Offline comparison of the smoothing models over captured sessions.
+//
+
+#ifndef __MidiSmoother__Benchmark__
+#define __MidiSmoother__Benchmark__
+
+#include <vector>
+
+#include "Capture.h"
+#include "Devices/DeviceProfile.h"
+#include "Models/SmoothingModel.h"
+
+// How a model's output compares with the platter over a capture
+struct ReplayQuality
+{
+	double mean_step;	// mean |change in velocity| between consecutive audio steps
+	double rmse;		// error against the reference velocity (see Reference.h)
+	double lag_ms;		// the delay that best lines the output up with the reference
+};
+
+// How a model's output settles after each start from rest in a capture
+struct OnsetQuality
+{
+	int onsets;				// starts from rest scored
+	double settle_ms;		// mean time from the first message until the output stays near the reference
+	double worst_error;		// mean of the largest |error| after each start, the spike at touch
+	double rmse;			// error against the reference over the settling windows
+};
+
+// The audio step (ms) VelocityConsumer requests, and so the grid output and the reference are
+// sampled on. Everything that steps like the audio uses this one value
+extern const double kReplayStepMs;
+
+// Replays a capture through a model on a virtual clock, sampling its output on the audio step
+// grid, and scores it against the capture's reference velocity on the same grid (see
+// ReferenceVelocity). arrivals is the capture as the model sees it
+ReplayQuality ReplayModel( SmoothingModel& model, const DeviceProfile& device, const std::vector<CaptureEvent>& arrivals, const std::vector<double>& reference );
+
+// Replays a capture through a model as MidiSmoother does around stops, resetting it at the first
+// message after each silence longer than the smoother's stop timeout, and scores the output over
+// the start of each motion
+OnsetQuality ReplayOnsets( SmoothingModel& model, const DeviceProfile& device, const std::vector<CaptureEvent>& arrivals, const std::vector<double>& reference );
+
+// Scores output already sampled on the audio step grid from time 0 against the reference
+ReplayQuality ScoreReplay( const std::vector<double>& output, const std::vector<double>& reference );
+
+// Entry point for "MidiSmoother --bench ...". argv holds the arguments after --bench
+int RunBenchmark( int argc, const char* argv[] );
+
+#endif /* defined(__MidiSmoother__Benchmark__) */
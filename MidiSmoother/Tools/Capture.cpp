@@ -0,0 +1,67 @@
+//
+//  Capture.cpp
+//  MidiSmoother
+//
+
+#include "Capture.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+bool LoadCapture( const std::string& filename, std::vector<CaptureEvent>& events )
+/*
+ * Loads a capture file, converting the per message intervals into absolute times.
+ *
+ * @param filename
+ *		The csv to read
+ * @param events
+ *		Receives the events in arrival order
+ */
+{
+	std::ifstream stream( filename.c_str() );
+	if( !stream )
+		return false;
+
+	events.clear();
+	double time_ms = 0;
+	std::string line;
+	while( std::getline( stream, line ) )
+	{
+		std::istringstream string_stream( line );
+		double interval;
+		char comma;
+		int midi_value;
+		if( !( string_stream >> interval >> comma >> midi_value ) )
+			continue;
+		time_ms += interval * 1000;
+		CaptureEvent event;
+		event.time_ms = time_ms;
+		event.midi_value = midi_value;
+		events.push_back( event );
+	}
+	return true;
+}
+
+bool SaveCapture( const std::string& filename, const std::vector<CaptureEvent>& events )
+/*
+ * Writes events back out as per message intervals, with the precision the supplied captures use.
+ *
+ * @param filename
+ *		The csv to write
+ * @param events
+ *		The events in arrival order
+ */
+{
+	FILE* file = fopen( filename.c_str(), "w" );
+	if( !file )
+		return false;
+
+	double previous_ms = 0;
+	for( size_t i = 0; i < events.size(); i++ )
+	{
+		fprintf( file, "%.9f,%d\n", ( events[i].time_ms - previous_ms ) / 1000, events[i].midi_value );
+		previous_ms = events[i].time_ms;
+	}
+	return fclose( file ) == 0;
+}
@@ -0,0 +1,28 @@
+//
+//  Capture.h
+//  MidiSmoother
+//
+//  Loading and saving of captured midi sessions for offline replay. Captures use the same two column
+//  csv format MidiFirer reads: the interval since the previous message in seconds, then
+//  the midi value.
+//
+
+#ifndef __MidiSmoother__Capture__
+#define __MidiSmoother__Capture__
+
+#include <string>
+#include <vector>
+
+struct CaptureEvent
+{
+	double time_ms;		// arrival time since the start of the capture
+	int midi_value;
+};
+
+// Returns false if the file can't be read. Lines that don't parse are skipped
+bool LoadCapture( const std::string& filename, std::vector<CaptureEvent>& events );
+
+// Returns false if the file can't be written
+bool SaveCapture( const std::string& filename, const std::vector<CaptureEvent>& events );
+
+#endif /* defined(__MidiSmoother__Capture__) */
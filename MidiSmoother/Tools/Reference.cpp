@@ -0,0 +1,262 @@
+//
+//  Reference.cpp
+//  MidiSmoother
+//
+
+#include "Reference.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <math.h>
+#include <string>
+
+static const double kPi = 3.14159265358979323846;
+// the cutoffs (Hz) cross validation chooses between
+static const double kCandidateCutoffs[] = { 2, 3, 4, 6, 8, 11, 16, 22, 32, 45, 64, 90, 128 };
+static const int kNumCandidateCutoffs = sizeof( kCandidateCutoffs ) / sizeof( kCandidateCutoffs[0] );
+
+static void SamplePositions( const std::vector<double>& times, const std::vector<double>& positions, double step_ms, size_t steps, std::vector<double>& sampled )
+/*
+ * The position track, linearly interpolated between messages, at each step. Before the first
+ * message the track rises from 0 at time 0, and after the last it holds.
+ */
+{
+	sampled.resize( steps );
+	size_t next = 0;
+	for( size_t k = 0; k < steps; k++ )
+	{
+		double now = k * step_ms;
+		while( next < times.size() && times[next] < now )
+			next++;
+		if( next == times.size() )
+		{
+			sampled[k] = positions.empty() ? 0 : positions.back();
+			continue;
+		}
+		double previous_time = next > 0 ? times[next - 1] : 0;
+		double previous_position = next > 0 ? positions[next - 1] : 0;
+		double span = times[next] - previous_time;
+		sampled[k] = span > 0 ? previous_position + ( positions[next] - previous_position ) * ( now - previous_time ) / span : positions[next];
+	}
+}
+
+static void FilterForwardBackward( std::vector<double>& signal, double cutoff_hz, double step_ms )
+/*
+ * Second order Butterworth low pass run forwards and then backwards, which squares its
+ * magnitude response and cancels its phase. Each pass starts settled on the value at its end
+ * of the signal, so there is no start up transient.
+ */
+{
+	if( signal.empty() )
+		return;
+	double k = tan( kPi * cutoff_hz * step_ms * 0.001 );
+	double norm = 1 / ( 1 + sqrt( 2.0 ) * k + k * k );
+	double b0 = k * k * norm, b1 = 2 * b0, b2 = b0;
+	double a1 = 2 * ( k * k - 1 ) * norm, a2 = ( 1 - sqrt( 2.0 ) * k + k * k ) * norm;
+
+	for( int pass = 0; pass < 2; pass++ )
+	{
+		size_t n = signal.size();
+		double initial = pass == 0 ? signal[0] : signal[n - 1];
+		double z2 = ( b2 - a2 ) * initial;
+		double z1 = ( b1 - a1 ) * initial + z2;
+		for( size_t i = 0; i < n; i++ )
+		{
+			double& x = signal[pass == 0 ? i : n - 1 - i];
+			double y = b0 * x + z1;
+			z1 = b1 * x - a1 * y + z2;
+			z2 = b2 * x - a2 * y;
+			x = y;
+		}
+	}
+}
+
+static void SmoothedVelocity( const std::vector<double>& sampled, double cutoff_hz, double step_ms, std::vector<double>& velocity )
+/*
+ * The velocity over each step, filtered, then averaged either side of each step so that it
+ * lines up with the grid rather than half a step later.
+ */
+{
+	size_t steps = sampled.size();
+	std::vector<double> between( steps > 1 ? steps - 1 : 0 );
+	for( size_t k = 0; k + 1 < steps; k++ )
+		between[k] = ( sampled[k + 1] - sampled[k] ) / step_ms;
+	FilterForwardBackward( between, cutoff_hz, step_ms );
+
+	velocity.assign( steps, 0.0 );
+	for( size_t k = 0; k < steps; k++ )
+	{
+		if( between.empty() )
+			break;
+		double before = k > 0 ? between[k - 1] : between[0];
+		double after = k < between.size() ? between[k] : between.back();
+		velocity[k] = 0.5 * ( before + after );
+	}
+}
+
+static void PositionTrack( const DeviceProfile& device, const std::vector<CaptureEvent>& events, std::vector<double>& times, std::vector<double>& positions )
+{
+	const double ms_per_value = device.MsPerTick();
+	double position = 0;
+	times.resize( events.size() );
+	positions.resize( events.size() );
+	for( size_t i = 0; i < events.size(); i++ )
+	{
+		position += events[i].midi_value * ms_per_value;
+		times[i] = events[i].time_ms;
+		positions[i] = position;
+	}
+}
+
+static size_t StepsFor( const std::vector<CaptureEvent>& events, double step_ms )
+{
+	double end_ms = events.empty() ? 0 : events.back().time_ms;
+	size_t steps = 0;
+	for( double now = 0; now < end_ms; now += step_ms )
+		steps++;
+	return steps;
+}
+
+static double HeldOutError( const std::vector<double>& times, const std::vector<double>& positions, double cutoff_hz, double step_ms, size_t steps )
+/*
+ * Smooths the track through every other message, and measures how far the smoothed position
+ * is from each message left out.
+ */
+{
+	std::vector<double> kept_times, kept_positions;
+	for( size_t i = 0; i < times.size(); i += 2 )
+	{
+		kept_times.push_back( times[i] );
+		kept_positions.push_back( positions[i] );
+	}
+	std::vector<double> sampled, velocity;
+	SamplePositions( kept_times, kept_positions, step_ms, steps, sampled );
+	SmoothedVelocity( sampled, cutoff_hz, step_ms, velocity );
+
+	// integrate the smoothed velocity back into a position on the grid
+	std::vector<double> smoothed( steps, 0.0 );
+	for( size_t k = 1; k < steps; k++ )
+		smoothed[k] = smoothed[k - 1] + 0.5 * ( velocity[k - 1] + velocity[k] ) * step_ms;
+
+	double error = 0;
+	for( size_t i = 1; i < times.size(); i += 2 )
+	{
+		double at = times[i] / step_ms;
+		size_t k = std::min( (size_t)at, steps > 1 ? steps - 2 : 0 );
+		if( k + 1 >= steps )
+			continue;
+		double fraction = at - k;
+		double predicted = smoothed[k] + ( smoothed[k + 1] - smoothed[k] ) * fraction;
+		error += ( predicted - positions[i] ) * ( predicted - positions[i] );
+	}
+	return error;
+}
+
+double ReferenceVelocity( const DeviceProfile& device, const std::vector<CaptureEvent>& events, double step_ms, std::vector<double>& velocity )
+/*
+ * @param device
+ *		The device the capture was recorded from
+ * @param events
+ *		The capture as recorded
+ * @param step_ms
+ *		The grid to produce the velocity on, normally VelocityConsumer's step
+ * @param velocity
+ *		Set to the velocity at each step
+ */
+{
+	std::vector<double> times, positions;
+	PositionTrack( device, events, times, positions );
+	size_t steps = StepsFor( events, step_ms );
+
+	double best_cutoff = kCandidateCutoffs[0], best_error = -1;
+	for( int i = 0; i < kNumCandidateCutoffs; i++ )
+	{
+		// a cutoff too close to the grid's Nyquist frequency filters nothing
+		if( kCandidateCutoffs[i] * step_ms * 0.001 > 0.25 )
+			break;
+		double error = HeldOutError( times, positions, kCandidateCutoffs[i], step_ms, steps );
+		if( best_error < 0 || error < best_error )
+		{
+			best_error = error;
+			best_cutoff = kCandidateCutoffs[i];
+		}
+	}
+
+	std::vector<double> sampled;
+	SamplePositions( times, positions, step_ms, steps, sampled );
+	SmoothedVelocity( sampled, best_cutoff, step_ms, velocity );
+	return best_cutoff;
+}
+
+void ReferenceVelocity( const DeviceProfile& device, const std::vector<CaptureEvent>& events, double step_ms, double cutoff_hz, std::vector<double>& velocity )
+{
+	std::vector<double> times, positions, sampled;
+	PositionTrack( device, events, times, positions );
+	SamplePositions( times, positions, step_ms, StepsFor( events, step_ms ), sampled );
+	SmoothedVelocity( sampled, cutoff_hz, step_ms, velocity );
+}
+
+static void PrintReferenceUsage()
+{
+	std::printf( "Usage: MidiSmoother --reference [--device <name>] [--cutoff <hz>] [--step <ms>] <midi_file> <output_csv>\n" );
+	std::printf( "  --device  the device the capture was recorded from (default %s)\n", DefaultDeviceProfile().name );
+	std::printf( "  --cutoff  the smoothing cutoff (default chosen by cross validation)\n" );
+	std::printf( "  --step    the grid to write the velocity on (default the audio step, %.4fms)\n", kReplayStepMs );
+	std::printf( "The output has a line of time ms, velocity for each step\n" );
+}
+
+int RunReference( int argc, const char* argv[] )
+{
+	const DeviceProfile* device = &DefaultDeviceProfile();
+	double cutoff_hz = -1;
+	double step_ms = kReplayStepMs;
+	std::vector<std::string> files;
+	for( int i = 0; i < argc; i++ )
+	{
+		std::string arg = argv[i];
+		if( arg == "--device" && i + 1 < argc && ( device = FindDeviceProfile( argv[i + 1] ) ) != NULL )
+			i++;
+		else if( arg == "--cutoff" && i + 1 < argc )
+			cutoff_hz = atof( argv[++i] );
+		else if( arg == "--step" && i + 1 < argc )
+			step_ms = atof( argv[++i] );
+		else if( arg[0] != '-' )
+			files.push_back( arg );
+		else
+		{
+			PrintReferenceUsage();
+			return -1;
+		}
+	}
+	if( files.size() != 2 || step_ms <= 0 )
+	{
+		PrintReferenceUsage();
+		return -1;
+	}
+
+	std::vector<CaptureEvent> events;
+	if( !LoadCapture( files[0], events ) )
+	{
+		std::printf( "Failed to open file %s\n", files[0].c_str() );
+		return -1;
+	}
+	std::vector<double> velocity;
+	if( cutoff_hz > 0 )
+		ReferenceVelocity( *device, events, step_ms, cutoff_hz, velocity );
+	else
+		cutoff_hz = ReferenceVelocity( *device, events, step_ms, velocity );
+
+	FILE* file = fopen( files[1].c_str(), "wb" );
+	if( !file )
+	{
+		std::printf( "Failed to write %s\n", files[1].c_str() );
+		return -1;
+	}
+	for( size_t k = 0; k < velocity.size(); k++ )
+		fprintf( file, "%.4f,%.6f\n", k * step_ms, velocity[k] );
+	fclose( file );
+	std::printf( "%s: %d steps, cutoff %gHz\n", files[1].c_str(), (int)velocity.size(), cutoff_hz );
+	return 0;
+}
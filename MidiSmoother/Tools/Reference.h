@@ -0,0 +1,31 @@
+//
+//  Reference.h
+//  MidiSmoother
+//
+//  The best estimate of the platter's velocity that hindsight allows, used as the target when
+//  scoring the live models. It sees the whole capture, so it can smooth without lag: the
+//  position track is differentiated on the audio step grid and low pass filtered forwards then
+//  backwards, cancelling the filter's delay. The cutoff is chosen per capture by cross
+//  validation: the one whose smoothing of every other message best predicts the messages left
+//  out. Everything is linear in the length of the capture.
+//
+
+#ifndef __MidiSmoother__Reference__
+#define __MidiSmoother__Reference__
+
+#include <vector>
+
+#include "Capture.h"
+#include "Devices/DeviceProfile.h"
+
+// The reference velocity at each step_ms from time 0 to the end of the capture. Returns the
+// cutoff (Hz) chosen
+double ReferenceVelocity( const DeviceProfile& device, const std::vector<CaptureEvent>& events, double step_ms, std::vector<double>& velocity );
+
+// As above with a given cutoff rather than a cross validated one
+void ReferenceVelocity( const DeviceProfile& device, const std::vector<CaptureEvent>& events, double step_ms, double cutoff_hz, std::vector<double>& velocity );
+
+// Entry point for "MidiSmoother --reference ...". argv holds the arguments after --reference
+int RunReference( int argc, const char* argv[] );
+
+#endif /* defined(__MidiSmoother__Reference__) */
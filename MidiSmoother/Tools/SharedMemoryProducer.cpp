@@ -0,0 +1,109 @@
+//
+//  SharedMemoryProducer.cpp
+//  MidiSmoother
+//
+
+#include "SharedMemoryProducer.h"
+#include "Capture.h"
+#include "Input/SharedMemoryIngress.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void PrintProduceUsage()
+{
+	std::printf( "Usage: MidiSmoother --produce [options] [<midi_file>]\n" );
+	std::printf( "  --name <name>     shared memory ring to write to (default %s)\n", SharedMidiRing::kDefaultName );
+	std::printf( "  --wait <s>        how long to wait for the consumer to create the ring (default 5)\n" );
+	std::printf( "  --rate <hz>       without a midi file, send single ticks at this rate (default 1000)\n" );
+	std::printf( "  --count <n>       without a midi file, the number of ticks to send (default 10000)\n" );
+}
+
+int RunProduce( int argc, const char* argv[] )
+/*
+ * Sends each event at the time the capture says it arrived, timestamping it as it is written.
+ */
+{
+	std::string name = SharedMidiRing::kDefaultName;
+	std::string file;
+	double wait_seconds = 5, rate = 1000;
+	int count = 10000;
+	for( int i = 0; i < argc; i++ )
+	{
+		std::string arg = argv[i];
+		if( arg == "--name" && i + 1 < argc )
+			name = argv[++i];
+		else if( arg == "--wait" && i + 1 < argc )
+			wait_seconds = atof( argv[++i] );
+		else if( arg == "--rate" && i + 1 < argc )
+			rate = atof( argv[++i] );
+		else if( arg == "--count" && i + 1 < argc )
+			count = atoi( argv[++i] );
+		else if( arg[0] != '-' )
+			file = arg;
+		else
+		{
+			PrintProduceUsage();
+			return -1;
+		}
+	}
+	if( rate <= 0 )
+	{
+		PrintProduceUsage();
+		return -1;
+	}
+
+	std::vector<CaptureEvent> events;
+	if( !file.empty() )
+	{
+		if( !LoadCapture( file, events ) )
+		{
+			std::printf( "Failed to open file %s\n", file.c_str() );
+			return -1;
+		}
+	}
+	else
+	{
+		for( int i = 0; i < count; i++ )
+		{
+			CaptureEvent event;
+			event.time_ms = ( i + 1 ) * 1000 / rate;
+			event.midi_value = 1;
+			events.push_back( event );
+		}
+	}
+
+	// the consumer owns the ring, so wait for it to appear
+	SharedMidiRing ring;
+	std::chrono::steady_clock::time_point give_up = std::chrono::steady_clock::now() + std::chrono::milliseconds( (long long)( wait_seconds * 1000 ) );
+	while( !ring.Open( name ) )
+	{
+		if( std::chrono::steady_clock::now() > give_up )
+		{
+			std::printf( "No shared memory ring %s to write to\n", name.c_str() );
+			return -1;
+		}
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+	}
+
+	size_t dropped = 0;
+	double worst_push_ns = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for( size_t i = 0; i < events.size(); i++ )
+	{
+		std::this_thread::sleep_until( start + std::chrono::microseconds( (long long)( events[i].time_ms * 1000 ) ) );
+		int64_t now_ns = SharedMidiRing::NowNs();
+		if( !ring.Push( events[i].midi_value, now_ns ) )
+			dropped++;
+		worst_push_ns = std::max( worst_push_ns, (double)( SharedMidiRing::NowNs() - now_ns ) );
+	}
+	ring.MarkDone();
+
+	std::printf( "%zu events sent to %s, %zu dropped, worst push %.1fus\n", events.size() - dropped, name.c_str(), dropped, worst_push_ns / 1000 );
+	return dropped > 0 ? 1 : 0;
+}
@@ -0,0 +1,15 @@
+//
+//  SharedMemoryProducer.h
+//  MidiSmoother
+//
+//  Stand in for an out of process controller driver, for testing SharedMemoryIngress: replays
+//  a capture (or a steady stream of single ticks) into the shared memory ring in real time.
+//
+
+#ifndef __MidiSmoother__SharedMemoryProducer__
+#define __MidiSmoother__SharedMemoryProducer__
+
+// Entry point for "MidiSmoother --produce ...". argv holds the arguments after --produce
+int RunProduce( int argc, const char* argv[] );
+
+#endif /* defined(__MidiSmoother__SharedMemoryProducer__) */
@@ -0,0 +1,140 @@
+//
+//  TraceExport.cpp
+//  MidiSmoother
+//
+
+#include "TraceExport.h"
+#include "MidiSmoother.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+static void PrintTraceExportUsage()
+{
+	std::printf( "Usage: MidiSmoother --trace-export <trace_file> <output_json>\n" );
+	std::printf( "  <trace_file> is written by --trace-dump, at exit or on SIGUSR1\n" );
+}
+
+static std::string JsonString( const std::string& text )
+{
+	std::string quoted = "\"";
+	for( size_t i = 0; i < text.size(); i++ )
+	{
+		if( text[i] == '"' || text[i] == '\\' )
+			quoted += '\\';
+		if( (unsigned char)text[i] >= 0x20 )
+			quoted += text[i];
+	}
+	return quoted + "\"";
+}
+
+static const char* ModeName( int mode )
+{
+	return mode >= 0 && mode < MidiSmoother::kNumSmoothingModes ? MidiSmoother::SmoothingModeName( (MidiSmoother::SmoothingMode)mode ) : "unknown";
+}
+
+static void WriteEvent( FILE* file, const TraceEvent& event, const std::string& thread_name )
+/*
+ * Writes the Chrome trace events for one traced event, each after a separator. Chrome times
+ * are in us.
+ */
+{
+	const double ts = event.time_ns / 1000.0;
+	const int tid = event.thread;
+	const char* separator = ",\n";
+	switch( event.type )
+	{
+	case kTraceMidi:
+		fprintf( file, "%s{\"name\":\"midi\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"ticks\":%d,\"time_ms\":%.4f}}",
+				separator, ts, tid, event.arg, event.values[0] );
+		break;
+	case kTraceModelUpdate:
+		fprintf( file, "%s{\"name\":\"model update\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"mode\":\"%s\",\"c0\":%g,\"c1\":%g,\"c2\":%g}}",
+				separator, ts, tid, ModeName( event.arg ), event.values[0], event.values[1], event.values[2] );
+		fprintf( file, ",\n{\"name\":\"model velocity\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"velocity\":%g}}", ts, event.values[0] );
+		break;
+	case kTraceModelChange:
+		fprintf( file, "%s{\"name\":\"model change\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"mode\":\"%s\",\"time_ms\":%.4f,\"update_cost_us\":%g}}",
+				separator, ts, tid, ModeName( event.arg ), event.values[0], event.values[1] );
+		break;
+	case kTraceStop:
+		fprintf( file, "%s{\"name\":\"stop\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"time_ms\":%.4f}}",
+				separator, ts, tid, event.values[0] );
+		break;
+	case kTraceRead:
+		// counters belong to the process, so each reader thread gets its own
+		fprintf( file, "%s{\"name\":%s,\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"velocity\":%g}}",
+				separator, JsonString( "velocity " + thread_name ).c_str(), ts, event.values[1] );
+		if( event.arg > 0 )
+			fprintf( file, ",\n{\"name\":\"read retried\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"retries\":%d,\"time_ms\":%.4f}}",
+					ts, tid, event.arg, event.values[0] );
+		break;
+	case kTraceAudioBlock:
+		fprintf( file, "%s{\"name\":\"audio block\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"steps\":%d,\"step_ms\":%.4f}}",
+				separator, ts, tid, event.arg, event.values[0] );
+		break;
+	case kTraceSaturation:
+		// the run shows as a span on the midi thread
+		if( event.arg )
+			fprintf( file, "%s{\"name\":\"saturated\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"time_ms\":%.4f,\"velocity_before\":%g,\"interval_ms\":%g}}",
+					separator, ts, tid, event.values[0], event.values[1], event.values[2] );
+		else
+			fprintf( file, "%s{\"name\":\"saturated\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"time_ms\":%.4f,\"duration_ms\":%g,\"peak_velocity\":%g}}",
+					separator, ts, tid, event.values[0], event.values[1], event.values[2] );
+		break;
+	default:
+		fprintf( file, "%s{\"name\":\"unknown\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"type\":%d}}",
+				separator, ts, tid, (int)event.type );
+		break;
+	}
+}
+
+bool ExportChromeTrace( const std::vector<TraceThread>& threads, const std::string& filename )
+{
+	FILE* file = fopen( filename.c_str(), "wb" );
+	if( !file )
+		return false;
+	fprintf( file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" );
+	fprintf( file, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"MidiSmoother\"}}" );
+	for( size_t i = 0; i < threads.size(); i++ )
+	{
+		fprintf( file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":%s}}", (int)i, JsonString( threads[i].name ).c_str() );
+		for( size_t e = 0; e < threads[i].events.size(); e++ )
+			WriteEvent( file, threads[i].events[e], threads[i].name );
+	}
+	fprintf( file, "\n]}\n" );
+	return fclose( file ) == 0;
+}
+
+int RunTraceExport( int argc, const char* argv[] )
+{
+	if( argc != 2 )
+	{
+		PrintTraceExportUsage();
+		return -1;
+	}
+
+	std::vector<TraceThread> threads;
+	if( !LoadTrace( argv[0], threads ) )
+	{
+		std::printf( "Failed to read trace %s\n", argv[0] );
+		return -1;
+	}
+	if( !ExportChromeTrace( threads, argv[1] ) )
+	{
+		std::printf( "Failed to write %s\n", argv[1] );
+		return -1;
+	}
+
+	std::printf( "%-16s %10s %12s %12s\n", "thread", "events", "first ms", "last ms" );
+	for( size_t i = 0; i < threads.size(); i++ )
+	{
+		const std::vector<TraceEvent>& events = threads[i].events;
+		if( events.empty() )
+			std::printf( "%-16s %10d %12s %12s\n", threads[i].name.c_str(), 0, "-", "-" );
+		else
+			std::printf( "%-16s %10d %12.3f %12.3f\n", threads[i].name.c_str(), (int)events.size(), events.front().time_ns * 1e-6, events.back().time_ns * 1e-6 );
+	}
+	return 0;
+}
@@ -0,0 +1,24 @@
+//
+//  TraceExport.h
+//  MidiSmoother
+//
+//  Turns a binary trace dumped by the Tracer into Chrome trace JSON, which chrome://tracing and
+//  ui.perfetto.dev show as a timeline: one track per thread with an instant for each midi
+//  message, model update and audio block, and counters for the model's velocity and the
+//  velocity each reader was given.
+//
+
+#ifndef __MidiSmoother__TraceExport__
+#define __MidiSmoother__TraceExport__
+
+#include <string>
+#include <vector>
+
+#include "Threading/Tracer.h"
+
+bool ExportChromeTrace( const std::vector<TraceThread>& threads, const std::string& filename );
+
+// Entry point for "MidiSmoother --trace-export ...". argv holds the arguments after --trace-export
+int RunTraceExport( int argc, const char* argv[] );
+
+#endif /* defined(__MidiSmoother__TraceExport__) */
@@ -0,0 +1,335 @@
+//
+//  Tuner.cpp
+//  MidiSmoother
+//
+
+#include "Tuner.h"
+#include "Benchmark.h"
+#include "Capture.h"
+#include "MidiSmoother.h"
+#include "Reference.h"
+#include "Threading/WorkStealingPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+// the grid searched for each engine
+static const int kRegressionWindows[] = { 4, 6, 8, 10, 12, 16, 20, 24, 32, 40, 48, 64 };
+static const int kRobustWindows[] = { 4, 6, 8, 10, 12, 16, 20, 24, 32 };
+static const int kSplineSpans[] = { 1, 2, 3, 4, 6, 8 };
+static const double kSplineHorizons[] = { 0.5, 1.0, 1.5, 2.0, 3.0, 4.0 };
+static const double kOneEuroCutoffs[] = { 0.25, 0.5, 1.0, 2.0, 4.0, 8.0 };
+static const double kOneEuroBetas[] = { 0.0, 0.25, 0.5, 1.0, 2.0, 4.0 };
+static const double kOneEuroDerivativeCutoffs[] = { 1.0, 3.0, 10.0 };
+
+#define COUNT_OF( array ) ( sizeof( array ) / sizeof( array[0] ) )
+
+// One setting of one engine
+struct TuneCandidate
+{
+	MidiSmoother::SmoothingMode mode;
+	double parameters[3];	// as passed to the engine's constructor
+	bool shipped;			// the setting MidiSmoother uses today
+};
+
+// The captures recorded from one device, and the results of every candidate over them
+struct TuneDevice
+{
+	const DeviceProfile* device;
+	std::vector<std::string> files;
+	std::vector< std::vector<CaptureEvent> > captures;
+	std::vector< std::vector<double> > references;	// the reference velocity of each capture
+	double captured_ms;
+	std::vector<ReplayQuality> results;		// per candidate, averaged over the captures
+};
+
+static void PrintTuneUsage()
+{
+	std::printf( "Usage: MidiSmoother --tune [--threads <n>] [--mode <name>]... [--device <name>] <midi_file>... [--device <name> <midi_file>...]...\n" );
+	std::printf( "  --threads  workers to replay on (default one per core)\n" );
+	std::printf( "  --mode     only search this engine. May be repeated (default all)\n" );
+	std::printf( "  --device   the device the captures that follow were recorded from (default %s)\n", DefaultDeviceProfile().name );
+	std::printf( "Lag can only be measured where the velocity changes, so tune over captures with gestures in\n" );
+	std::printf( "them (such as those from --generate) rather than steady play.\n" );
+}
+
+static void AddCandidate( std::vector<TuneCandidate>& candidates, MidiSmoother::SmoothingMode mode, double a, double b, double c, bool shipped )
+{
+	TuneCandidate candidate;
+	candidate.mode = mode;
+	candidate.parameters[0] = a;
+	candidate.parameters[1] = b;
+	candidate.parameters[2] = c;
+	candidate.shipped = shipped;
+	candidates.push_back( candidate );
+}
+
+static void BuildCandidates( const std::vector<bool>& modes, std::vector<TuneCandidate>& candidates )
+/*
+ * Fills in the grid for each engine being searched.
+ */
+{
+	if( modes[MidiSmoother::kSmoothingRegression] )
+	{
+		for( size_t i = 0; i < COUNT_OF( kRegressionWindows ); i++ )
+			AddCandidate( candidates, MidiSmoother::kSmoothingRegression, kRegressionWindows[i], 0, 0, kRegressionWindows[i] == MaxNum );
+	}
+	if( modes[MidiSmoother::kSmoothingSpline] )
+	{
+		for( size_t i = 0; i < COUNT_OF( kSplineSpans ); i++ )
+			for( size_t j = 0; j < COUNT_OF( kSplineHorizons ); j++ )
+				AddCandidate( candidates, MidiSmoother::kSmoothingSpline, kSplineSpans[i], kSplineHorizons[j], 0,
+							 kSplineSpans[i] == SplineTangentSpan && kSplineHorizons[j] == SplineHorizonIntervals );
+	}
+	if( modes[MidiSmoother::kSmoothingOneEuro] )
+	{
+		for( size_t i = 0; i < COUNT_OF( kOneEuroCutoffs ); i++ )
+			for( size_t j = 0; j < COUNT_OF( kOneEuroBetas ); j++ )
+				for( size_t k = 0; k < COUNT_OF( kOneEuroDerivativeCutoffs ); k++ )
+					AddCandidate( candidates, MidiSmoother::kSmoothingOneEuro, kOneEuroCutoffs[i], kOneEuroBetas[j], kOneEuroDerivativeCutoffs[k],
+								 kOneEuroCutoffs[i] == OneEuroMinCutoff && kOneEuroBetas[j] == OneEuroBeta && kOneEuroDerivativeCutoffs[k] == OneEuroDerivativeCutoff );
+	}
+	if( modes[MidiSmoother::kSmoothingRobust] )
+	{
+		for( size_t i = 0; i < COUNT_OF( kRobustWindows ); i++ )
+			AddCandidate( candidates, MidiSmoother::kSmoothingRobust, kRobustWindows[i], 0, 0, kRobustWindows[i] == RobustWindow );
+	}
+	if( modes[MidiSmoother::kSmoothingLastDelta] )
+		AddCandidate( candidates, MidiSmoother::kSmoothingLastDelta, 0, 0, 0, true );
+}
+
+static SmoothingModel* CreateCandidateModel( const TuneCandidate& candidate )
+/*
+ * The engine with the candidate's settings. The caller owns the result
+ */
+{
+	const double* p = candidate.parameters;
+	switch( candidate.mode )
+	{
+	case MidiSmoother::kSmoothingSpline: return new HermiteSplineModel( (int)p[0], p[1] );
+	case MidiSmoother::kSmoothingOneEuro: return new OneEuroModel( p[0], p[1], p[2] );
+	case MidiSmoother::kSmoothingRobust: return new RobustRegressionModel( (int)p[0] );
+	case MidiSmoother::kSmoothingLastDelta: return new LastDeltaModel();
+	case MidiSmoother::kSmoothingRegression:
+	default: return new LinearRegressionModel( (int)p[0] );
+	}
+}
+
+static std::string DescribeCandidate( const TuneCandidate& candidate )
+/*
+ * The candidate's settings, named after the MidiSmoother.h defines they would replace.
+ */
+{
+	char text[128];
+	const double* p = candidate.parameters;
+	switch( candidate.mode )
+	{
+	case MidiSmoother::kSmoothingSpline: snprintf( text, sizeof( text ), "SplineTangentSpan=%d SplineHorizonIntervals=%g", (int)p[0], p[1] ); break;
+	case MidiSmoother::kSmoothingOneEuro: snprintf( text, sizeof( text ), "OneEuroMinCutoff=%g OneEuroBeta=%g OneEuroDerivativeCutoff=%g", p[0], p[1], p[2] ); break;
+	case MidiSmoother::kSmoothingRobust: snprintf( text, sizeof( text ), "RobustWindow=%d", (int)p[0] ); break;
+	case MidiSmoother::kSmoothingLastDelta: snprintf( text, sizeof( text ), "-" ); break;
+	case MidiSmoother::kSmoothingRegression:
+	default: snprintf( text, sizeof( text ), "MaxNum=%d", (int)p[0] ); break;
+	}
+	return text;
+}
+
+static void EvaluateCandidate( const TuneCandidate& candidate, TuneDevice& device, size_t index )
+/*
+ * Replays every capture of a device through one candidate, averaging the results into slot index.
+ */
+{
+	std::unique_ptr<SmoothingModel> model( CreateCandidateModel( candidate ) );
+	ReplayQuality total;
+	total.mean_step = total.rmse = total.lag_ms = 0;
+	double weight = 0;
+	for( size_t i = 0; i < device.captures.size(); i++ )
+	{
+		const std::vector<CaptureEvent>& capture = device.captures[i];
+		if( capture.empty() )
+			continue;
+		// longer captures count for more
+		double duration = capture.back().time_ms;
+		ReplayQuality quality = ReplayModel( *model, *device.device, capture, device.references[i] );
+		total.mean_step += quality.mean_step * duration;
+		total.rmse += quality.rmse * duration;
+		total.lag_ms += quality.lag_ms * duration;
+		weight += duration;
+	}
+	if( weight > 0 )
+	{
+		total.mean_step /= weight;
+		total.rmse /= weight;
+		total.lag_ms /= weight;
+	}
+	device.results[index] = total;
+}
+
+static bool Dominates( const ReplayQuality& a, const ReplayQuality& b )
+/*
+ * True if a is at least as good as b on both lag and smoothness, and better on one.
+ */
+{
+	return a.lag_ms <= b.lag_ms && a.mean_step <= b.mean_step && ( a.lag_ms < b.lag_ms || a.mean_step < b.mean_step );
+}
+
+static void PrintFrontier( const TuneDevice& device, const std::vector<TuneCandidate>& candidates )
+/*
+ * Prints the candidates no other candidate dominates in order of lag, and the shipped settings.
+ */
+{
+	std::vector<size_t> frontier;
+	for( size_t i = 0; i < candidates.size(); i++ )
+	{
+		bool dominated = false;
+		for( size_t j = 0; j < candidates.size() && !dominated; j++ )
+			dominated = j != i && Dominates( device.results[j], device.results[i] );
+		if( !dominated )
+			frontier.push_back( i );
+	}
+	struct ByLag
+	{
+		const std::vector<ReplayQuality>* results;
+		bool operator()( size_t a, size_t b ) const { return (*results)[a].lag_ms < (*results)[b].lag_ms; }
+	} by_lag = { &device.results };
+	std::sort( frontier.begin(), frontier.end(), by_lag );
+
+	std::printf( "\n%s: %d captures, %.1fs, default mode %s\n", device.device->name, (int)device.captures.size(), device.captured_ms / 1000, device.device->default_mode );
+	std::printf( "  %-12s %10s %10s %10s  %s\n", "mode", "lag ms", "step", "rmse", "settings" );
+	for( size_t i = 0; i < frontier.size(); i++ )
+	{
+		const TuneCandidate& candidate = candidates[frontier[i]];
+		const ReplayQuality& result = device.results[frontier[i]];
+		std::printf( "  %-12s %10.2f %10.4f %10.4f  %s%s\n", MidiSmoother::SmoothingModeName( candidate.mode ), result.lag_ms, result.mean_step, result.rmse,
+					DescribeCandidate( candidate ).c_str(), candidate.shipped ? " (shipped)" : "" );
+	}
+	std::printf( "  shipped settings off the frontier:\n" );
+	for( size_t i = 0; i < candidates.size(); i++ )
+	{
+		if( !candidates[i].shipped || std::find( frontier.begin(), frontier.end(), i ) != frontier.end() )
+			continue;
+		const ReplayQuality& result = device.results[i];
+		std::printf( "  %-12s %10.2f %10.4f %10.4f  %s\n", MidiSmoother::SmoothingModeName( candidates[i].mode ), result.lag_ms, result.mean_step, result.rmse,
+					DescribeCandidate( candidates[i] ).c_str() );
+	}
+}
+
+int RunTune( int argc, const char* argv[] )
+{
+	int threads = 0;
+	std::vector<bool> modes( MidiSmoother::kNumSmoothingModes, false );
+	bool any_mode = false;
+	std::vector<TuneDevice> devices;
+	const DeviceProfile* device = &DefaultDeviceProfile();
+	for( int i = 0; i < argc; i++ )
+	{
+		std::string arg = argv[i];
+		if( arg == "--threads" && i + 1 < argc )
+		{
+			threads = std::max( 0, atoi( argv[++i] ) );
+		}
+		else if( arg == "--mode" && i + 1 < argc )
+		{
+			MidiSmoother::SmoothingMode mode;
+			if( !MidiSmoother::SmoothingModeFromName( argv[++i], mode ) )
+			{
+				PrintTuneUsage();
+				return -1;
+			}
+			modes[mode] = true;
+			any_mode = true;
+		}
+		else if( arg == "--device" && i + 1 < argc )
+		{
+			device = FindDeviceProfile( argv[++i] );
+			if( !device )
+			{
+				PrintTuneUsage();
+				return -1;
+			}
+		}
+		else if( arg[0] != '-' )
+		{
+			// captures are grouped by the device they were recorded from
+			size_t d = 0;
+			while( d < devices.size() && devices[d].device != device )
+				d++;
+			if( d == devices.size() )
+			{
+				devices.push_back( TuneDevice() );
+				devices.back().device = device;
+				devices.back().captured_ms = 0;
+			}
+			devices[d].files.push_back( arg );
+		}
+		else
+		{
+			PrintTuneUsage();
+			return -1;
+		}
+	}
+	if( devices.empty() )
+	{
+		PrintTuneUsage();
+		return -1;
+	}
+	if( !any_mode )
+		modes.assign( modes.size(), true );
+
+	std::vector<TuneCandidate> candidates;
+	BuildCandidates( modes, candidates );
+
+	double captured_ms = 0;
+	for( size_t d = 0; d < devices.size(); d++ )
+	{
+		TuneDevice& tune = devices[d];
+		tune.captures.resize( tune.files.size() );
+		tune.references.resize( tune.files.size() );
+		for( size_t f = 0; f < tune.files.size(); f++ )
+		{
+			if( !LoadCapture( tune.files[f], tune.captures[f] ) )
+			{
+				std::printf( "Failed to open file %s\n", tune.files[f].c_str() );
+				return -1;
+			}
+			if( !tune.captures[f].empty() )
+				tune.captured_ms += tune.captures[f].back().time_ms;
+			ReferenceVelocity( *tune.device, tune.captures[f], kReplayStepMs, tune.references[f] );
+		}
+		tune.results.resize( candidates.size() );
+		captured_ms += tune.captured_ms;
+	}
+
+	// every candidate on every device is a job. Each writes only its own result
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint64_t steals;
+	int workers;
+	{
+		WorkStealingPool pool( threads );
+		workers = pool.Threads();
+		for( size_t d = 0; d < devices.size(); d++ )
+		{
+			for( size_t c = 0; c < candidates.size(); c++ )
+			{
+				TuneDevice* tune = &devices[d];
+				const TuneCandidate* candidate = &candidates[c];
+				pool.Submit( [tune, candidate, c]() { EvaluateCandidate( *candidate, *tune, c ); } );
+			}
+		}
+		pool.Wait();
+		steals = pool.Steals();
+	}
+	double elapsed_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+
+	std::printf( "Replayed %d settings over %.1fs of captures on %d threads in %.2fs (%.0fx real time, %llu jobs stolen)\n",
+				(int)candidates.size(), captured_ms / 1000, workers, elapsed_ms / 1000,
+				elapsed_ms > 0 ? captured_ms * candidates.size() / elapsed_ms : 0, (unsigned long long)steals );
+	for( size_t d = 0; d < devices.size(); d++ )
+		PrintFrontier( devices[d], candidates );
+	return 0;
+}
@@ -0,0 +1,17 @@
+//
+//  Tuner.h
+//  MidiSmoother
+//
+//  Offline search of the smoothing models' parameters. Every combination on a grid of each
+//  engine's parameters is replayed over the captures recorded from a device, on a virtual
+//  clock and in parallel across all cores, and the settings that no other setting beats on
+//  both lag and smoothness (the Pareto frontier) are reported per device.
+//
+
+#ifndef __MidiSmoother__Tuner__
+#define __MidiSmoother__Tuner__
+
+// Entry point for "MidiSmoother --tune ...". argv holds the arguments after --tune
+int RunTune( int argc, const char* argv[] );
+
+#endif /* defined(__MidiSmoother__Tuner__) */
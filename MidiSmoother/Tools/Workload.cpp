@@ -0,0 +1,488 @@
+//
+//  Workload.cpp
+//  MidiSmoother
+//
+
+#include "Workload.h"
+#include "Benchmark.h"
+#include "MidiSmoother.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <math.h>
+#include <random>
+#include <sstream>
+#include <thread>
+
+static const double kPi = 3.14159265358979323846;
+// integration step of the simulated platter (ms)
+static const double kSimulationStepMs = 0.05;
+// how quickly the platter follows the hand or motor, standing in for its inertia (ms)
+static const double kPlatterLagMs = 4.0;
+// the audio block VelocityConsumer requests: 7 audio steps
+static const int kAudioStepsPerBlock = 7;
+static const double kAudioBlockMs = kAudioStepsPerBlock * kReplayStepMs;
+// a stress rate is sustained if this fraction of the messages could be delivered
+static const double kSustainedFraction = 0.98;
+
+static const char* const kGestureNames[kNumPlatterGestures] =
+{
+	"play", "spindown", "baby", "transform", "stop", "backspin"
+};
+
+struct GestureSegment
+{
+	PlatterGesture gesture;
+	double start_ms;
+	double duration_ms;
+	double amplitude;		// peak velocity
+	double frequency_hz;	// of back and forth gestures
+};
+
+WorkloadSettings::WorkloadSettings() :
+device( DefaultDeviceProfile() ),
+duration_ms( 10000 ),
+message_rate_hz( 0 ),
+jitter_ms( 0.15 ),
+saturate( true ),
+gestures(),
+seed( 1234 )
+{
+}
+
+const char* PlatterGestureName( PlatterGesture gesture )
+{
+	return gesture >= 0 && gesture < kNumPlatterGestures ? kGestureNames[gesture] : "unknown";
+}
+
+bool PlatterGestureFromName( const std::string& name, PlatterGesture& gesture )
+{
+	for( int i = 0; i < kNumPlatterGestures; i++ )
+	{
+		if( name == kGestureNames[i] )
+		{
+			gesture = (PlatterGesture)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static GestureSegment NextGesture( PlatterGesture gesture, double start_ms, std::mt19937& random )
+/*
+ * Picks the shape of the next gesture within the range a DJ would plausibly perform it.
+ */
+{
+	std::uniform_real_distribution<double> uniform( 0.0, 1.0 );
+	GestureSegment segment;
+	segment.gesture = gesture;
+	segment.start_ms = start_ms;
+	segment.amplitude = 1;
+	segment.frequency_hz = 0;
+	switch( gesture )
+	{
+	case kGestureSpinDown:
+		segment.duration_ms = 600 + 1400 * uniform( random );
+		break;
+	case kGestureBabyScratch:
+		segment.amplitude = 1.5 + 2.5 * uniform( random );
+		segment.frequency_hz = 2 + 3 * uniform( random );
+		segment.duration_ms = ( 2 + (int)( 5 * uniform( random ) ) ) * 1000 / segment.frequency_hz;
+		break;
+	case kGestureTransform:
+		segment.amplitude = 0.5 + uniform( random );
+		segment.frequency_hz = 1 + 1.5 * uniform( random );
+		segment.duration_ms = ( 1 + (int)( 3 * uniform( random ) ) ) * 1000 / segment.frequency_hz;
+		break;
+	case kGestureStop:
+		segment.amplitude = 0.02;
+		segment.frequency_hz = 9;
+		segment.duration_ms = 100 + 500 * uniform( random );
+		break;
+	case kGestureBackspin:
+		segment.amplitude = 8 + 16 * uniform( random );
+		segment.duration_ms = 500 + 1000 * uniform( random );
+		break;
+	case kGesturePlay:
+	default:
+		segment.duration_ms = 300 + 1200 * uniform( random );
+		break;
+	}
+	return segment;
+}
+
+static double TargetVelocity( const GestureSegment& segment, double time_ms )
+/*
+ * The velocity the hand or motor is driving the platter towards during a gesture.
+ */
+{
+	double t = time_ms - segment.start_ms;
+	double phase = sin( 2 * kPi * segment.frequency_hz * t / 1000 );
+	switch( segment.gesture )
+	{
+	case kGestureSpinDown: return exp( -t / ( segment.duration_ms / 4 ) );
+	case kGestureBabyScratch: return segment.amplitude * phase;
+	case kGestureTransform: return phase >= 0 ? segment.amplitude : -segment.amplitude;
+	case kGestureStop: return segment.amplitude * phase;	// the tremor of a resting hand
+	case kGestureBackspin: return -segment.amplitude * exp( -t / ( segment.duration_ms / 3 ) );
+	case kGesturePlay:
+	default: return 1;
+	}
+}
+
+void GenerateWorkload( const WorkloadSettings& settings, std::vector<CaptureEvent>& events, std::vector<WorkloadTruth>* truth )
+/*
+ * Integrates the platter through a random sequence of gestures and polls it like the device.
+ * A message is only sent when the tick count has changed since the last poll, and a message
+ * that saturates loses the ticks beyond the limit, as they do on the real hardware.
+ *
+ * @param settings
+ *		The device and the session to generate
+ * @param events
+ *		Receives the messages in arrival order
+ * @param truth
+ *		If not NULL, receives the platter's true velocity at every message
+ */
+{
+	events.clear();
+	if( truth )
+		truth->clear();
+
+	std::vector<PlatterGesture> gestures = settings.gestures;
+	if( gestures.empty() )
+	{
+		for( int i = 0; i < kNumPlatterGestures; i++ )
+			gestures.push_back( (PlatterGesture)i );
+	}
+
+	std::mt19937 random( settings.seed );
+	std::uniform_int_distribution<size_t> choose( 0, gestures.size() - 1 );
+	std::normal_distribution<double> jitter( 0.0, std::max( settings.jitter_ms, 0.0 ) );
+
+	const double message_rate = settings.message_rate_hz > 0 ? settings.message_rate_hz : settings.device.message_rate_hz;
+	const double poll_interval = 1000 / message_rate;
+	const double ticks_per_ms = 1 / settings.device.MsPerTick();
+	const int quantization = std::max( settings.device.tick_quantization, 1 );
+	const int limit = settings.device.saturation_limit;
+	const double follow = 1 - exp( -kSimulationStepMs / kPlatterLagMs );
+
+	GestureSegment segment = NextGesture( gestures[choose( random )], 0, random );
+	double velocity = 0, position = 0;
+	long long polled_ticks = 0;
+	double next_poll = poll_interval;
+	double last_arrival = 0;
+	for( double now = 0; now < settings.duration_ms; now += kSimulationStepMs )
+	{
+		if( now >= segment.start_ms + segment.duration_ms )
+			segment = NextGesture( gestures[choose( random )], now, random );
+		velocity += ( TargetVelocity( segment, now ) - velocity ) * follow;
+		position += velocity * kSimulationStepMs;
+
+		if( now < next_poll )
+			continue;
+		next_poll += poll_interval;
+
+		long long ticks = (long long)floor( position * ticks_per_ms / quantization ) * quantization;
+		long long delta = ticks - polled_ticks;
+		polled_ticks = ticks;
+		if( delta == 0 )
+			continue;
+		if( settings.saturate && limit > 0 )
+			delta = std::max( (long long)-limit, std::min( delta, (long long)limit ) );
+
+		// delivery over USB is only ever late, and never reorders messages
+		double arrival = std::max( now + fabs( jitter( random ) ), last_arrival + 0.001 );
+		last_arrival = arrival;
+
+		CaptureEvent event;
+		event.time_ms = arrival;
+		event.midi_value = (int)delta;
+		events.push_back( event );
+		if( truth )
+		{
+			WorkloadTruth sample;
+			sample.time_ms = now;
+			sample.velocity = velocity;
+			truth->push_back( sample );
+		}
+	}
+}
+
+static void PrintGenerateUsage()
+{
+	std::printf( "Usage: MidiSmoother --generate [options] <output_csv>\n" );
+	std::printf( "  --device <name>      device to model (default %s)\n", DefaultDeviceProfile().name );
+	std::printf( "  --duration <ms>      length of the session (default 10000)\n" );
+	std::printf( "  --rate <hz>          message rate (default the device's)\n" );
+	std::printf( "  --jitter <ms>        standard deviation of the USB poll delay (default 0.15)\n" );
+	std::printf( "  --no-saturation      don't clamp messages to the device's limit\n" );
+	std::printf( "  --gestures <a,b,..>  gestures to use from play, spindown, baby, transform, stop, backspin\n" );
+	std::printf( "  --seed <n>           random seed (default 1234)\n" );
+	std::printf( "  --truth <csv>        also write the true velocity (time ms, velocity) at each message\n" );
+}
+
+int RunGenerate( int argc, const char* argv[] )
+{
+	WorkloadSettings settings;
+	std::string output, truth_file;
+	for( int i = 0; i < argc; i++ )
+	{
+		std::string arg = argv[i];
+		if( arg == "--device" && i + 1 < argc )
+		{
+			const DeviceProfile* device = FindDeviceProfile( argv[++i] );
+			if( !device )
+			{
+				PrintGenerateUsage();
+				return -1;
+			}
+			settings.device = *device;
+		}
+		else if( arg == "--duration" && i + 1 < argc )
+			settings.duration_ms = atof( argv[++i] );
+		else if( arg == "--rate" && i + 1 < argc )
+			settings.message_rate_hz = atof( argv[++i] );
+		else if( arg == "--jitter" && i + 1 < argc )
+			settings.jitter_ms = atof( argv[++i] );
+		else if( arg == "--no-saturation" )
+			settings.saturate = false;
+		else if( arg == "--seed" && i + 1 < argc )
+			settings.seed = (unsigned int)strtoul( argv[++i], NULL, 10 );
+		else if( arg == "--truth" && i + 1 < argc )
+			truth_file = argv[++i];
+		else if( arg == "--gestures" && i + 1 < argc )
+		{
+			std::istringstream names( argv[++i] );
+			std::string name;
+			while( std::getline( names, name, ',' ) )
+			{
+				PlatterGesture gesture;
+				if( !PlatterGestureFromName( name, gesture ) )
+				{
+					PrintGenerateUsage();
+					return -1;
+				}
+				settings.gestures.push_back( gesture );
+			}
+		}
+		else if( arg[0] != '-' )
+			output = arg;
+		else
+		{
+			PrintGenerateUsage();
+			return -1;
+		}
+	}
+	if( output.empty() )
+	{
+		PrintGenerateUsage();
+		return -1;
+	}
+
+	std::vector<CaptureEvent> events;
+	std::vector<WorkloadTruth> truth;
+	GenerateWorkload( settings, events, truth_file.empty() ? NULL : &truth );
+	if( !SaveCapture( output, events ) )
+	{
+		std::printf( "Failed to write file %s\n", output.c_str() );
+		return -1;
+	}
+	if( !truth_file.empty() )
+	{
+		std::ofstream stream( truth_file.c_str() );
+		if( !stream )
+		{
+			std::printf( "Failed to write file %s\n", truth_file.c_str() );
+			return -1;
+		}
+		for( size_t i = 0; i < truth.size(); i++ )
+			stream << truth[i].time_ms << "," << truth[i].velocity << "\n";
+	}
+
+	size_t saturated = 0;
+	for( size_t i = 0; i < events.size(); i++ )
+	{
+		if( std::abs( events[i].midi_value ) >= settings.device.saturation_limit )
+			saturated++;
+	}
+	std::printf( "%s: %zu messages over %.0fms from %s, %zu saturated\n", output.c_str(), events.size(), settings.duration_ms, settings.device.name, saturated );
+	return 0;
+}
+
+struct AudioStats
+{
+	AudioStats() : blocks( 0 ), misses( 0 ), worst_late_ms( 0 ) {}
+
+	long long blocks;
+	long long misses;
+	double worst_late_ms;	// how far the latest block finished after its deadline
+};
+
+static void StressAudioThread( const MidiSmoother* smoother, const std::atomic<bool>* running, AudioStats* stats )
+/*
+ * Requests a block of steps every audio period the way VelocityConsumer does, but on a fixed
+ * schedule so that a block finishing after the next one was due is counted as a miss.
+ */
+{
+	const std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::duration<double, std::milli>( kAudioBlockMs ) );
+	std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now();
+	volatile double sink = 0;
+	while( running->load() )
+	{
+		std::this_thread::sleep_until( due );
+		for( int i = 0; i < kAudioStepsPerBlock; i++ )
+			sink = sink + smoother->RequestMSToMoveValue( kAudioBlockMs / kAudioStepsPerBlock );
+
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		double late_ms = std::chrono::duration<double, std::milli>( end - ( due + period ) ).count();
+		stats->blocks++;
+		if( late_ms > 0 )
+		{
+			stats->misses++;
+			stats->worst_late_ms = std::max( stats->worst_late_ms, late_ms );
+		}
+		// a block that is already overdue is dropped rather than played late
+		due += period;
+		while( due + period < end )
+		{
+			due += period;
+			stats->misses++;
+		}
+	}
+}
+
+struct StressResult
+{
+	double achieved_hz;
+	double mean_ns;		// per NotifyMidiValue, including waiting for the smoother's lock
+	double worst_us;
+	AudioStats audio;
+};
+
+static StressResult StressAtRate( const DeviceProfile& device, const char* mode_name, double rate_hz, double seconds )
+/*
+ * Fires single tick messages into a fresh smoother at the given rate for a while, with the audio
+ * path running alongside. Messages are paced against a schedule, so a producer that can't keep up
+ * shows as a lower achieved rate rather than a longer run.
+ */
+{
+	MidiSmoother smoother( device );
+	MidiSmoother::SmoothingMode mode;
+	if( mode_name && MidiSmoother::SmoothingModeFromName( mode_name, mode ) )
+		smoother.SetSmoothingMode( mode );
+	smoother.StartMidiProcessing();
+
+	StressResult result;
+	std::atomic<bool> running( true );
+	std::thread audio( StressAudioThread, &smoother, &running, &result.audio );
+
+	const std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::duration<double>( 1 / rate_hz ) );
+	const std::chrono::steady_clock::duration length = std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::duration<double>( seconds ) );
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point due = start;
+	std::chrono::steady_clock::time_point now = start;
+	long long sent = 0;
+	double total_ns = 0, worst_ns = 0;
+	while( now - start < length )
+	{
+		if( now < due )
+		{
+			// sleep when there's time to, otherwise spin as a busy controller driver would
+			if( due - now > std::chrono::microseconds( 200 ) )
+				std::this_thread::sleep_until( due - std::chrono::microseconds( 100 ) );
+			now = std::chrono::steady_clock::now();
+			continue;
+		}
+		smoother.NotifyMidiValue( 1 );
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		double ns = std::chrono::duration<double, std::nano>( end - now ).count();
+		total_ns += ns;
+		worst_ns = std::max( worst_ns, ns );
+		sent++;
+		due += period;
+		now = end;
+	}
+	double elapsed = std::chrono::duration<double>( now - start ).count();
+
+	running = false;
+	audio.join();
+	smoother.StopMidiProcessing();
+
+	result.achieved_hz = sent / std::max( elapsed, 1e-9 );
+	result.mean_ns = sent > 0 ? total_ns / sent : 0;
+	result.worst_us = worst_ns / 1000;
+	return result;
+}
+
+static void PrintStressUsage()
+{
+	std::printf( "Usage: MidiSmoother --stress [options]\n" );
+	std::printf( "  --device <name>      device to model (default %s)\n", DefaultDeviceProfile().name );
+	std::printf( "  --mode <name>        smoothing mode (default the device's)\n" );
+	std::printf( "  --start-rate <hz>    first message rate (default 1000)\n" );
+	std::printf( "  --max-rate <hz>      rate to stop at (default 4096000)\n" );
+	std::printf( "  --seconds <s>        time spent at each rate (default 1)\n" );
+}
+
+int RunStress( int argc, const char* argv[] )
+/*
+ * Doubles the message rate until either the producer can no longer deliver it or the audio path
+ * misses a deadline, and reports the highest rate sustained.
+ */
+{
+	const DeviceProfile* device = &DefaultDeviceProfile();
+	const char* mode_name = NULL;
+	double start_rate = 1000, max_rate = 4096000, seconds = 1;
+	for( int i = 0; i < argc; i++ )
+	{
+		std::string arg = argv[i];
+		MidiSmoother::SmoothingMode mode;
+		if( arg == "--device" && i + 1 < argc && ( device = FindDeviceProfile( argv[i + 1] ) ) )
+			i++;
+		else if( arg == "--mode" && i + 1 < argc && MidiSmoother::SmoothingModeFromName( argv[i + 1], mode ) )
+			mode_name = argv[++i];
+		else if( arg == "--start-rate" && i + 1 < argc )
+			start_rate = atof( argv[++i] );
+		else if( arg == "--max-rate" && i + 1 < argc )
+			max_rate = atof( argv[++i] );
+		else if( arg == "--seconds" && i + 1 < argc )
+			seconds = atof( argv[++i] );
+		else
+		{
+			PrintStressUsage();
+			return -1;
+		}
+	}
+	if( start_rate <= 0 || seconds <= 0 )
+	{
+		PrintStressUsage();
+		return -1;
+	}
+
+	MidiSmoother::SmoothingMode mode;
+	const char* shown_mode = mode_name ? mode_name : device->default_mode;
+	if( !MidiSmoother::SmoothingModeFromName( shown_mode, mode ) )
+		shown_mode = MidiSmoother::SmoothingModeName( MidiSmoother::kSmoothingRegression );
+	std::printf( "device %s, mode %s, audio block %.2fms\n", device->name, shown_mode, kAudioBlockMs );
+	std::printf( "%12s %12s %10s %10s %8s %8s %10s\n", "rate", "achieved", "ns/msg", "worst us", "blocks", "misses", "worst late" );
+
+	double sustained = 0;
+	for( double rate = start_rate; rate <= max_rate; rate *= 2 )
+	{
+		StressResult result = StressAtRate( *device, mode_name, rate, seconds );
+		std::printf( "%12.0f %12.0f %10.1f %10.1f %8lld %8lld %8.3fms\n", rate, result.achieved_hz, result.mean_ns, result.worst_us,
+					result.audio.blocks, result.audio.misses, result.audio.worst_late_ms );
+		if( result.achieved_hz < rate * kSustainedFraction || result.audio.misses > 0 )
+			break;
+		sustained = rate;
+	}
+	if( sustained > 0 )
+		std::printf( "max sustained rate: %.0f messages/s\n", sustained );
+	else
+		std::printf( "max sustained rate: below %.0f messages/s\n", start_rate );
+	return 0;
+}
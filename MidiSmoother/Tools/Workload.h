@@ -0,0 +1,66 @@
+//
+//  Workload.h
+//  MidiSmoother
+//
+//  Synthetic platter sessions. A sequence of gestures (playing, spin downs, baby scratches,
+//  transforms, stops and backspins) describes the platter's velocity over time, and the
+//  motion is sampled the way a controller does: the position is quantized to ticks, polled
+//  at the device's message rate with USB poll jitter, and each message saturates at the
+//  largest delta the device can report. The result is a capture in the MidiFirer format
+//  together with the true velocity it was generated from.
+//
+
+#ifndef __MidiSmoother__Workload__
+#define __MidiSmoother__Workload__
+
+#include <string>
+#include <vector>
+
+#include "Capture.h"
+#include "Devices/DeviceProfile.h"
+
+enum PlatterGesture
+{
+	kGesturePlay,			// motor on, normal speed
+	kGestureSpinDown,		// motor off, the platter coasting to a stop
+	kGestureBabyScratch,	// the record pushed back and forth about a point
+	kGestureTransform,		// slow even drags forwards and back while the fader is chopped
+	kGestureStop,			// a hand resting on the platter
+	kGestureBackspin,		// the record flung backwards and left to slow down
+	kNumPlatterGestures
+};
+
+struct WorkloadSettings
+{
+	WorkloadSettings();
+
+	DeviceProfile device;
+	double duration_ms;				// length of the session
+	double message_rate_hz;			// polls per second, 0 for the device's own rate
+	double jitter_ms;				// standard deviation of the USB poll time
+	bool saturate;					// clamp each message to the device's saturation limit
+	std::vector<PlatterGesture> gestures;	// the gestures to choose from, empty for all of them
+	unsigned int seed;
+};
+
+// A sample of the motion the capture was generated from
+struct WorkloadTruth
+{
+	double time_ms;
+	double velocity;		// song ms per ms
+};
+
+const char* PlatterGestureName( PlatterGesture gesture );
+
+bool PlatterGestureFromName( const std::string& name, PlatterGesture& gesture );
+
+// Generates a session. truth, if given, receives the true velocity at every message
+void GenerateWorkload( const WorkloadSettings& settings, std::vector<CaptureEvent>& events, std::vector<WorkloadTruth>* truth );
+
+// Entry point for "MidiSmoother --generate ...". argv holds the arguments after --generate
+int RunGenerate( int argc, const char* argv[] );
+
+// Entry point for "MidiSmoother --stress ...". argv holds the arguments after --stress
+int RunStress( int argc, const char* argv[] );
+
+#endif /* defined(__MidiSmoother__Workload__) */
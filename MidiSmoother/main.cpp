@@ -8,9 +8,29 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <algorithm>
 
 #include "Input/MidiFirer.h"
+#include "Input/SharedMemoryIngress.h"
+#include "Output/MetricsServer.h"
+#include "Output/ShadowComparison.h"
+#include "Output/VelocityCapture.h"
 #include "Output/VelocityConsumer.h"
+#include "Output/VelocityReader.h"
+#include "Threading/ThreadConfig.h"
+#include "Threading/Tracer.h"
+#include "Tools/BatchRender.h"
+#include "Tools/Benchmark.h"
+#include "Tools/Reference.h"
+#include "Tools/SharedMemoryProducer.h"
+#include "Tools/TraceExport.h"
+#include "Tools/Tuner.h"
+#include "Tools/Workload.h"
 
 void PrintUsage( const char* binary_name )
 /*
@@ -20,10 +40,59 @@ void PrintUsage( const char* binary_name )
  *		The name of the current binary
  */
 {
-	std::cout << "Usage: " << binary_name << " <midi_file>" << std::endl;
+	std::cout << "Usage: " << binary_name << " <midi_file> [output_wav] [--device <name>] [--mode regression|spline|oneeuro|robust|lastdelta] [--latency <ms>] [--stop-timeout <ms>] [--stream] [--follow] [--readers <n>] [--reactor] [--rt <role>=<policy>[:<priority>][@<cpu>]]... [--mlock] [--prefault-stack <KB>] [--update-budget <us>] [--no-warmup] [--trace <csv>] [--trace-dump <file>] [--no-tracing] [--metrics <socket>] [--velocity-out none|binary|text] [--shadow <mode>] [--shadow-latency <ms>] [--capture <file> | -] [--capture-seconds <s>]" << std::endl;
+	std::cout << "       --reactor runs the firer, smoother and consumer as tasks on the main thread instead of a thread each" << std::endl;
+	std::cout << "       --update-budget steps down to cheaper models (ending with lastdelta) while a model update costs more than the budget" << std::endl;
+	std::cout << "       --rt sets the scheduling of the midi, smoother, audio or reactor thread, e.g. audio=fifo:80@2. Policies are default, fifo and rr" << std::endl;
+	std::cout << "       --trace-dump writes the flight recorder to <file> at exit and whenever the process gets SIGUSR1" << std::endl;
+	std::cout << "       --velocity-out sets how each step's velocity goes to stdout: not at all, as native doubles, or a line each (the default)" << std::endl;
+	std::cout << "       --shadow runs a second smoother with the given mode on the same midi and reports how it compares with the one heard" << std::endl;
+	std::cout << "       --no-warmup leaves the first messages after a start from rest to the model alone" << std::endl;
+	std::cout << "       --capture keeps every step's velocity for a report at exit, in a file for --capture-report or in memory with -. Up to --capture-seconds (600) are kept" << std::endl;
+	std::cout << "       --metrics serves live counters on a Unix socket, e.g. curl --unix-socket <socket> http://localhost/metrics" << std::endl;
+	std::cout << "       <midi_file> may be - for stdin, or shm:<name> to take events from a --produce process. --stream fires events as they are read, --follow keeps reading a file that is still being written" << std::endl;
+	std::cout << "       " << binary_name << " --bench [--device <name>] [--bunch <fraction>] [--repeat <n>] <midi_file>..." << std::endl;
+	std::cout << "       " << binary_name << " --batch [--threads <n>] [--out <dir>] [--device <name>] [--mode <name>] <directory | manifest>..." << std::endl;
+	std::cout << "       " << binary_name << " --reference [--device <name>] [--cutoff <hz>] <midi_file> <output_csv>" << std::endl;
+	std::cout << "       " << binary_name << " --trace-export <trace_file> <output_json>" << std::endl;
+	std::cout << "       " << binary_name << " --capture-report <capture_file> [output_csv]" << std::endl;
+	std::cout << "       " << binary_name << " --tune [--threads <n>] [--mode <name>]... [--device <name>] <midi_file>..." << std::endl;
+	std::cout << "       " << binary_name << " --generate [--device <name>] [--duration <ms>] [--gestures <a,b,..>] ... <output_csv>" << std::endl;
+	std::cout << "       " << binary_name << " --produce [--name <name>] [--rate <hz>] [--count <n>] [<midi_file>]" << std::endl;
+	std::cout << "       " << binary_name << " --stress [--device <name>] [--mode <name>] [--start-rate <hz>] [--max-rate <hz>] [--seconds <s>]" << std::endl;
+	std::cout << "Devices:";
+	for( int i = 0; i < NumDeviceProfiles(); i++ )
+		std::cout << " " << DeviceProfileAt( i ).name;
+	std::cout << " (default " << DefaultDeviceProfile().name << ")" << std::endl;
 	exit(-1);
 }
 
+void ExtraReaderThreadFunction( VelocityReader* reader, const MidiSmoother* smoother, double period_ms, const std::atomic<bool>* running )
+/*
+ * Stands in for another part of the product reading the same deck as the audio, such as a
+ * waveform renderer, at its own rate.
+ */
+{
+	SetTraceThreadName( reader->Name().c_str() );
+	volatile double sink = 0;
+	while( *running )
+	{
+		sink = sink + reader->VelocityAt( smoother->CurrentTimeMs() );
+		std::this_thread::sleep_for( std::chrono::microseconds( (long long)( period_ms * 1000 ) ) );
+	}
+}
+
+void PrintWakeupLatency( const char* thread, const LatencyHistogram& latency )
+/*
+ * Prints how late a periodic thread woke against its schedule
+ */
+{
+	if( latency.Count() == 0 )
+		return;
+	std::cerr << "Wakeup " << thread << ": " << latency.Count() << " wakeups, late mean " << latency.Mean() << "us, p99 " << latency.Percentile( 0.99 )
+		<< "us, max " << latency.Max() << "us" << std::endl;
+}
+
 int main(int argc, const char * argv[])
 {
 	if( argc < 2 )
@@ -31,17 +100,247 @@ int main(int argc, const char * argv[])
 		PrintUsage( argv[0]);
 	}
 
-	std::string output = (argc >= 3) ? argv[2] : "output.wav";
+	if( std::string( argv[1] ) == "--bench" )
+		return RunBenchmark( argc - 2, argv + 2 );
+	if( std::string( argv[1] ) == "--batch" )
+		return RunBatch( argc - 2, argv + 2 );
+	if( std::string( argv[1] ) == "--reference" )
+		return RunReference( argc - 2, argv + 2 );
+	if( std::string( argv[1] ) == "--trace-export" )
+		return RunTraceExport( argc - 2, argv + 2 );
+	if( std::string( argv[1] ) == "--capture-report" )
+		return RunCaptureReport( argc - 2, argv + 2 );
+	if( std::string( argv[1] ) == "--tune" )
+		return RunTune( argc - 2, argv + 2 );
+	if( std::string( argv[1] ) == "--generate" )
+		return RunGenerate( argc - 2, argv + 2 );
+	if( std::string( argv[1] ) == "--stress" )
+		return RunStress( argc - 2, argv + 2 );
+	if( std::string( argv[1] ) == "--produce" )
+		return RunProduce( argc - 2, argv + 2 );
 
-	// The values for the smoother are from the real world. This particular device has 2048 'clicks' around it's wheel
-	// and all devices have one revolution is 1.8 seconds (it's a DJ thing)
-	MidiSmoother smoother( 2048, 1.8 );
+	std::string output = "output.wav";
+	std::string trace = "out.csv";
+	std::string trace_dump;
+	std::string metrics_socket;
+	VelocitySink::Mode velocity_out = VelocitySink::kSinkText;
+	const char* shadow_mode_name = NULL;
+	double shadow_latency_budget = -1;
+	bool warmup = true;
+	std::string capture_file;
+	double capture_seconds = 600;
+	const DeviceProfile* device = &DefaultDeviceProfile();
+	const char* mode_name = NULL;
+	double latency_budget = -1;
+	double stop_timeout = -1;
+	double update_budget = -1;
+	bool stream = std::string( argv[1] ) == "-";
+	bool follow = false;
+	int extra_readers = 0;
+	bool use_reactor = false;
+	bool real_time = false;
+	bool lock_memory = false;
+	long long prefault_kb = -1;
+	for( int i = 2; i < argc; i++ )
+	{
+		std::string arg = argv[i];
+		if( arg == "--device" && i + 1 < argc )
+		{
+			device = FindDeviceProfile( argv[++i] );
+			if( !device )
+				PrintUsage( argv[0] );
+		}
+		else if( arg == "--mode" && i + 1 < argc )
+		{
+			MidiSmoother::SmoothingMode mode;
+			mode_name = argv[++i];
+			if( !MidiSmoother::SmoothingModeFromName( mode_name, mode ) )
+				PrintUsage( argv[0] );
+		}
+		else if( arg == "--latency" && i + 1 < argc )
+		{
+			latency_budget = atof( argv[++i] );
+		}
+		else if( arg == "--stop-timeout" && i + 1 < argc )
+		{
+			stop_timeout = atof( argv[++i] );
+		}
+		else if( arg == "--trace" && i + 1 < argc )
+		{
+			trace = argv[++i];
+		}
+		else if( arg == "--trace-dump" && i + 1 < argc )
+		{
+			trace_dump = argv[++i];
+		}
+		else if( arg == "--shadow" && i + 1 < argc )
+		{
+			MidiSmoother::SmoothingMode mode;
+			shadow_mode_name = argv[++i];
+			if( !MidiSmoother::SmoothingModeFromName( shadow_mode_name, mode ) )
+				PrintUsage( argv[0] );
+		}
+		else if( arg == "--capture" && i + 1 < argc )
+		{
+			capture_file = argv[++i];
+		}
+		else if( arg == "--capture-seconds" && i + 1 < argc )
+		{
+			capture_seconds = atof( argv[++i] );
+		}
+		else if( arg == "--shadow-latency" && i + 1 < argc )
+		{
+			shadow_latency_budget = atof( argv[++i] );
+		}
+		else if( arg == "--velocity-out" && i + 1 < argc )
+		{
+			if( !VelocitySink::ModeFromName( argv[++i], velocity_out ) )
+				PrintUsage( argv[0] );
+		}
+		else if( arg == "--metrics" && i + 1 < argc )
+		{
+			metrics_socket = argv[++i];
+		}
+		else if( arg == "--no-tracing" )
+		{
+			SetTracing( false );
+		}
+		else if( arg == "--no-warmup" )
+		{
+			warmup = false;
+		}
+		else if( arg == "--update-budget" && i + 1 < argc )
+		{
+			update_budget = atof( argv[++i] );
+		}
+		else if( arg == "--stream" )
+		{
+			stream = true;
+		}
+		else if( arg == "--readers" && i + 1 < argc )
+		{
+			extra_readers = std::max( 0, atoi( argv[++i] ) );
+		}
+		else if( arg == "--reactor" )
+		{
+			use_reactor = true;
+		}
+		else if( arg == "--rt" && i + 1 < argc )
+		{
+			ThreadRole role;
+			ThreadSettings settings;
+			if( !ParseThreadSettings( argv[++i], role, settings ) )
+				PrintUsage( argv[0] );
+			SetThreadSettings( role, settings );
+			real_time = true;
+		}
+		else if( arg == "--mlock" )
+		{
+			lock_memory = true;
+		}
+		else if( arg == "--prefault-stack" && i + 1 < argc )
+		{
+			prefault_kb = std::max( 0LL, atoll( argv[++i] ) );
+		}
+		else if( arg == "--follow" )
+		{
+			stream = true;
+			follow = true;
+		}
+		else if( arg[0] != '-' )
+			output = arg;
+		else
+			PrintUsage( argv[0] );
+	}
+
+	// every thread's stack is touched as it starts if asked, not just the real time ones
+	if( prefault_kb >= 0 )
+	{
+		for( int i = 0; i < kNumThreadRoles; i++ )
+		{
+			ThreadSettings settings = GetThreadSettings( (ThreadRole)i );
+			settings.prefault_stack_bytes = (size_t)prefault_kb * 1024;
+			SetThreadSettings( (ThreadRole)i, settings );
+		}
+	}
+	if( lock_memory && !LockProcessMemory() )
+		std::cerr << "Couldn't lock memory, continuing without it" << std::endl;
+	SetTraceThreadName( "main" );
+
+	// The values for the smoother are from the real world, described by the device profile. The bundled captures
+	// come from a device with 2048 'clicks' around it's wheel, and all devices have one revolution is 1.8 seconds (it's a DJ thing)
+	MidiSmoother smoother( *device );
+	if( mode_name )
+	{
+		MidiSmoother::SmoothingMode mode;
+		MidiSmoother::SmoothingModeFromName( mode_name, mode );
+		smoother.SetSmoothingMode( mode );
+	}
+	smoother.SetLatencyBudget( latency_budget );
+	if( stop_timeout >= 0 )
+		smoother.SetStopTimeout( stop_timeout );
+	smoother.SetUpdateBudget( update_budget );
+	smoother.SetWarmup( warmup );
+	MetricsServer metrics;
+	metrics.AddDeck( "deck1", smoother.Metrics() );
+	if( !metrics_socket.empty() && !metrics.Start( metrics_socket ) )
+		std::cerr << "Couldn't serve metrics on " << metrics_socket << ", continuing without them" << std::endl;
     MidiFirer firer( smoother );
-    VelocityConsumer consumer( smoother, output );
+    VelocityConsumer consumer( smoother, output, trace, velocity_out );
+
+	// a shadow smoother hears the same midi as the deck but is only compared with it, never played
+	MidiSmoother shadow_smoother( *device );
+	if( shadow_mode_name )
+	{
+		MidiSmoother::SmoothingMode mode;
+		MidiSmoother::SmoothingModeFromName( shadow_mode_name, mode );
+		shadow_smoother.SetSmoothingMode( mode );
+	}
+	shadow_smoother.SetLatencyBudget( shadow_latency_budget );
+	if( stop_timeout >= 0 )
+		shadow_smoother.SetStopTimeout( stop_timeout );
+	ShadowComparison shadow( smoother, shadow_smoother );
+
+	// all of the capture's space is taken now, before the audio starts
+	size_t capture_records = capture_file.empty() ? 0 : (size_t)std::max( 0.0, capture_seconds * 1000.0 / kReplayStepMs );
+	VelocityCapture capture( capture_records, capture_file == "-" ? "" : capture_file );
+	if( !capture_file.empty() )
+	{
+		if( capture.IsOpen() )
+			consumer.SetCapture( &capture );
+		else
+			std::cerr << "Couldn't make a capture in " << capture_file << ", continuing without one" << std::endl;
+	}
+	if( shadow_mode_name )
+	{
+		firer.SetShadow( &shadow );
+		consumer.SetShadow( &shadow );
+	}
 	
-	// Load MIDI data from the supplied file argument
+	// Midi from another process arrives through shared memory instead of the firer
+	std::string input = argv[1];
+	bool shared_memory = input.compare( 0, 4, "shm:" ) == 0;
+	if( shared_memory && ( use_reactor || shadow_mode_name ) )
+		PrintUsage( argv[0] );
+	SharedMemoryIngress ingress( smoother );
+	std::ifstream filestream;
+	if( shared_memory )
+	{
+		std::string name = input.size() > 4 ? input.substr( 4 ) : SharedMidiRing::kDefaultName;
+		if( !ingress.Open( name, 4096 ) )
+		{
+			std::cout << "Failed to create shared memory ring " << name << ", or another consumer is using it" << std::endl;
+			exit(-1);
+		}
+	}
+	// Load MIDI data from the supplied file argument, or stream it in while firing
+	else if( input == "-" )
 	{
-		std::ifstream filestream = std::ifstream(argv[1]);
+		firer.StreamMidiDataFromStream( std::cin, false );
+	}
+	else
+	{
+		filestream.open( argv[1] );
 		
 		if( !filestream )
 		{
@@ -49,14 +348,101 @@ int main(int argc, const char * argv[])
 			exit(-1);
 		}
 	
-		firer.LoadMidiDataFromStream(filestream);
+		if( stream )
+			firer.StreamMidiDataFromStream( filestream, follow );
+		else
+			firer.LoadMidiDataFromStream( filestream );
+	}
+
+	// dumps on request only start once the input is known to be good, as the error exits above don't stop them
+	if( !trace_dump.empty() )
+		DumpTraceOnSignal( trace_dump );
+
+	// any other readers of the deck run alongside the audio
+	std::atomic<bool> readers_running( true );
+	std::vector<VelocityReader*> readers;
+	std::vector<std::thread> reader_threads;
+	for( int i = 0; i < extra_readers; i++ )
+	{
+		std::ostringstream name;
+		name << "reader" << i + 1;
+		readers.push_back( new VelocityReader( smoother, name.str() ) );
+		reader_threads.push_back( std::thread( ExtraReaderThreadFunction, readers.back(), &smoother, 1.0, &readers_running ) );
 	}
     
 	// start the firer and consumer
-    firer.Start();
-	consumer.Start();
-    firer.WaitForCompletion();
-    consumer.WaitForCompletion();
+	Reactor reactor;
+	if( use_reactor )
+	{
+		firer.Schedule( reactor );
+		consumer.Schedule( reactor );
+		ApplyThreadSettings( kThreadRoleReactor );
+		reactor.Run();
+		firer.WaitForCompletion();
+	}
+	else
+	{
+		if( shared_memory )
+			ingress.Start();
+		else
+			firer.Start();
+		consumer.Start();
+		if( shared_memory )
+			ingress.WaitForCompletion();
+		else
+			firer.WaitForCompletion();
+		consumer.WaitForCompletion();
+	}
+
+	if( shadow_mode_name )
+	{
+		shadow.End();
+		shadow.Finish();
+	}
+	readers_running = false;
+	for( size_t i = 0; i < reader_threads.size(); i++ )
+		reader_threads[i].join();
+	metrics.Stop();
+	if( !trace_dump.empty() )
+	{
+		DumpTraceOnSignal( "" );
+		if( !DumpTrace( trace_dump ) )
+			std::cerr << "Couldn't write the trace to " << trace_dump << std::endl;
+	}
+
+	if( shared_memory )
+	{
+		const LatencyHistogram& latency = ingress.Latency();
+		std::cerr << "Ingress: " << latency.Count() << " events, latency mean " << latency.Mean() << "us, p50 " << latency.Percentile( 0.5 )
+			<< "us, p99 " << latency.Percentile( 0.99 ) << "us, max " << latency.Max() << "us" << std::endl;
+		if( ingress.ProducerLost() )
+			std::cerr << "The producer exited without finishing its stream" << std::endl;
+	}
+	if( use_reactor )
+		reactor.Report( std::cerr );
+	std::cerr << "Smoother: " << smoother.ServiceWakeups() << " wakeups, " << smoother.WakeupsAvoided() << " avoided while idle" << std::endl;
+	if( real_time && !use_reactor )
+	{
+		PrintWakeupLatency( "midi", firer.WakeupLatency() );
+		PrintWakeupLatency( "smoother", smoother.WakeupLatency() );
+		PrintWakeupLatency( "audio", consumer.WakeupLatency() );
+	}
+	if( extra_readers > 0 )
+		VelocityReader::Report( smoother, std::cerr );
+	for( size_t i = 0; i < readers.size(); i++ )
+		delete readers[i];
+	if( update_budget >= 0 )
+	{
+		MidiSmoother::QosStats qos = smoother.GetQosStats();
+		std::cerr << "QoS: finished on " << MidiSmoother::SmoothingModeName( qos.mode ) << " (level " << qos.level << "), " << qos.downgrades
+			<< " downgrades, " << qos.upgrades << " upgrades, update cost " << qos.update_cost_us << "us (budget " << update_budget << "us)" << std::endl;
+	}
+	if( latency_budget >= 0 )
+		std::cerr << "Effective latency: " << smoother.EffectiveLatency() << "ms (budget " << latency_budget << "ms)" << std::endl;
+	if( shadow_mode_name )
+		shadow.Report( std::cerr );
+	if( !capture_file.empty() && capture.IsOpen() )
+		capture.Report( std::cerr );
     
     return 0;
 }